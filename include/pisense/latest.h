@@ -0,0 +1,143 @@
+/*
+ * Reader for the "latest values" shared memory segment published by PiSense ([Exporter.SharedMemory]).
+ *
+ * Header-only and usable from both C and C++. The segment is guarded by a seqlock: the writer bumps `sequence` to an
+ * odd value, updates the values and bumps it back to even, and never waits for anyone. Readers copy the values and
+ * retry if the sequence changed underneath them, so a read is a few dozen loads with no syscalls and no locks.
+ *
+ *   struct pisense_latest *latest = pisense_latest_open("/pisense");
+ *   struct pisense_latest_snapshot snapshot;
+ *   int humidity = pisense_latest_index(latest, "humidity");
+ *
+ *   if (pisense_latest_read(latest, &snapshot) == 0 && humidity >= 0) {
+ *     printf("%f\n", snapshot.values[humidity].value);
+ *   }
+ *
+ *   pisense_latest_close(latest);
+ */
+#ifndef PISENSE_LATEST_H
+#define PISENSE_LATEST_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PISENSE_LATEST_MAGIC 0x5453544C45534950ULL /* "PISELTST" in little endian */
+#define PISENSE_LATEST_VERSION 1
+#define PISENSE_LATEST_MAX_METRICS 32
+#define PISENSE_LATEST_NAME_SIZE 32
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct pisense_latest_value {
+  double value;
+  int64_t timestamp; /* Unix time in nanoseconds of the sample that last carried this metric, 0 if none has yet */
+};
+
+struct pisense_latest_snapshot {
+  int64_t timestamp; /* Unix time in nanoseconds of the newest sample */
+  uint64_t samples;  /* Samples published since the segment was created */
+  struct pisense_latest_value values[PISENSE_LATEST_MAX_METRICS];
+};
+
+/* Everything before `sequence` is written once, before `magic` is set, and never changes afterwards */
+struct pisense_latest {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t metric_count;
+  char names[PISENSE_LATEST_MAX_METRICS][PISENSE_LATEST_NAME_SIZE];
+  uint64_t sequence __attribute__((aligned(64)));
+  struct pisense_latest_snapshot data;
+};
+
+/* Maps the segment read-only. Returns NULL with errno set if it doesn't exist or wasn't written by PiSense. */
+static inline struct pisense_latest *pisense_latest_open(const char *name) {
+  const int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+
+  if (fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(struct pisense_latest)) {
+    close(fd);
+    errno = EPROTO;
+    return NULL;
+  }
+
+  void *map = mmap(NULL, sizeof(struct pisense_latest), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+
+  struct pisense_latest *latest = (struct pisense_latest *)map;
+
+  if (__atomic_load_n(&latest->magic, __ATOMIC_ACQUIRE) != PISENSE_LATEST_MAGIC ||
+      latest->version != PISENSE_LATEST_VERSION) {
+    munmap(map, sizeof(struct pisense_latest));
+    errno = EPROTO;
+    return NULL;
+  }
+
+  return latest;
+}
+
+static inline void pisense_latest_close(struct pisense_latest *latest) {
+  if (latest != NULL) {
+    munmap(latest, sizeof(struct pisense_latest));
+  }
+}
+
+/* Index of a metric by name (e.g. "humidity"), or -1 if the writer doesn't publish it */
+static inline int pisense_latest_index(const struct pisense_latest *latest, const char *name) {
+  for (uint32_t i = 0; i < latest->metric_count && i < PISENSE_LATEST_MAX_METRICS; i++) {
+    if (strncmp(latest->names[i], name, PISENSE_LATEST_NAME_SIZE) == 0) {
+      return (int)i;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ * Copies a consistent snapshot of the latest values. Retries while the writer is mid-update, which only ever lasts
+ * for a handful of stores; gives up with -1 and errno EAGAIN after `PISENSE_LATEST_MAX_RETRIES` attempts.
+ */
+#ifndef PISENSE_LATEST_MAX_RETRIES
+#define PISENSE_LATEST_MAX_RETRIES 1000
+#endif
+
+static inline int pisense_latest_read(const struct pisense_latest *latest, struct pisense_latest_snapshot *snapshot) {
+  for (int attempt = 0; attempt < PISENSE_LATEST_MAX_RETRIES; attempt++) {
+    const uint64_t before = __atomic_load_n(&latest->sequence, __ATOMIC_ACQUIRE);
+
+    if ((before & 1) != 0) {
+      continue;
+    }
+
+    memcpy(snapshot, (const void *)&latest->data, sizeof(struct pisense_latest_snapshot));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&latest->sequence, __ATOMIC_RELAXED) == before) {
+      return 0;
+    }
+  }
+
+  errno = EAGAIN;
+  return -1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PISENSE_LATEST_H */
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <expected>
+#include <format>
+#include <memory>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <poll.h>
+
+#include <spdlog/common.h>
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "control.hpp"
+#include "deadband.hpp"
+#include "exporter.hpp"
+#include "i2c.hpp"
+#include "iio.hpp"
+#include "sample.hpp"
+#include "sense_hat.hpp"
+#include "telemetry.hpp"
+#include "timestamp.hpp"
+
+// Trace and debug messages compile out along with SPDLOG_TRACE/SPDLOG_DEBUG (see PISENSE_LOG_LEVEL)
+struct SpdLogger {
+  template <typename... Args>
+  static void trace([[maybe_unused]] std::format_string<Args...> format, [[maybe_unused]] Args &&...args) {
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+    SpdLogger::log(spdlog::level::trace, format, std::forward<Args>(args)...);
+#endif
+  }
+
+  template <typename... Args>
+  static void debug([[maybe_unused]] std::format_string<Args...> format, [[maybe_unused]] Args &&...args) {
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+    SpdLogger::log(spdlog::level::debug, format, std::forward<Args>(args)...);
+#endif
+  }
+
+  template <typename... Args>
+  static void info(std::format_string<Args...> format, Args &&...args) {
+    SpdLogger::log(spdlog::level::info, format, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void warn(std::format_string<Args...> format, Args &&...args) {
+    SpdLogger::log(spdlog::level::warn, format, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void error(std::format_string<Args...> format, Args &&...args) {
+    SpdLogger::log(spdlog::level::err, format, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void critical(std::format_string<Args...> format, Args &&...args) {
+    SpdLogger::log(spdlog::level::critical, format, std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void log(spdlog::level::level_enum level, std::format_string<Args...> format, Args &&...args) {
+    if (spdlog::should_log(level)) {
+      spdlog::log(level, std::format(format, std::forward<Args>(args)...));
+    }
+  }
+};
+
+// Fahrenheit is derived from the Celsius reading, and only worked out when it is consumed
+inline void setTemperature(Sample &sample, uint32_t metrics, double tempC) {
+  if ((metrics & metricBit(Metric::TemperatureCelsius)) != 0) {
+    sample.set(Metric::TemperatureCelsius, tempC);
+  }
+
+  if ((metrics & metricBit(Metric::TemperatureFahrenheit)) != 0) {
+    sample.set(Metric::TemperatureFahrenheit, (tempC * (9.0 / 5.0)) + 32.0);
+  }
+}
+
+/**
+ * Everything that happens to a sample of one board once it has been read: caching it for clients of the control
+ * socket, the deadband, the console line and handing it to the exporter. Shared by every way of reading a board, so
+ * they all report the same way.
+ */
+class Publisher {
+public:
+  Publisher(const Config &config, const I2cConfig &i2c, uint8_t source, telemetry::Registry &registry) :
+      _name(i2c.Name), _source(source), _tagged(config.I2C.size() > 1) {
+    const std::string labels = telemetry::label("source", this->_name);
+
+    registry.histogram("pisense_serialize_latency_seconds",
+                       "Time from acquiring a sample to its JSON line being written",
+                       this->_serializeLatency,
+                       labels);
+
+    if (config.Deadband.Enabled) {
+      this->_deadband = std::make_unique<deadband::Filter>(config.Deadband, registry, labels);
+    }
+  }
+
+  Publisher(const Publisher &) = delete;
+  Publisher &operator=(const Publisher &) = delete;
+
+  // Samples go to the exporter and the cache from the next one on, nullptr stops publishing them there
+  void attach(Exporter *exporter, control::Cache *cache) {
+    this->_exporter = exporter;
+    this->_cache = cache;
+  }
+
+  void publish(Sample &sample, const Timestamp &acquired) {
+    sample.source = this->_source;
+
+    if (sample.present == 0) {
+      return;
+    }
+
+    if (this->_cache != nullptr) {
+      this->_cache->update(sample);
+    }
+
+    if (this->_deadband && !this->_deadband->apply(sample)) {
+      return;
+    }
+
+    // A single board keeps the output it always had
+    std::println("{}", control::line(sample, this->_tagged ? std::string_view(this->_name) : std::string_view()));
+    this->_serializeLatency.observe(Timestamp::monotonicNow() - acquired.monotonic);
+
+    if (this->_exporter != nullptr) {
+      this->_exporter->publish(sample, acquired.monotonic);
+    }
+  }
+
+private:
+  std::string _name;
+  uint8_t _source;
+  bool _tagged;
+  telemetry::Histogram _serializeLatency;
+  std::unique_ptr<deadband::Filter> _deadband;
+  Exporter *_exporter{nullptr};
+  control::Cache *_cache{nullptr};
+};
+
+/**
+ * Reads the sensors of one board over i2c-dev and turns them into a sample. Boards are ticked by the Scheduler of the
+ * bus they are on.
+ */
+class Acquisition {
+public:
+  Acquisition(const Config &config,
+              const I2cConfig &i2c,
+              uint8_t source,
+              i2c::Bus &bus,
+              telemetry::Registry &registry) :
+      _name(i2c.Name),
+      _channel(i2c.MuxAddress != 0 ? std::optional(i2c.MuxChannel) : std::nullopt),
+      _statsInterval(int64_t{i2c.StatsIntervalMs} * 1'000'000),
+      _senseHat(i2c, bus),
+      _publisher(config, i2c, source, registry) {
+    const std::string labels = telemetry::label("source", this->_name);
+
+    registry.counter("pisense_ticks_total", "Sensor polling ticks", this->_ticks, labels);
+    registry.counter("pisense_sensor_read_errors_total", "Sensor readings that failed", this->_readErrors, labels);
+    registry.histogram("pisense_read_latency_seconds", "Time spent reading the sensors", this->_readLatency, labels);
+    registry.counter("pisense_read_cache_hits_total",
+                     "Sensor readings served from memory within the sensor's output data period",
+                     this->_senseHat.cacheHits(),
+                     labels);
+    registry.counter("pisense_read_cache_misses_total",
+                     "Sensor readings that went to the bus",
+                     this->_senseHat.cacheMisses(),
+                     labels);
+    registry.gauge(
+        "pisense_read_cache_hit_ratio",
+        "Fraction of sensor readings served from memory",
+        [this] {
+          const uint64_t hits = this->_senseHat.cacheHits().value();
+          const uint64_t reads = hits + this->_senseHat.cacheMisses().value();
+          return reads == 0 ? 0.0 : static_cast<double>(hits) / reads;
+        },
+        labels);
+  }
+
+  Acquisition(const Acquisition &) = delete;
+  Acquisition &operator=(const Acquisition &) = delete;
+
+  [[nodiscard]] const std::string &name() const { return this->_name; }
+
+  // The mux channel the board is on, none when it is wired to the bus directly
+  [[nodiscard]] std::optional<uint8_t> channel() const noexcept { return this->_channel; }
+
+  void attach(Exporter *exporter, control::Cache *cache) { this->_publisher.attach(exporter, cache); }
+
+  /**
+   * Only reads the metrics consumed from the next tick on, powering down the sensors that provide none of them. A
+   * sensor that fails to power up is tried again on its next read, like after a bus error, so the board keeps going.
+   */
+  void activate(uint32_t metrics) {
+    this->_metrics = metrics;
+
+    if (const i2c::Result<void> result = this->_senseHat.activate(metrics); !result) {
+      spdlog::error("Failed to power the sensors of {} up or down: {}", this->_name, strerror(result.error().error));
+    }
+  }
+
+  void testHardware() const {
+    spdlog::info("Checking the sensors of {}", this->_name);
+    this->_senseHat.testHardware();
+  }
+
+  void logStats() const {
+    this->_senseHat.forEachDevice([this](const i2c::Device &device) {
+      spdlog::info("I2C {}: {}", this->_name, device.summary());
+    });
+  }
+
+  // Goes to stderr so it never mixes with the JSON lines on stdout
+  void printStats() const {
+    this->_senseHat.forEachDevice([this](const i2c::Device &device) {
+      std::println(stderr, "{}: {}", this->_name, device.summary());
+    });
+  }
+
+  void tick() {
+    const uint32_t metrics = this->_metrics & this->_senseHat.metrics();
+
+    if (metrics == 0) {
+      return;
+    }
+
+    this->_ticks.increment();
+
+    const int64_t start = Timestamp::monotonicNow();
+
+    std::optional<i2c::Result<double>> tempC;
+    std::optional<i2c::Result<double>> humidity;
+
+    if ((metrics & TEMPERATURE_METRICS) != 0) {
+      tempC = this->_senseHat.readTemperature();
+    }
+
+    if ((metrics & metricBit(Metric::Humidity)) != 0) {
+      humidity = this->_senseHat.readHumidity();
+    }
+
+    // Stamped as soon as the values exist, so nothing that happens to the sample later shifts its time
+    const Timestamp acquired = Timestamp::now();
+    this->_readLatency.observe(acquired.monotonic - start);
+
+    if (this->_statsInterval != 0 && acquired.monotonic - this->_lastStatsLog >= this->_statsInterval) {
+      this->_lastStatsLog = acquired.monotonic;
+      this->logStats();
+    }
+
+    Sample sample;
+    sample.timestamp = acquired.realtime;
+
+    // A failed reading only drops its own metrics, the rest of the tick goes ahead with whatever was read
+    if (tempC && *tempC) {
+      setTemperature(sample, metrics, **tempC);
+    } else if (tempC) {
+      this->readFailed("temperature", tempC->error());
+    }
+
+    if (humidity && *humidity) {
+      sample.set(Metric::Humidity, **humidity);
+    } else if (humidity) {
+      this->readFailed("humidity", humidity->error());
+    }
+
+    this->_publisher.publish(sample, acquired);
+  }
+
+private:
+  std::string _name;
+  std::optional<uint8_t> _channel;
+  int64_t _statsInterval;
+  SenseHat<SpdLogger> _senseHat;
+  Publisher _publisher;
+  telemetry::Counter _ticks;
+  telemetry::Counter _readErrors;
+  telemetry::Histogram _readLatency;
+  int64_t _lastStatsLog{Timestamp::monotonicNow()};
+  uint32_t _metrics{ALL_METRICS};
+
+  void readFailed(std::string_view reading, const i2c::BusError &error) {
+    this->_readErrors.increment();
+    spdlog::warn("Failed to read {} of {}: {} 0x{:02X} of I2C device 0x{:02X}: {}",
+                 reading,
+                 this->_name,
+                 error.description(),
+                 error.reg,
+                 error.address,
+                 strerror(error.error));
+  }
+};
+
+/**
+ * Reads one board through the kernel's IIO drivers instead of i2c-dev. The driver samples the sensor on every
+ * data-ready interrupt and queues the scans, so this worker sleeps in poll() until there are some and takes everything
+ * queued with a single read(). How often that happens follows the sensor's data rate and IioWatermark, not
+ * PollingIntervalMs.
+ */
+class BufferedAcquisition {
+public:
+  static constexpr size_t CAPACITY = 256; // Scans taken by one read at most
+  static constexpr int WAIT_MS = 100;     // How long to wait for scans before checking whether to stop
+  static constexpr int ONCE_WAIT_MS = 2000;
+
+  BufferedAcquisition(const Config &config, const I2cConfig &i2c, uint8_t source, telemetry::Registry &registry) :
+      _name(i2c.Name), _config(i2c), _publisher(config, i2c, source, registry) {
+    this->open();
+    this->_device = this->_buffer->name();
+
+    const std::string labels = telemetry::label("source", this->_name);
+
+    registry.counter("pisense_iio_reads_total", "Reads from IIO buffers", this->_reads, labels);
+    registry.counter("pisense_iio_scans_total", "Scans taken from IIO buffers", this->_scans, labels);
+    registry.counter("pisense_sensor_read_errors_total", "Sensor readings that failed", this->_readErrors, labels);
+    registry.histogram("pisense_read_latency_seconds", "Time spent reading the sensors", this->_readLatency, labels);
+  }
+
+  ~BufferedAcquisition() { this->stop(); }
+
+  BufferedAcquisition(const BufferedAcquisition &) = delete;
+  BufferedAcquisition &operator=(const BufferedAcquisition &) = delete;
+
+  // The exporter and cache have to outlive the worker, so stop() comes before they are torn down
+  void start(Exporter *exporter, control::Cache *cache, uint32_t metrics) {
+    this->_publisher.attach(exporter, cache);
+    this->activate(metrics);
+    this->_running.store(true);
+
+    this->_worker = std::thread([this] {
+      while (this->_running.load()) {
+        this->tick(BufferedAcquisition::WAIT_MS);
+      }
+    });
+  }
+
+  void stop() {
+    this->_running.store(false);
+
+    if (this->_worker.joinable()) {
+      this->_worker.join();
+    }
+  }
+
+  void testHardware() const {
+    if (!this->_buffer) {
+      spdlog::info("{} doesn't read IIO device {}, none of its metrics are consumed", this->_name, this->_device);
+      return;
+    }
+
+    spdlog::info("{} reads IIO device {}: {} channels, {} bytes per scan",
+                 this->_name,
+                 this->_device,
+                 this->_buffer->layout().channels.size(),
+                 this->_buffer->layout().size);
+  }
+
+  // Only enables the channels of the metrics consumed from now on, and the buffer only if there are any
+  void activate(uint32_t metrics) {
+    const bool reopen = BufferedAcquisition::channels(metrics) != BufferedAcquisition::channels(this->_metrics);
+    this->_metrics = metrics;
+
+    if (reopen) {
+      this->open();
+    }
+  }
+
+  // Goes to stderr so it never mixes with the JSON lines on stdout
+  void printStats() const {
+    std::println(stderr,
+                 "{}: IIO {}: {} reads, {} scans, {} failed",
+                 this->_name,
+                 this->_device,
+                 this->_reads.value(),
+                 this->_scans.value(),
+                 this->_readErrors.value());
+  }
+
+  // Waits up to waitMs for scans and publishes every one that was queued
+  void tick(int waitMs) {
+    if (!this->_buffer) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+      return;
+    }
+
+    pollfd ready{.fd = this->_buffer->fd(), .events = POLLIN, .revents = 0};
+
+    if (::poll(&ready, 1, waitMs) <= 0) {
+      return;
+    }
+
+    const Timestamp start = Timestamp::now();
+    const std::expected<std::span<const uint8_t>, int> scans = this->_buffer->read();
+
+    this->_reads.increment();
+    this->_readLatency.observe(Timestamp::monotonicNow() - start.monotonic);
+
+    if (!scans) {
+      this->_readErrors.increment();
+      spdlog::warn("Failed to read IIO buffer of {}: {}", this->_name, strerror(scans.error()));
+      std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+      return;
+    }
+
+    // Only a file standing in for the device runs dry without poll() waiting for more
+    if (scans->empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(waitMs));
+      return;
+    }
+
+    // Scans are stamped by the driver on the monotonic clock; Unix time comes from how far apart the clocks are now
+    const int64_t clockOffset = start.realtime - start.monotonic;
+    const size_t size = this->_buffer->layout().size;
+
+    for (size_t offset = 0; offset < scans->size(); offset += size) {
+      const uint8_t *scan = scans->data() + offset;
+      const int64_t monotonic = this->_timestamp != nullptr ? this->_timestamp->raw(scan) : start.monotonic;
+
+      Sample sample;
+      sample.timestamp = monotonic + clockOffset;
+
+      if (this->_temperature != nullptr) {
+        setTemperature(sample, this->_metrics, this->_temperature->value(scan) / 1000.0);
+      }
+
+      if (this->_humidity != nullptr) {
+        sample.set(Metric::Humidity, std::clamp(this->_humidity->value(scan) / 1000.0, 0.0, 100.0));
+      }
+
+      this->_publisher.publish(sample, {.monotonic = monotonic, .realtime = sample.timestamp});
+    }
+
+    this->_scans.increment(scans->size() / size);
+  }
+
+private:
+  std::string _name;
+  I2cConfig _config;
+  std::string _device;
+  std::optional<iio::Buffer> _buffer;
+  Publisher _publisher;
+  uint32_t _metrics{ALL_METRICS};
+  const iio::Channel *_temperature{nullptr};
+  const iio::Channel *_humidity{nullptr};
+  const iio::Channel *_timestamp{nullptr};
+  telemetry::Counter _reads;
+  telemetry::Counter _scans;
+  telemetry::Counter _readErrors;
+  telemetry::Histogram _readLatency;
+  std::atomic<bool> _running{false};
+  std::thread _worker;
+
+  // IIO channel types the metrics come from, in milli degrees Celsius and milli percent
+  [[nodiscard]] static std::vector<std::string_view> channels(uint32_t metrics) {
+    std::vector<std::string_view> channels;
+
+    if ((metrics & TEMPERATURE_METRICS) != 0) {
+      channels.emplace_back("temp");
+    }
+
+    if ((metrics & metricBit(Metric::Humidity)) != 0) {
+      channels.emplace_back("humidityrelative");
+    }
+
+    return channels;
+  }
+
+  // Scan elements can only change while the buffer is disabled, so the old one goes before the new one is set up
+  void open() {
+    const std::vector<std::string_view> channels = BufferedAcquisition::channels(this->_metrics);
+
+    this->_temperature = nullptr;
+    this->_humidity = nullptr;
+    this->_timestamp = nullptr;
+    this->_buffer.reset();
+
+    if (channels.empty()) {
+      return;
+    }
+
+    this->_buffer.emplace(this->_config, channels, BufferedAcquisition::CAPACITY);
+    this->_temperature = this->_buffer->layout().find("temp");
+    this->_humidity = this->_buffer->layout().find("humidityrelative");
+    this->_timestamp = this->_buffer->layout().find("timestamp");
+  }
+};
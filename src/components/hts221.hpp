@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
+#include "register.hpp"
+
 namespace hts221 {
   constexpr uint8_t ADDRESS = 0x5F;
   constexpr uint8_t DEVICE_ID = 0xBC;
@@ -32,6 +35,69 @@ namespace hts221 {
     constexpr uint8_t T1_OUT_H = 0x3F;
   } // namespace reg
 
+  // Control registers whose value only changes when written. CTRL_REG2 is left out, BOOT and ONE_SHOT clear themselves
+  constexpr std::array<uint8_t, 3> SHADOWED = {reg::AV_CONF, reg::CTRL_REG1, reg::CTRL_REG3};
+
+  // Multi-byte reads only auto-increment through the registers with the MSB of the register address set
+  constexpr uint8_t AUTO_INCREMENT = 0x80;
+
+  namespace registers {
+    template <uint8_t Address, typename T = uint8_t, i2c::Access Mode = i2c::Access::Read>
+    using Register = i2c::Register<Address, T, Mode, std::endian::little, AUTO_INCREMENT>;
+
+    using WHO_AM_I = Register<reg::WHO_AM_I>;
+    using AV_CONF = Register<reg::AV_CONF, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG1 = Register<reg::CTRL_REG1, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG2 = Register<reg::CTRL_REG2, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG3 = Register<reg::CTRL_REG3, uint8_t, i2c::Access::ReadWrite>;
+    using STATUS_REG = Register<reg::STATUS_REG>;
+    using HUMIDITY_OUT = Register<reg::HUMIDITY_OUT_L, int16_t>;
+    using TEMP_OUT = Register<reg::TEMP_OUT_L, int16_t>;
+    using H0_rH_x2 = Register<reg::H0_rH_x2>;
+    using H1_rH_x2 = Register<reg::H1_rH_x2>;
+    using T0_degC_x8 = Register<reg::T0_degC_x8>;
+    using T1_degC_x8 = Register<reg::T1_degC_x8>;
+    using T1_T0_MSB = Register<reg::T1_T0_MSB>;
+    using H0_T0_OUT = Register<reg::H0_T0_OUT_L, int16_t>;
+    using H1_T0_OUT = Register<reg::H1_T0_OUT_L, int16_t>;
+    using T0_OUT = Register<reg::T0_OUT_L, int16_t>;
+    using T1_OUT = Register<reg::T1_OUT_L, int16_t>;
+  } // namespace registers
+
+  namespace fields {
+    using AVGT = i2c::Field<registers::AV_CONF, 3, 3>;
+    using AVGH = i2c::Field<registers::AV_CONF, 0, 3>;
+
+    using PD = i2c::Field<registers::CTRL_REG1, 7, 1>;
+    using BDU = i2c::Field<registers::CTRL_REG1, 2, 1>;
+    using ODR = i2c::Field<registers::CTRL_REG1, 0, 2>;
+
+    using BOOT = i2c::Field<registers::CTRL_REG2, 7, 1>;
+    using HEATER = i2c::Field<registers::CTRL_REG2, 1, 1>;
+    using ONE_SHOT = i2c::Field<registers::CTRL_REG2, 0, 1>;
+  } // namespace fields
+
+  namespace odr {
+    constexpr uint8_t ONE_SHOT = 0x00;
+    constexpr uint8_t HZ_1 = 0x01;
+    constexpr uint8_t HZ_7 = 0x02;
+    constexpr uint8_t HZ_12_5 = 0x03;
+
+    // Nanoseconds between two conversions at a data rate, 0 in one-shot mode where there is no fixed rate
+    constexpr int64_t period(uint8_t odr) noexcept {
+      switch (odr) {
+        case HZ_1:
+          return 1'000'000'000;
+        case HZ_7:
+          return 142'857'143;
+        case HZ_12_5:
+          return 80'000'000;
+        default:
+          return 0;
+      }
+    }
+  } // namespace odr
+
   namespace sampling {
     constexpr uint8_t AVGT_2 = 0x00;
     constexpr uint8_t AVGT_4 = 0x01;
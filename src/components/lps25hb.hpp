@@ -1,12 +1,43 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
+#include "register.hpp"
+
 namespace lps25hb {
   constexpr uint8_t ADDRESS = 0x5C;
   constexpr uint8_t DEVICE_ID = 0xBD;
 
   namespace reg {
     constexpr uint8_t WHO_AM_I = 0x0F;
-  }
+    constexpr uint8_t RES_CONF = 0x10;
+    constexpr uint8_t CTRL_REG1 = 0x20;
+    constexpr uint8_t CTRL_REG2 = 0x21;
+    constexpr uint8_t CTRL_REG3 = 0x22;
+    constexpr uint8_t CTRL_REG4 = 0x23;
+    constexpr uint8_t FIFO_CTRL = 0x2E;
+  } // namespace reg
+
+  // Multi-byte reads only auto-increment through the registers with the MSB of the register address set
+  constexpr uint8_t AUTO_INCREMENT = 0x80;
+
+  namespace registers {
+    template <uint8_t Address, typename T = uint8_t, i2c::Access Mode = i2c::Access::Read>
+    using Register = i2c::Register<Address, T, Mode, std::endian::little, AUTO_INCREMENT>;
+
+    using WHO_AM_I = Register<reg::WHO_AM_I>;
+    using RES_CONF = Register<reg::RES_CONF, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG1 = Register<reg::CTRL_REG1, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG2 = Register<reg::CTRL_REG2, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG3 = Register<reg::CTRL_REG3, uint8_t, i2c::Access::ReadWrite>;
+    using CTRL_REG4 = Register<reg::CTRL_REG4, uint8_t, i2c::Access::ReadWrite>;
+    using FIFO_CTRL = Register<reg::FIFO_CTRL, uint8_t, i2c::Access::ReadWrite>;
+  } // namespace registers
+
+  // Control registers whose value only changes when written. CTRL_REG2 is left out, BOOT, SWRESET and ONE_SHOT clear
+  // themselves
+  constexpr std::array<uint8_t, 5> SHADOWED = {
+      reg::RES_CONF, reg::CTRL_REG1, reg::CTRL_REG3, reg::CTRL_REG4, reg::FIFO_CTRL,
+  };
 } // namespace lps25hb
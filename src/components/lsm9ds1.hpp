@@ -1,7 +1,10 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
+#include "register.hpp"
+
 namespace lsm9ds1 {
   namespace gyro {
     constexpr uint8_t ADDRESS = 0x6A;
@@ -59,6 +62,30 @@ namespace lsm9ds1 {
       constexpr uint8_t INT_GEN_THS_ZL_G = 0x36;
       constexpr uint8_t INT_GEN_DUR_G = 0x37;
     } // namespace reg
+
+    // Multi-byte reads auto-increment by default (IF_ADD_INC in CTRL_REG8), no flag in the register address needed
+    namespace registers {
+      template <uint8_t Address, typename T = uint8_t, i2c::Access Mode = i2c::Access::Read>
+      using Register = i2c::Register<Address, T, Mode>;
+
+      using WHO_AM_I = Register<reg::WHO_AM_I>;
+      using CTRL_REG1_G = Register<reg::CTRL_REG1_G, uint8_t, i2c::Access::ReadWrite>;
+      using CTRL_REG6_XL = Register<reg::CTRL_REG6_XL, uint8_t, i2c::Access::ReadWrite>;
+      using OUT_TEMP = Register<reg::OUT_TEMP_L, int16_t>;
+      using OUT_X_G = Register<reg::OUT_X_L_G, int16_t>;
+      using OUT_Y_G = Register<reg::OUT_Y_L_G, int16_t>;
+      using OUT_Z_G = Register<reg::OUT_Z_L_G, int16_t>;
+      using OUT_X_XL = Register<reg::OUT_X_L_XL, int16_t>;
+      using OUT_Y_XL = Register<reg::OUT_Y_L_XL, int16_t>;
+      using OUT_Z_XL = Register<reg::OUT_Z_L_XL, int16_t>;
+    } // namespace registers
+
+    // Control registers whose value only changes when written. CTRL_REG8 is left out, BOOT and SW_RESET clear
+    // themselves
+    constexpr std::array<uint8_t, 11> SHADOWED = {
+        reg::CTRL_REG1_G,  reg::CTRL_REG2_G,  reg::CTRL_REG3_G, reg::ORIENT_CFG_G, reg::CTRL_REG4, reg::CTRL_REG5_XL,
+        reg::CTRL_REG6_XL, reg::CTRL_REG7_XL, reg::CTRL_REG9,   reg::CTRL_REG10,   reg::FIFO_CTRL,
+    };
   } // namespace gyro
 
   namespace mag {
@@ -90,5 +117,26 @@ namespace lsm9ds1 {
       constexpr uint8_t INT_THS_L_M = 0x32;
       constexpr uint8_t INT_THS_H_M = 0x33;
     } // namespace reg
+
+    // Multi-byte reads only auto-increment through the registers with the MSB of the register address set
+    constexpr uint8_t AUTO_INCREMENT = 0x80;
+
+    namespace registers {
+      template <uint8_t Address, typename T = uint8_t, i2c::Access Mode = i2c::Access::Read>
+      using Register = i2c::Register<Address, T, Mode, std::endian::little, AUTO_INCREMENT>;
+
+      using WHO_AM_I_M = Register<reg::WHO_AM_I_M>;
+      using CTRL_REG1_M = Register<reg::CTRL_REG1_M, uint8_t, i2c::Access::ReadWrite>;
+      using CTRL_REG3_M = Register<reg::CTRL_REG3_M, uint8_t, i2c::Access::ReadWrite>;
+      using OUT_X_M = Register<reg::OUT_X_L_M, int16_t>;
+      using OUT_Y_M = Register<reg::OUT_Y_L_M, int16_t>;
+      using OUT_Z_M = Register<reg::OUT_Z_L_M, int16_t>;
+    } // namespace registers
+
+    // Control registers whose value only changes when written. CTRL_REG2_M is left out, REBOOT and SOFT_RST clear
+    // themselves
+    constexpr std::array<uint8_t, 4> SHADOWED = {
+        reg::CTRL_REG1_M, reg::CTRL_REG3_M, reg::CTRL_REG4_M, reg::CTRL_REG5_M,
+    };
   } // namespace mag
 } // namespace lsm9ds1
@@ -1,14 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
 #include <cstdint>
 #include <expected>
+#include <format>
 #include <fstream>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <vector>
+#include <unistd.h>
 
 #include "ini_manager.hpp"
+#include "rollup.hpp"
+#include "sample.hpp"
 #include "spdlog/common.h"
 #include <spdlog/spdlog.h>
 
@@ -18,6 +28,31 @@
 #define ReadBool(section, keyName) ReadConfig(bool, section, keyName);
 #define ReadUInt32(section, keyName) ReadConfig(uint32_t, section, keyName);
 
+// Splits a comma separated list, trimming whitespace around each item and skipping empty ones
+[[nodiscard]] inline std::vector<std::string> splitList(std::string_view list) {
+  std::vector<std::string> items;
+
+  while (!list.empty()) {
+    const size_t comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+
+    while (!item.empty() && std::isspace(static_cast<unsigned char>(item.front())) != 0) {
+      item.remove_prefix(1);
+    }
+
+    while (!item.empty() && std::isspace(static_cast<unsigned char>(item.back())) != 0) {
+      item.remove_suffix(1);
+    }
+
+    if (!item.empty()) {
+      items.emplace_back(item);
+    }
+  }
+
+  return items;
+}
+
 struct AppConfig {
   uint32_t PollingIntervalMs;
   uint32_t ExitCheckIntervalMs;
@@ -54,12 +89,389 @@ struct HTS221Config {
   };
 };
 
+struct I2cConfig {
+  // How the sensors are read: directly over i2c-dev, or through the kernel's IIO drivers and their buffers
+  enum class Driver : uint8_t { I2cDev, Iio };
+
+  static constexpr uint8_t HTS221 = 1U << 0;
+  static constexpr uint8_t LPS25HB = 1U << 1;
+  static constexpr uint8_t LSM9DS1 = 1U << 2;
+
+  std::string Name;
+  std::string Bus;
+  uint8_t Devices;            // Sensors present on the bus, a combination of the flags above
+  uint8_t MuxAddress;         // TCA9548A the sensors sit behind, 0 when they are wired to the bus directly
+  uint8_t MuxChannel;         // Channel of the mux (0-7) the sensors are on
+  uint32_t Attempts;          // Tries per transaction, including the first
+  uint32_t BackoffUs;         // Wait before the first retry, doubled for every one after it
+  uint32_t MaxBackoffUs;
+  uint32_t TimeoutMs;         // Adapter timeout (I2C_TIMEOUT), 0 keeps the driver default
+  uint32_t AdapterRetries;    // Retries done by the adapter itself on arbitration loss (I2C_RETRIES)
+  uint32_t RecoveryThreshold; // Failed transactions in a row after which the bus is reopened, 0 to never reopen it
+  uint32_t StatsIntervalMs;   // How often per-device statistics are logged, 0 to never log them
+  Driver Backend;
+  std::string IioDevice;      // sysfs directory of the IIO device, e.g. /sys/bus/iio/devices/iio:device0
+  std::string IioBuffer;      // Its buffer's character device, /dev/<name of IioDevice> when empty
+  std::string IioTrigger;     // Trigger to attach, empty to keep the current one (drivers with DRDY set their own)
+  uint32_t IioWatermark;      // Scans queued in the kernel before a read wakes up, 1 to wake up for every scan
+
+  // Parses a comma separated list of sensors, e.g. "hts221, lps25hb, lsm9ds1"
+  [[nodiscard]] static uint8_t toDevices(const std::string &devicesStr) {
+    uint8_t devices = 0;
+
+    for (const std::string &device : splitList(devicesStr)) {
+      if (device == "hts221") {
+        devices |= HTS221;
+      } else if (device == "lps25hb") {
+        devices |= LPS25HB;
+      } else if (device == "lsm9ds1") {
+        devices |= LSM9DS1;
+      } else {
+        spdlog::warn("Unknown I2C device '{}', ignoring it", device);
+      }
+    }
+
+    return devices;
+  }
+
+  // Parses a 7-bit device address, in hex with a 0x prefix (e.g. "0x70") or in decimal
+  [[nodiscard]] static std::optional<uint8_t> toAddress(std::string_view addressStr) {
+    int base = 10;
+
+    if (addressStr.starts_with("0x") || addressStr.starts_with("0X")) {
+      addressStr.remove_prefix(2);
+      base = 16;
+    }
+
+    unsigned address = 0;
+    const auto [end, error] = std::from_chars(addressStr.data(), addressStr.data() + addressStr.size(), address, base);
+
+    if (error != std::errc{} || end != addressStr.data() + addressStr.size() || addressStr.empty() || address > 0x7F) {
+      return std::nullopt;
+    }
+
+    return static_cast<uint8_t>(address);
+  }
+};
+
+struct DeadbandConfig {
+  bool Enabled;
+  std::array<double, METRIC_COUNT> Thresholds;  // Change from the last reported value needed to report again
+  std::array<int64_t, METRIC_COUNT> MaxSilence; // Nanoseconds after which a value is reported even if unchanged
+};
+
 struct LoggerConfig {
+  enum class OverflowPolicy : uint8_t { Block, OverrunOldest };
+
   spdlog::level::level_enum LogLevel;
+  bool Async;
+  uint32_t QueueSize;
+  OverflowPolicy OverflowPolicy;
+
+  [[nodiscard]] static enum OverflowPolicy toOverflowPolicy(const std::string &policyStr) {
+    if (policyStr == "Block") {
+      return OverflowPolicy::Block;
+    }
+
+    if (policyStr == "OverrunOldest") {
+      return OverflowPolicy::OverrunOldest;
+    }
+
+    spdlog::warn("Invalid logger OverflowPolicy '{}', defaulting to 'OverrunOldest'", policyStr);
+    return OverflowPolicy::OverrunOldest;
+  }
+};
+
+struct PrometheusExporterConfig {
+  bool Enabled;
+  std::string Address;
+  uint16_t Port;
+  std::string Path;
+  uint32_t MaxConnections;
+  uint32_t BufferSize;
+  uint32_t Metrics; // Metrics the exporter consumes, see metricBit
+};
+
+struct SQLiteExporterConfig {
+  enum class Synchronous : uint8_t { Off, Normal, Full, Extra };
+
+  bool Enabled;
+  std::string Path;
+  std::string Table;
+  Synchronous Synchronous;
+  uint32_t BusyTimeoutMs;
+  uint32_t Metrics;
+
+  [[nodiscard]] static enum Synchronous toSynchronous(const std::string &levelStr) {
+    if (levelStr == "Off") {
+      return Synchronous::Off;
+    }
+
+    if (levelStr == "Normal") {
+      return Synchronous::Normal;
+    }
+
+    if (levelStr == "Full") {
+      return Synchronous::Full;
+    }
+
+    if (levelStr == "Extra") {
+      return Synchronous::Extra;
+    }
+
+    spdlog::warn("Invalid SQLite Synchronous level '{}', defaulting to 'Normal'", levelStr);
+    return Synchronous::Normal;
+  }
+
+  [[nodiscard]] static std::string_view toString(enum Synchronous level) {
+    switch (level) {
+      case Synchronous::Off:
+        return "OFF";
+      case Synchronous::Normal:
+        return "NORMAL";
+      case Synchronous::Full:
+        return "FULL";
+      case Synchronous::Extra:
+        return "EXTRA";
+    }
+
+    return "NORMAL";
+  }
+};
+
+struct PostgresExporterConfig {
+  bool Enabled;
+  std::string ConnectionString;
+  std::string Table;
+  uint32_t MaxBacklog;
+  uint32_t ReconnectMinMs;
+  uint32_t ReconnectMaxMs;
+  uint32_t TimeoutMs;
+  uint32_t Metrics;
+};
+
+struct HistoryExporterConfig {
+  enum class Compression : uint8_t { None, Gorilla };
+
+  bool Enabled;
+  std::string Path;
+  uint32_t SizeMb;
+  uint32_t SyncIntervalMs;
+  Compression Compression;
+  uint32_t RollupSizeMb;
+  uint32_t Metrics;
+
+  [[nodiscard]] static enum Compression toCompression(const std::string &compressionStr) {
+    if (compressionStr == "None") {
+      return Compression::None;
+    }
+
+    if (compressionStr == "Gorilla") {
+      return Compression::Gorilla;
+    }
+
+    spdlog::warn("Invalid history Compression '{}', defaulting to 'None'", compressionStr);
+    return Compression::None;
+  }
+};
+
+struct RollupConfig {
+  bool Enabled;
+  std::vector<rollup::Resolution> Resolutions;
+
+  // Parses a comma separated list of durations with an s/m/h/d suffix, e.g. "1s, 1m, 1h", finest first. A bucket is
+  // only ever merged into the next coarser one, so each resolution has to divide it evenly.
+  [[nodiscard]] static std::vector<rollup::Resolution> toResolutions(const std::string &resolutionsStr) {
+    std::vector<rollup::Resolution> resolutions;
+
+    for (const std::string &item : splitList(resolutionsStr)) {
+      const std::optional<int64_t> nanoseconds = RollupConfig::toDuration(item);
+
+      if (!nanoseconds) {
+        spdlog::warn("Invalid rollup resolution '{}', ignoring it", item);
+        continue;
+      }
+
+      resolutions.push_back({*nanoseconds, item});
+    }
+
+    std::ranges::sort(resolutions, {}, &rollup::Resolution::nanoseconds);
+
+    for (size_t i = 1; i < resolutions.size(); i++) {
+      const rollup::Resolution &finer = resolutions[i - 1];
+      const rollup::Resolution &coarser = resolutions[i];
+
+      if (coarser.nanoseconds == finer.nanoseconds) {
+        spdlog::error("[Exporter.Rollup] resolutions {} and {} are the same duration", finer.label, coarser.label);
+        throw std::runtime_error("Duplicate rollup resolution");
+      }
+
+      if (coarser.nanoseconds % finer.nanoseconds != 0) {
+        spdlog::error("[Exporter.Rollup] resolution {} doesn't evenly divide the next coarser one, {}",
+                      finer.label,
+                      coarser.label);
+        throw std::runtime_error("Rollup resolutions not multiples of each other");
+      }
+    }
+
+    return resolutions;
+  }
+
+  // Parses a single positive duration with an s/m/h/d suffix into nanoseconds
+  [[nodiscard]] static std::optional<int64_t> toDuration(std::string_view duration) {
+    if (duration.size() < 2) {
+      return std::nullopt;
+    }
+
+    int64_t unit = 0;
+
+    switch (duration.back()) {
+      case 's':
+        unit = 1'000'000'000LL;
+        break;
+      case 'm':
+        unit = 60 * 1'000'000'000LL;
+        break;
+      case 'h':
+        unit = 3600 * 1'000'000'000LL;
+        break;
+      case 'd':
+        unit = 86400 * 1'000'000'000LL;
+        break;
+      default:
+        return std::nullopt;
+    }
+
+    int64_t count = 0;
+    const std::string_view number = duration.substr(0, duration.size() - 1);
+    const auto [end, error] = std::from_chars(number.data(), number.data() + number.size(), count);
+
+    if (error != std::errc{} || end != number.data() + number.size() || count <= 0) {
+      return std::nullopt;
+    }
+
+    return count * unit;
+  }
+};
+
+struct SpoolConfig {
+  bool Enabled;
+  std::string Directory;
+  uint32_t MaxSizeMb;
+  uint32_t SegmentSizeMb;
+  uint32_t ReplayRate; // Samples per second, 0 for unlimited
+};
+
+struct SharedMemoryExporterConfig {
+  bool Enabled;
+  std::string Name;
+  uint32_t Metrics;
+};
+
+struct StreamExporterConfig {
+  enum class SlowSubscriber : uint8_t { Drop, Disconnect };
+
+  bool Enabled;
+  std::string Path;
+  uint32_t MaxSubscribers;
+  uint32_t MaxQueueKb;
+  SlowSubscriber SlowSubscriber;
+  uint32_t Metrics;
+
+  [[nodiscard]] static enum SlowSubscriber toSlowSubscriber(const std::string &slowSubscriberStr) {
+    if (slowSubscriberStr == "Drop") {
+      return SlowSubscriber::Drop;
+    }
+
+    if (slowSubscriberStr == "Disconnect") {
+      return SlowSubscriber::Disconnect;
+    }
+
+    spdlog::warn("Invalid stream SlowSubscriber '{}', defaulting to 'Drop'", slowSubscriberStr);
+    return SlowSubscriber::Drop;
+  }
+};
+
+struct MqttExporterConfig {
+  enum class Version : uint8_t { V311, V5 };
+
+  bool Enabled;
+  std::string Host;
+  uint16_t Port;
+  Version Version;
+  std::string ClientId;
+  std::string Username;
+  std::string Password;
+  std::string Topic;
+  uint8_t Qos;
+  bool Retain;
+  bool CleanSession;
+  uint16_t KeepAliveSec;
+  uint32_t SessionExpirySec;
+  uint32_t MaxBacklog;
+  uint32_t MaxInflight;
+  uint32_t ReconnectMinMs;
+  uint32_t ReconnectMaxMs;
+  uint32_t TimeoutMs;
+  uint32_t Metrics;
+
+  [[nodiscard]] static enum Version toVersion(const std::string &versionStr) {
+    if (versionStr == "3.1.1") {
+      return Version::V311;
+    }
+
+    if (versionStr == "5") {
+      return Version::V5;
+    }
+
+    spdlog::warn("Invalid MQTT Version '{}', defaulting to '3.1.1'", versionStr);
+    return Version::V311;
+  }
+
+  // Substitutes {host}, {source} and {metric} in a topic or client ID template
+  [[nodiscard]] static std::string expand(std::string_view pattern, std::string_view metric, std::string_view source) {
+    std::array<char, 256> host{};
+    ::gethostname(host.data(), host.size() - 1);
+
+    std::string result;
+
+    while (!pattern.empty()) {
+      if (pattern.starts_with("{host}")) {
+        result += host.data();
+        pattern.remove_prefix(6);
+      } else if (pattern.starts_with("{metric}")) {
+        result += metric;
+        pattern.remove_prefix(8);
+      } else if (pattern.starts_with("{source}")) {
+        result += source;
+        pattern.remove_prefix(8);
+      } else {
+        result += pattern.front();
+        pattern.remove_prefix(1);
+      }
+    }
+
+    return result;
+  }
 };
 
 struct ExporterConfig {
   bool Enabled;
+  uint32_t QueueCapacity;
+  RollupConfig Rollup;
+  SpoolConfig Spool;
+  PrometheusExporterConfig Prometheus;
+  SQLiteExporterConfig SQLite;
+  PostgresExporterConfig Postgres;
+  HistoryExporterConfig History;
+  SharedMemoryExporterConfig SharedMemory;
+  StreamExporterConfig Stream;
+  MqttExporterConfig Mqtt;
+};
+
+struct ControlConfig {
+  bool Enabled;
+  std::string Path;
 };
 
 struct DebugConfig {
@@ -71,8 +483,11 @@ class Config {
 public:
   AppConfig App{};
   HTS221Config HTS221{};
+  std::vector<I2cConfig> I2C{}; // One per acquisition instance, in the order of [I2C] Instances
   LoggerConfig Logger{};
+  DeadbandConfig Deadband{};
   ExporterConfig Exporter{};
+  ControlConfig Control{};
   DebugConfig Debug{};
 
   Config(const std::string &configFilePath) {
@@ -112,13 +527,93 @@ public:
       this->HTS221.CpuCompensationCpuCoefficient = cpuCompCpuCoefficient.value_or(0.0);
     }
 
+    // I2C Section
+    {
+      const auto i2c = ini::section{Config::I2C_SECTION};
+
+      const auto instances = ReadString(i2c, "Instances");
+
+      const I2cConfig builtin{.Name = "hat",
+                              .Bus = "/dev/i2c-1",
+                              .Devices = I2cConfig::HTS221 | I2cConfig::LPS25HB | I2cConfig::LSM9DS1,
+                              .MuxAddress = 0,
+                              .MuxChannel = 0,
+                              .Attempts = 3,
+                              .BackoffUs = 500,
+                              .MaxBackoffUs = 20000,
+                              .TimeoutMs = 100,
+                              .AdapterRetries = 0,
+                              .RecoveryThreshold = 5,
+                              .StatsIntervalMs = 0,
+                              .Backend = I2cConfig::Driver::I2cDev,
+                              .IioDevice = "",
+                              .IioBuffer = "",
+                              .IioTrigger = "",
+                              .IioWatermark = 1};
+
+      const I2cConfig defaults = Config::readI2c(config, i2c, builtin);
+
+      // Every instance takes its settings from [I2C.<name>], falling back to [I2C] for anything it leaves out
+      for (const std::string &name : splitList(instances.value_or(defaults.Name))) {
+        if (std::ranges::any_of(this->I2C, [&](const I2cConfig &bus) { return bus.Name == name; })) {
+          spdlog::warn("I2C instance '{}' is listed more than once, ignoring the duplicate", name);
+          continue;
+        }
+
+        const std::string section = std::format("{}.{}", Config::I2C_SECTION, name);
+
+        I2cConfig bus = Config::readI2c(config, ini::section{section}, defaults);
+        bus.Name = name;
+
+        this->I2C.push_back(std::move(bus));
+      }
+
+      // Samples carry the index of their instance in a single byte
+      if (this->I2C.empty() || this->I2C.size() > 256) {
+        spdlog::error("[I2C] Instances must list between 1 and 256 instances, got {}", this->I2C.size());
+        throw std::runtime_error("Invalid I2C instances");
+      }
+
+      Config::validateSharedBuses(this->I2C);
+    }
+
     // Logger Section
     {
       const auto logger = ini::section{Config::LOGGER_SECTION};
 
       const auto logLevel = ReadString(logger, "LogLevel");
+      const auto async = ReadBool(logger, "Async");
+      const auto queueSize = ReadUInt32(logger, "QueueSize");
+      const auto overflowPolicy = ReadString(logger, "OverflowPolicy");
 
       this->Logger.LogLevel = spdlog::level::from_str(logLevel.value_or("info"));
+      this->Logger.Async = async.value_or(false);
+      this->Logger.QueueSize = std::max<uint32_t>(queueSize.value_or(8192), 1);
+      this->Logger.OverflowPolicy = LoggerConfig::toOverflowPolicy(overflowPolicy.value_or("OverrunOldest"));
+    }
+
+    // Deadband Section
+    {
+      const auto deadband = ini::section{Config::DEADBAND_SECTION};
+
+      const auto enabled = ReadBool(deadband, "Enabled");
+      const auto maxSilence = ReadString(deadband, "MaxSilence");
+
+      this->Deadband.Enabled = enabled.value_or(false);
+
+      const int64_t defaultMaxSilence = Config::toMaxSilence(maxSilence.value_or("5m"), 300'000'000'000LL);
+
+      // Each metric takes its deadband from a key named after it, and optionally its own <metric>.MaxSilence
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const std::string name(METRICS[i].name);
+
+        const auto threshold = ReadDouble(deadband, name);
+        const auto metricMaxSilence = ReadString(deadband, name + ".MaxSilence");
+
+        this->Deadband.Thresholds[i] = std::max(threshold.value_or(0.0), 0.0);
+        this->Deadband.MaxSilence[i] = metricMaxSilence ? Config::toMaxSilence(*metricMaxSilence, defaultMaxSilence)
+                                                        : defaultMaxSilence;
+      }
     }
 
     // Exporter Section
@@ -126,8 +621,229 @@ public:
       const auto exporter = ini::section{Config::EXPORTER_SECTION};
 
       const auto exporterEnabled = ReadBool(exporter, "Enabled");
+      const auto queueCapacity = ReadUInt32(exporter, "QueueCapacity");
 
       this->Exporter.Enabled = exporterEnabled.value_or(false);
+      this->Exporter.QueueCapacity = queueCapacity.value_or(1024);
+    }
+
+    // Rollup Section
+    {
+      const auto rollup = ini::section{Config::ROLLUP_SECTION};
+
+      const auto enabled = ReadBool(rollup, "Enabled");
+      const auto resolutions = ReadString(rollup, "Resolutions");
+
+      this->Exporter.Rollup.Enabled = enabled.value_or(false);
+      this->Exporter.Rollup.Resolutions = RollupConfig::toResolutions(resolutions.value_or("1s, 1m, 1h"));
+
+      // Buckets carry no source, so the readings of several boards would be aggregated together
+      if (this->Exporter.Rollup.Enabled && this->I2C.size() > 1) {
+        spdlog::error("[Exporter.Rollup] needs a single [I2C] instance, got {}", this->I2C.size());
+        throw std::runtime_error("Rollup with several I2C instances");
+      }
+    }
+
+    // Spool Section
+    {
+      const auto spool = ini::section{Config::SPOOL_SECTION};
+
+      const auto enabled = ReadBool(spool, "Enabled");
+      const auto directory = ReadString(spool, "Directory");
+      const auto maxSizeMb = ReadUInt32(spool, "MaxSizeMb");
+      const auto segmentSizeMb = ReadUInt32(spool, "SegmentSizeMb");
+      const auto replayRate = ReadUInt32(spool, "ReplayRate");
+
+      this->Exporter.Spool.Enabled = enabled.value_or(false);
+      this->Exporter.Spool.Directory = directory.value_or("spool");
+      this->Exporter.Spool.MaxSizeMb = std::max<uint32_t>(maxSizeMb.value_or(256), 1);
+      this->Exporter.Spool.SegmentSizeMb = std::max<uint32_t>(segmentSizeMb.value_or(4), 1);
+      this->Exporter.Spool.ReplayRate = replayRate.value_or(1000);
+    }
+
+    // Prometheus Exporter Section
+    {
+      const auto prometheus = ini::section{Config::PROMETHEUS_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(prometheus, "Enabled");
+      const auto address = ReadString(prometheus, "Address");
+      const auto port = ReadUInt32(prometheus, "Port");
+      const auto path = ReadString(prometheus, "Path");
+      const auto maxConnections = ReadUInt32(prometheus, "MaxConnections");
+      const auto bufferSize = ReadUInt32(prometheus, "BufferSize");
+      const auto metrics = ReadString(prometheus, "Metrics");
+
+      this->Exporter.Prometheus.Enabled = enabled.value_or(false);
+      this->Exporter.Prometheus.Address = address.value_or("0.0.0.0");
+      this->Exporter.Prometheus.Port = static_cast<uint16_t>(port.value_or(9101));
+      this->Exporter.Prometheus.Path = path.value_or("/metrics");
+      this->Exporter.Prometheus.MaxConnections = maxConnections.value_or(64);
+      this->Exporter.Prometheus.BufferSize = bufferSize.value_or(16384);
+      this->Exporter.Prometheus.Metrics = Config::toMetrics(metrics.value_or("*"));
+    }
+
+    // SQLite Exporter Section
+    {
+      const auto sqlite = ini::section{Config::SQLITE_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(sqlite, "Enabled");
+      const auto path = ReadString(sqlite, "Path");
+      const auto table = ReadString(sqlite, "Table");
+      const auto synchronous = ReadString(sqlite, "Synchronous");
+      const auto busyTimeout = ReadUInt32(sqlite, "BusyTimeoutMs");
+      const auto metrics = ReadString(sqlite, "Metrics");
+
+      this->Exporter.SQLite.Enabled = enabled.value_or(false);
+      this->Exporter.SQLite.Path = path.value_or("pisense.db");
+      this->Exporter.SQLite.Table = table.value_or("samples");
+      this->Exporter.SQLite.Synchronous = SQLiteExporterConfig::toSynchronous(synchronous.value_or("Normal"));
+      this->Exporter.SQLite.BusyTimeoutMs = busyTimeout.value_or(5000);
+      this->Exporter.SQLite.Metrics = Config::toMetrics(metrics.value_or("*"));
+    }
+
+    // PostgreSQL Exporter Section
+    {
+      const auto postgres = ini::section{Config::POSTGRES_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(postgres, "Enabled");
+      const auto connectionString = ReadString(postgres, "ConnectionString");
+      const auto table = ReadString(postgres, "Table");
+      const auto maxBacklog = ReadUInt32(postgres, "MaxBacklog");
+      const auto reconnectMin = ReadUInt32(postgres, "ReconnectMinMs");
+      const auto reconnectMax = ReadUInt32(postgres, "ReconnectMaxMs");
+      const auto timeout = ReadUInt32(postgres, "TimeoutMs");
+      const auto metrics = ReadString(postgres, "Metrics");
+
+      this->Exporter.Postgres.Enabled = enabled.value_or(false);
+      this->Exporter.Postgres.ConnectionString = connectionString.value_or("");
+      this->Exporter.Postgres.Table = table.value_or("samples");
+      this->Exporter.Postgres.MaxBacklog = maxBacklog.value_or(100000);
+      this->Exporter.Postgres.ReconnectMinMs = reconnectMin.value_or(500);
+      this->Exporter.Postgres.ReconnectMaxMs = reconnectMax.value_or(60000);
+      this->Exporter.Postgres.TimeoutMs = timeout.value_or(5000);
+      this->Exporter.Postgres.Metrics = Config::toMetrics(metrics.value_or("*"));
+    }
+
+    // History Exporter Section
+    {
+      const auto history = ini::section{Config::HISTORY_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(history, "Enabled");
+      const auto path = ReadString(history, "Path");
+      const auto sizeMb = ReadUInt32(history, "SizeMb");
+      const auto syncInterval = ReadUInt32(history, "SyncIntervalMs");
+      const auto compression = ReadString(history, "Compression");
+      const auto rollupSizeMb = ReadUInt32(history, "RollupSizeMb");
+      const auto metrics = ReadString(history, "Metrics");
+
+      this->Exporter.History.Enabled = enabled.value_or(false);
+      this->Exporter.History.Path = path.value_or("history.ring");
+      this->Exporter.History.SizeMb = sizeMb.value_or(32);
+      this->Exporter.History.SyncIntervalMs = syncInterval.value_or(10000);
+      this->Exporter.History.Compression = HistoryExporterConfig::toCompression(compression.value_or("None"));
+      this->Exporter.History.RollupSizeMb = rollupSizeMb.value_or(8);
+      this->Exporter.History.Metrics = Config::toMetrics(metrics.value_or("*"));
+    }
+
+    // Shared Memory Exporter Section
+    {
+      const auto sharedMemory = ini::section{Config::SHARED_MEMORY_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(sharedMemory, "Enabled");
+      const auto name = ReadString(sharedMemory, "Name");
+      const auto metrics = ReadString(sharedMemory, "Metrics");
+
+      this->Exporter.SharedMemory.Enabled = enabled.value_or(false);
+      this->Exporter.SharedMemory.Name = name.value_or("/pisense");
+      this->Exporter.SharedMemory.Metrics = Config::toMetrics(metrics.value_or("*"));
+
+      // The segment holds one latest value per metric, the boards would overwrite each other's
+      if (this->Exporter.SharedMemory.Enabled && this->I2C.size() > 1) {
+        spdlog::error("[Exporter.SharedMemory] needs a single [I2C] instance, got {}", this->I2C.size());
+        throw std::runtime_error("Shared memory with several I2C instances");
+      }
+    }
+
+    // Stream Exporter Section
+    {
+      const auto stream = ini::section{Config::STREAM_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(stream, "Enabled");
+      const auto path = ReadString(stream, "Path");
+      const auto maxSubscribers = ReadUInt32(stream, "MaxSubscribers");
+      const auto maxQueueKb = ReadUInt32(stream, "MaxQueueKb");
+      const auto slowSubscriber = ReadString(stream, "SlowSubscriber");
+      const auto metrics = ReadString(stream, "Metrics");
+
+      this->Exporter.Stream.Enabled = enabled.value_or(false);
+      this->Exporter.Stream.Path = path.value_or("/run/pisense/stream.sock");
+      this->Exporter.Stream.MaxSubscribers = maxSubscribers.value_or(256);
+      this->Exporter.Stream.MaxQueueKb = maxQueueKb.value_or(256);
+      this->Exporter.Stream.SlowSubscriber = StreamExporterConfig::toSlowSubscriber(slowSubscriber.value_or("Drop"));
+      this->Exporter.Stream.Metrics = Config::toMetrics(metrics.value_or("*"));
+    }
+
+    // MQTT Exporter Section
+    {
+      const auto mqtt = ini::section{Config::MQTT_EXPORTER_SECTION};
+
+      const auto enabled = ReadBool(mqtt, "Enabled");
+      const auto host = ReadString(mqtt, "Host");
+      const auto port = ReadUInt32(mqtt, "Port");
+      const auto version = ReadString(mqtt, "Version");
+      const auto clientId = ReadString(mqtt, "ClientId");
+      const auto username = ReadString(mqtt, "Username");
+      const auto password = ReadString(mqtt, "Password");
+      const auto topic = ReadString(mqtt, "Topic");
+      const auto qos = ReadUInt32(mqtt, "Qos");
+      const auto retain = ReadBool(mqtt, "Retain");
+      const auto cleanSession = ReadBool(mqtt, "CleanSession");
+      const auto keepAlive = ReadUInt32(mqtt, "KeepAliveSec");
+      const auto sessionExpiry = ReadUInt32(mqtt, "SessionExpirySec");
+      const auto maxBacklog = ReadUInt32(mqtt, "MaxBacklog");
+      const auto maxInflight = ReadUInt32(mqtt, "MaxInflight");
+      const auto reconnectMin = ReadUInt32(mqtt, "ReconnectMinMs");
+      const auto reconnectMax = ReadUInt32(mqtt, "ReconnectMaxMs");
+      const auto timeout = ReadUInt32(mqtt, "TimeoutMs");
+      const auto metrics = ReadString(mqtt, "Metrics");
+
+      this->Exporter.Mqtt.Enabled = enabled.value_or(false);
+      this->Exporter.Mqtt.Host = host.value_or("localhost");
+      this->Exporter.Mqtt.Port = static_cast<uint16_t>(port.value_or(1883));
+      this->Exporter.Mqtt.Version = MqttExporterConfig::toVersion(version.value_or("3.1.1"));
+      this->Exporter.Mqtt.ClientId = clientId.value_or("pisense-{host}");
+      this->Exporter.Mqtt.Username = username.value_or("");
+      this->Exporter.Mqtt.Password = password.value_or("");
+      this->Exporter.Mqtt.Topic = topic.value_or("pisense/{host}/{metric}");
+      this->Exporter.Mqtt.Qos = static_cast<uint8_t>(std::min<uint32_t>(qos.value_or(1), 1));
+      this->Exporter.Mqtt.Retain = retain.value_or(false);
+      this->Exporter.Mqtt.CleanSession = cleanSession.value_or(false);
+      this->Exporter.Mqtt.KeepAliveSec = static_cast<uint16_t>(keepAlive.value_or(60));
+      this->Exporter.Mqtt.SessionExpirySec = sessionExpiry.value_or(3600);
+      this->Exporter.Mqtt.MaxBacklog = maxBacklog.value_or(100000);
+      this->Exporter.Mqtt.MaxInflight = std::max<uint32_t>(maxInflight.value_or(1000), 1);
+      this->Exporter.Mqtt.ReconnectMinMs = reconnectMin.value_or(500);
+      this->Exporter.Mqtt.ReconnectMaxMs = reconnectMax.value_or(60000);
+      this->Exporter.Mqtt.TimeoutMs = timeout.value_or(5000);
+      this->Exporter.Mqtt.Metrics = Config::toMetrics(metrics.value_or("*"));
+
+      // Otherwise the readings of every board would end up on the same topics
+      if (this->Exporter.Mqtt.Enabled && this->I2C.size() > 1 && !this->Exporter.Mqtt.Topic.contains("{source}")) {
+        spdlog::error("[Exporter.MQTT] Topic needs {{source}} with several [I2C] instances, got '{}'",
+                      this->Exporter.Mqtt.Topic);
+        throw std::runtime_error("MQTT topic without {source} with several I2C instances");
+      }
+    }
+
+    // Control Section
+    {
+      const auto control = ini::section{Config::CONTROL_SECTION};
+
+      const auto enabled = ReadBool(control, "Enabled");
+      const auto path = ReadString(control, "Path");
+
+      this->Control.Enabled = enabled.value_or(true);
+      this->Control.Path = path.value_or("/run/pisense/control.sock");
     }
 
     // Debug Section
@@ -146,10 +862,185 @@ public:
 private:
   static constexpr std::string APP_SECTION = "App";
   static constexpr std::string HTS221_SECTION = "HTS221";
+  static constexpr std::string I2C_SECTION = "I2C";
   static constexpr std::string LOGGER_SECTION = "Logger";
+  static constexpr std::string DEADBAND_SECTION = "Deadband";
   static constexpr std::string EXPORTER_SECTION = "Exporter";
+  static constexpr std::string_view ROLLUP_SECTION = "Exporter.Rollup";
+  static constexpr std::string_view SPOOL_SECTION = "Exporter.Spool";
+  static constexpr std::string_view PROMETHEUS_EXPORTER_SECTION = "Exporter.Prometheus";
+  static constexpr std::string_view SQLITE_EXPORTER_SECTION = "Exporter.SQLite";
+  static constexpr std::string_view POSTGRES_EXPORTER_SECTION = "Exporter.Postgres";
+  static constexpr std::string_view HISTORY_EXPORTER_SECTION = "Exporter.History";
+  static constexpr std::string_view SHARED_MEMORY_EXPORTER_SECTION = "Exporter.SharedMemory";
+  static constexpr std::string_view STREAM_EXPORTER_SECTION = "Exporter.Stream";
+  static constexpr std::string_view MQTT_EXPORTER_SECTION = "Exporter.MQTT";
+  static constexpr std::string CONTROL_SECTION = "Control";
   static constexpr std::string DEBUG_SECTION = "Debug";
 
+  [[nodiscard]] static I2cConfig readI2c(const ini::ini_manager &config,
+                                         const ini::section &i2c,
+                                         const I2cConfig &fallback) {
+    const auto bus = ReadString(i2c, "Bus");
+    const auto devices = ReadString(i2c, "Devices");
+    const auto muxAddress = ReadString(i2c, "MuxAddress");
+    const auto muxChannel = ReadUInt32(i2c, "MuxChannel");
+    const auto attempts = ReadUInt32(i2c, "Attempts");
+    const auto backoff = ReadUInt32(i2c, "BackoffUs");
+    const auto maxBackoff = ReadUInt32(i2c, "MaxBackoffUs");
+    const auto timeout = ReadUInt32(i2c, "TimeoutMs");
+    const auto adapterRetries = ReadUInt32(i2c, "AdapterRetries");
+    const auto recoveryThreshold = ReadUInt32(i2c, "RecoveryThreshold");
+    const auto statsInterval = ReadUInt32(i2c, "StatsIntervalMs");
+    const auto backend = ReadString(i2c, "Backend");
+    const auto iioDevice = ReadString(i2c, "IioDevice");
+    const auto iioBuffer = ReadString(i2c, "IioBuffer");
+    const auto iioTrigger = ReadString(i2c, "IioTrigger");
+    const auto iioWatermark = ReadUInt32(i2c, "IioWatermark");
+
+    I2cConfig result = fallback;
+    result.Bus = bus.value_or(fallback.Bus);
+    result.Devices = devices ? I2cConfig::toDevices(*devices) : fallback.Devices;
+    result.MuxAddress = fallback.MuxAddress;
+    result.MuxChannel = static_cast<uint8_t>(std::min<uint32_t>(muxChannel.value_or(fallback.MuxChannel), 0xFF));
+
+    if (muxAddress) {
+      const std::optional<uint8_t> address = I2cConfig::toAddress(*muxAddress);
+
+      if (!address) {
+        spdlog::error("Invalid I2C MuxAddress '{}'", *muxAddress);
+        throw std::runtime_error("Invalid I2C mux address");
+      }
+
+      result.MuxAddress = *address;
+    }
+
+    if (result.MuxChannel > 7) {
+      spdlog::error("I2C MuxChannel must be between 0 and 7, got {}", result.MuxChannel);
+      throw std::runtime_error("Invalid I2C mux channel");
+    }
+    result.Attempts = std::max<uint32_t>(attempts.value_or(fallback.Attempts), 1);
+    result.BackoffUs = backoff.value_or(fallback.BackoffUs);
+    result.MaxBackoffUs = std::max(maxBackoff.value_or(fallback.MaxBackoffUs), result.BackoffUs);
+    result.TimeoutMs = timeout.value_or(fallback.TimeoutMs);
+    result.AdapterRetries = adapterRetries.value_or(fallback.AdapterRetries);
+    result.RecoveryThreshold = recoveryThreshold.value_or(fallback.RecoveryThreshold);
+    result.StatsIntervalMs = statsInterval.value_or(fallback.StatsIntervalMs);
+    result.Backend = backend ? Config::toDriver(*backend) : fallback.Backend;
+    result.IioDevice = iioDevice.value_or(fallback.IioDevice);
+    result.IioBuffer = iioBuffer.value_or(fallback.IioBuffer);
+    result.IioTrigger = iioTrigger.value_or(fallback.IioTrigger);
+    result.IioWatermark = std::max<uint32_t>(iioWatermark.value_or(fallback.IioWatermark), 1);
+
+    return result;
+  }
+
+  /**
+   * Instances on the same adapter share one bus and worker, so they have to agree on the mux and be told apart by its
+   * channel; without a mux their sensors would answer on the same addresses. IIO instances only need a device of
+   * their own, the kernel driver owns the bus.
+   */
+  static void validateSharedBuses(const std::vector<I2cConfig> &instances) {
+    for (size_t i = 0; i < instances.size(); i++) {
+      if (instances[i].Backend == I2cConfig::Driver::Iio && instances[i].IioDevice.empty()) {
+        spdlog::error("I2C instance '{}' uses the iio backend but has no IioDevice", instances[i].Name);
+        throw std::runtime_error("Missing IIO device");
+      }
+
+      for (size_t j = 0; j < i; j++) {
+        const I2cConfig &first = instances[j];
+        const I2cConfig &second = instances[i];
+
+        if (first.Backend == I2cConfig::Driver::Iio || second.Backend == I2cConfig::Driver::Iio) {
+          if (first.Backend == second.Backend && first.IioDevice == second.IioDevice) {
+            spdlog::error("I2C instances '{}' and '{}' both read IIO device {}",
+                          first.Name,
+                          second.Name,
+                          first.IioDevice);
+            throw std::runtime_error("Conflicting IIO device");
+          }
+
+          continue;
+        }
+
+        if (first.Bus != second.Bus) {
+          continue;
+        }
+
+        if (first.MuxAddress != second.MuxAddress) {
+          spdlog::error("I2C instances '{}' and '{}' share bus {} but not its MuxAddress",
+                        first.Name,
+                        second.Name,
+                        first.Bus);
+          throw std::runtime_error("Conflicting I2C mux address");
+        }
+
+        if (first.MuxAddress == 0) {
+          spdlog::error("I2C instances '{}' and '{}' share bus {} without a mux (MuxAddress) to tell them apart",
+                        first.Name,
+                        second.Name,
+                        first.Bus);
+          throw std::runtime_error("I2C instances share a bus without a mux");
+        }
+
+        if (first.MuxChannel == second.MuxChannel) {
+          spdlog::error("I2C instances '{}' and '{}' are both on channel {} of the mux on bus {}",
+                        first.Name,
+                        second.Name,
+                        first.MuxChannel,
+                        first.Bus);
+          throw std::runtime_error("Conflicting I2C mux channel");
+        }
+      }
+    }
+  }
+
+  [[nodiscard]] static I2cConfig::Driver toDriver(const std::string &backendStr) {
+    if (backendStr == "i2c-dev") {
+      return I2cConfig::Driver::I2cDev;
+    }
+
+    if (backendStr == "iio") {
+      return I2cConfig::Driver::Iio;
+    }
+
+    spdlog::error("Invalid I2C Backend '{}', expected i2c-dev or iio", backendStr);
+    throw std::runtime_error("Invalid I2C backend");
+  }
+
+  // Parses a comma separated list of metric names, or "*" for all of them
+  [[nodiscard]] static uint32_t toMetrics(const std::string &metricsStr) {
+    const std::vector<std::string> names = splitList(metricsStr);
+
+    if (names.empty() || (names.size() == 1 && names.front() == "*")) {
+      return ALL_METRICS;
+    }
+
+    uint32_t metrics = 0;
+
+    for (const std::string &name : names) {
+      const auto metric = std::ranges::find(METRICS, name, &MetricInfo::name);
+
+      if (metric == METRICS.end()) {
+        spdlog::warn("Unknown metric '{}', ignoring it", name);
+        continue;
+      }
+
+      metrics |= 1U << static_cast<uint32_t>(metric - METRICS.begin());
+    }
+
+    return metrics;
+  }
+
+  [[nodiscard]] static int64_t toMaxSilence(const std::string &durationStr, int64_t fallback) {
+    if (const std::optional<int64_t> duration = RollupConfig::toDuration(durationStr)) {
+      return *duration;
+    }
+
+    spdlog::warn("Invalid deadband MaxSilence '{}', ignoring it", durationStr);
+    return fallback;
+  }
+
   static void createDefaultConfigFile(const std::string &filePath) {
     ini::ini_manager defaultConfig;
     defaultConfig.set_section(Config::APP_SECTION);
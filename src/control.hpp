@@ -0,0 +1,280 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <json.hpp>
+#include <spdlog/spdlog.h>
+
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace control {
+  // How long a client waits on the running instance before giving up on it
+  inline constexpr int TIMEOUT_MS = 1000;
+
+  // The console line of a sample, tagged with its source unless that is empty
+  [[nodiscard]] inline std::string line(const Sample &sample, std::string_view source) {
+    nlohmann::json::object_t output;
+    output.emplace("timestamp", sample.timestamp);
+
+    if (!source.empty()) {
+      output.emplace("source", source);
+    }
+
+    sample.forEach([&](Metric metric, double value) { output.emplace(metricInfo(metric).name, value); });
+
+    return nlohmann::json(output).dump();
+  }
+
+  /**
+   * The latest sample read from every board, taken before the deadband so a client always gets every metric rather
+   * than only the ones that moved. Written by the acquisition workers, read by the control server.
+   */
+  class Cache {
+  public:
+    explicit Cache(std::vector<std::string> sources) :
+        _sources(std::move(sources)), _tagged(this->_sources.size() > 1), _latest(this->_sources.size()) {}
+
+    Cache(const Cache &) = delete;
+    Cache &operator=(const Cache &) = delete;
+
+    void update(const Sample &sample) {
+      std::lock_guard lock(this->_mutex);
+      this->_latest[sample.source] = sample;
+    }
+
+    // One console line per board that has been read so far, empty before the first sample
+    [[nodiscard]] std::string render() const {
+      std::vector<Sample> latest;
+
+      {
+        std::lock_guard lock(this->_mutex);
+        latest = this->_latest;
+      }
+
+      std::string output;
+
+      for (size_t source = 0; source < latest.size(); source++) {
+        if (latest[source].present == 0) {
+          continue;
+        }
+
+        output += line(latest[source], this->_tagged ? std::string_view(this->_sources[source]) : std::string_view());
+        output += '\n';
+      }
+
+      return output;
+    }
+
+  private:
+    std::vector<std::string> _sources;
+    bool _tagged;
+    mutable std::mutex _mutex;
+    std::vector<Sample> _latest;
+  };
+
+  /**
+   * Answers every connection to an `AF_UNIX` stream socket with the cached console lines and closes it, so `--once`
+   * and `--client` can read the latest samples of the running instance instead of opening the bus next to it.
+   */
+  class Server {
+  public:
+    Server(const Cache &cache, telemetry::Registry &registry) : _cache(cache) {
+      registry.counter("pisense_control_requests_total", "Clients answered on the control socket", this->_requests);
+    }
+
+    ~Server() noexcept { this->stop(); }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    void start(const std::string &path) {
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+
+      if (path.size() >= sizeof(addr.sun_path)) {
+        spdlog::error("Control socket path '{}' is too long", path);
+        throw std::runtime_error("Control socket path too long");
+      }
+
+      std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+      // A socket file left behind by a previous run would make bind fail
+      ::unlink(path.c_str());
+
+      this->_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+      if (this->_listenFd < 0 || ::bind(this->_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+          ::listen(this->_listenFd, SOMAXCONN) < 0) {
+        spdlog::error("Failed to listen on {}: {}", path, strerror(errno));
+        this->closeAll();
+        throw std::runtime_error("Failed to start control server");
+      }
+
+      this->_path = path;
+      this->_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      spdlog::info("Control server listening on {}", path);
+
+      this->_worker = std::thread([this] { this->run(); });
+    }
+
+    void stop() noexcept {
+      if (this->_worker.joinable()) {
+        const uint64_t one = 1;
+        (void)::write(this->_wakeFd, &one, sizeof(one));
+        this->_worker.join();
+      }
+
+      this->closeAll();
+    }
+
+  private:
+    const Cache &_cache;
+    std::string _path;
+    int _listenFd{-1};
+    int _wakeFd{-1};
+    std::thread _worker;
+    telemetry::Counter _requests;
+
+    void run() {
+      std::array<pollfd, 2> fds{pollfd{.fd = this->_listenFd, .events = POLLIN, .revents = 0},
+                                pollfd{.fd = this->_wakeFd, .events = POLLIN, .revents = 0}};
+
+      while (true) {
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          spdlog::error("Control server poll failed: {}", strerror(errno));
+          return;
+        }
+
+        if (fds[1].revents != 0) {
+          return;
+        }
+
+        if (fds[0].revents != 0) {
+          this->accept();
+        }
+      }
+    }
+
+    // The answer is a few hundred bytes per board and fits the socket buffer, so a client that doesn't read can't
+    // hold up the next one
+    void accept() {
+      while (true) {
+        const int fd = ::accept4(this->_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            spdlog::warn("Control server failed to accept connection: {}", strerror(errno));
+          }
+
+          return;
+        }
+
+        const std::string output = this->_cache.render();
+
+        if (!output.empty() && ::send(fd, output.data(), output.size(), MSG_NOSIGNAL) < 0) {
+          spdlog::warn("Control server failed to answer a client: {}", strerror(errno));
+        }
+
+        ::close(fd);
+        this->_requests.increment();
+      }
+    }
+
+    void closeAll() noexcept {
+      for (int *fd : {&this->_listenFd, &this->_wakeFd}) {
+        if (*fd >= 0) {
+          ::close(*fd);
+          *fd = -1;
+        }
+      }
+
+      if (!this->_path.empty()) {
+        ::unlink(this->_path.c_str());
+        this->_path.clear();
+      }
+    }
+  };
+
+  /**
+   * Asks the instance listening on path for its latest samples. Fails with ENOENT or ECONNREFUSED when there is no
+   * instance running, anything else means there is one but it didn't answer in time. An empty answer means it hasn't
+   * read anything yet.
+   */
+  [[nodiscard]] inline std::expected<std::string, int> query(const std::string &path, int timeoutMs) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+
+    if (path.size() >= sizeof(addr.sun_path)) {
+      return std::unexpected(ENAMETOOLONG);
+    }
+
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+      return std::unexpected(errno);
+    }
+
+    const timeval timeout{.tv_sec = timeoutMs / 1000, .tv_usec = (timeoutMs % 1000) * 1000};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+      const int error = errno;
+      ::close(fd);
+      return std::unexpected(error);
+    }
+
+    std::string output;
+    std::array<char, 4096> buffer{};
+
+    while (true) {
+      const ssize_t received = ::read(fd, buffer.data(), buffer.size());
+
+      if (received == 0) {
+        break;
+      }
+
+      if (received < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+
+        const int error = errno;
+        ::close(fd);
+        return std::unexpected(error);
+      }
+
+      output.append(buffer.data(), static_cast<size_t>(received));
+    }
+
+    ::close(fd);
+    return output;
+  }
+
+  [[nodiscard]] inline bool absent(int error) noexcept { return error == ENOENT || error == ECONNREFUSED; }
+} // namespace control
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace crc32 {
+  namespace detail {
+    constexpr std::array<uint32_t, 256> TABLE = [] {
+      std::array<uint32_t, 256> table{};
+
+      for (uint32_t i = 0; i < table.size(); i++) {
+        uint32_t crc = i;
+
+        for (int bit = 0; bit < 8; bit++) {
+          crc = (crc & 1U) != 0 ? (crc >> 1U) ^ 0xEDB88320U : crc >> 1U;
+        }
+
+        table[i] = crc;
+      }
+
+      return table;
+    }();
+  } // namespace detail
+
+  // Continues a CRC-32 (IEEE 802.3) over more data; start with `update(0, ...)`
+  [[nodiscard]] inline uint32_t update(uint32_t crc, std::span<const std::byte> data) {
+    crc = ~crc;
+
+    for (const std::byte byte : data) {
+      crc = detail::TABLE[(crc ^ static_cast<uint32_t>(byte)) & 0xFFU] ^ (crc >> 8U);
+    }
+
+    return ~crc;
+  }
+} // namespace crc32
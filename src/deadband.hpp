@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "config.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace deadband {
+  /**
+   * Change-based reporting: a metric is only kept in a sample when it moved by more than its deadband since the value
+   * last reported, or when it hasn't been reported for longer than its max silence. Runs before a sample is serialized
+   * or queued, so whatever it drops costs nothing further down the line.
+   */
+  class Filter {
+  public:
+    Filter(const DeadbandConfig &config, telemetry::Registry &registry, const std::string &labels = {}) :
+        _thresholds(config.Thresholds), _maxSilence(config.MaxSilence) {
+      registry.counter("pisense_deadband_values_total",
+                       "Metric values evaluated by the deadband",
+                       this->_values,
+                       labels);
+      registry.counter("pisense_deadband_suppressed_total",
+                       "Metric values suppressed by the deadband",
+                       this->_suppressed,
+                       labels);
+      registry.gauge(
+          "pisense_deadband_suppression_ratio",
+          "Fraction of metric values suppressed by the deadband",
+          [this] {
+            const uint64_t values = this->_values.value();
+            return values == 0 ? 0.0 : static_cast<double>(this->_suppressed.value()) / values;
+          },
+          labels);
+    }
+
+    Filter(const Filter &) = delete;
+    Filter &operator=(const Filter &) = delete;
+
+    // Clears the metrics of the sample that don't need reporting. Returns false when none are left
+    bool apply(Sample &sample) {
+      uint64_t values = 0;
+      uint64_t suppressed = 0;
+
+      sample.forEach([&](Metric metric, double value) {
+        const auto index = static_cast<size_t>(metric);
+        Reported &reported = this->_reported[index];
+        values++;
+
+        if (reported.timestamp != 0 && !this->due(index, reported, sample.timestamp) &&
+            !this->moved(index, reported.value, value)) {
+          sample.clear(metric);
+          suppressed++;
+          return;
+        }
+
+        reported = {.value = value, .timestamp = sample.timestamp};
+      });
+
+      this->_values.increment(values);
+      this->_suppressed.increment(suppressed);
+
+      return sample.present != 0;
+    }
+
+  private:
+    struct Reported {
+      double value{0.0};
+      int64_t timestamp{0};
+    };
+
+    std::array<double, METRIC_COUNT> _thresholds;
+    std::array<int64_t, METRIC_COUNT> _maxSilence;
+    std::array<Reported, METRIC_COUNT> _reported{};
+    telemetry::Counter _values;
+    telemetry::Counter _suppressed;
+
+    // A clock stepping backwards counts as due, rather than silencing the metric until it catches up again
+    [[nodiscard]] bool due(size_t index, const Reported &reported, int64_t timestamp) const {
+      const int64_t elapsed = timestamp - reported.timestamp;
+      return elapsed < 0 || elapsed >= this->_maxSilence[index];
+    }
+
+    // A value going to or coming back from NaN is always a change worth reporting
+    [[nodiscard]] bool moved(size_t index, double last, double value) const {
+      if (std::isnan(last) || std::isnan(value)) {
+        return std::isnan(last) != std::isnan(value);
+      }
+
+      return std::abs(value - last) > this->_thresholds[index];
+    }
+  };
+} // namespace deadband
@@ -0,0 +1,540 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "rollup.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+#include "timestamp.hpp"
+
+class Sink {
+public:
+  // `metrics` are the ones the sink consumes, a combination of metricBit
+  explicit Sink(uint32_t metrics = ALL_METRICS) : _metrics(metrics) {}
+
+  virtual ~Sink() = default;
+
+  [[nodiscard]] virtual std::string_view name() const = 0;
+
+  [[nodiscard]] uint32_t metrics() const noexcept { return this->_metrics; }
+
+  virtual void write(std::span<const Sample> batch) = 0;
+
+  // Sinks that wait on a remote end are written on a thread of their own, so a slow or unreachable peer holds up
+  // nothing but itself
+  [[nodiscard]] virtual bool remote() const { return false; }
+
+  // How long a remote sink can go without a batch before `idle()` is called on its thread, zero for never
+  [[nodiscard]] virtual std::chrono::milliseconds idleInterval() const { return std::chrono::milliseconds::zero(); }
+
+  // Lets a remote sink tend its connection between batches, e.g. to keep it alive
+  virtual void idle() {}
+
+  // Storage sinks persist finished rollup buckets; everything else can ignore them
+  virtual void writeRollup([[maybe_unused]] const rollup::Resolution &resolution,
+                           [[maybe_unused]] std::span<const rollup::Bucket> buckets) {}
+
+private:
+  uint32_t _metrics;
+};
+
+/**
+ * Fixed-capacity FIFO of samples and the CLOCK_MONOTONIC times they were acquired at. Once full, every push overwrites
+ * the oldest entry, so dropping costs no more than queueing.
+ */
+class SampleQueue {
+public:
+  explicit SampleQueue(size_t capacity) :
+      _samples(std::max<size_t>(capacity, 1)), _acquired(std::max<size_t>(capacity, 1)) {}
+
+  [[nodiscard]] bool empty() const noexcept { return this->_size == 0; }
+
+  // False when the queue was full and the oldest sample was dropped to make room
+  bool push(const Sample &sample, int64_t acquired) noexcept {
+    const size_t capacity = this->_samples.size();
+    const bool full = this->_size == capacity;
+
+    if (full) {
+      this->_head = (this->_head + 1) % capacity;
+      this->_size--;
+    }
+
+    const size_t tail = (this->_head + this->_size) % capacity;
+    this->_samples[tail] = sample;
+    this->_acquired[tail] = acquired;
+    this->_size++;
+
+    return !full;
+  }
+
+  // Appends everything queued, oldest first, to `samples` and `acquired` and leaves the queue empty
+  void drain(std::vector<Sample> &samples, std::vector<int64_t> &acquired) {
+    const size_t first = std::min(this->_size, this->_samples.size() - this->_head);
+
+    SampleQueue::take(this->_samples, this->_head, first, this->_size, samples);
+    SampleQueue::take(this->_acquired, this->_head, first, this->_size, acquired);
+
+    this->_head = 0;
+    this->_size = 0;
+  }
+
+private:
+  std::vector<Sample> _samples;
+  std::vector<int64_t> _acquired; // Parallel to `_samples`, so sinks still get a contiguous span of samples
+  size_t _head{0};
+  size_t _size{0};
+
+  // The queued entries may wrap around the end of the ring, `first` of them are before the wrap
+  template <typename T>
+  static void take(const std::vector<T> &ring, size_t head, size_t first, size_t size, std::vector<T> &out) {
+    const auto begin = ring.begin() + static_cast<ptrdiff_t>(head);
+
+    out.insert(out.end(), begin, begin + static_cast<ptrdiff_t>(first));
+    out.insert(out.end(), ring.begin(), ring.begin() + static_cast<ptrdiff_t>(size - first));
+  }
+};
+
+/**
+ * The thread a remote sink is written on. The export thread only queues the sink's samples here and moves on; when
+ * the sink falls more than the queue capacity behind, its oldest samples are dropped.
+ */
+class SinkWorker {
+public:
+  SinkWorker(Sink &sink,
+             size_t capacity,
+             telemetry::Counter &written,
+             telemetry::Histogram &latency,
+             telemetry::Counter &errors) :
+      _sink(sink), _pending(capacity), _written(written), _latency(latency), _errors(errors) {
+    this->_batch.reserve(capacity);
+    this->_batchAcquired.reserve(capacity);
+  }
+
+  ~SinkWorker() { this->stop(); }
+
+  SinkWorker(const SinkWorker &) = delete;
+  SinkWorker &operator=(const SinkWorker &) = delete;
+
+  void start() {
+    if (this->_worker.joinable()) {
+      return;
+    }
+
+    this->_running = true;
+    this->_worker = std::thread([this] { this->run(); });
+  }
+
+  // Whatever is still queued is written before the thread exits
+  void stop() {
+    {
+      std::lock_guard lock(this->_mutex);
+      this->_running = false;
+    }
+
+    this->_wake.notify_all();
+
+    if (this->_worker.joinable()) {
+      this->_worker.join();
+    }
+  }
+
+  // Returns how many queued samples were dropped to make room
+  size_t push(std::span<const Sample> batch, std::span<const int64_t> acquired) {
+    size_t dropped = 0;
+
+    {
+      std::lock_guard lock(this->_mutex);
+
+      for (size_t i = 0; i < batch.size(); i++) {
+        dropped += this->_pending.push(batch[i], acquired[i]) ? 0 : 1;
+      }
+    }
+
+    this->_wake.notify_one();
+
+    return dropped;
+  }
+
+private:
+  Sink &_sink;
+  SampleQueue _pending;
+  std::vector<Sample> _batch;
+  std::vector<int64_t> _batchAcquired;
+  telemetry::Counter &_written;
+  telemetry::Histogram &_latency;
+  telemetry::Counter &_errors;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _running{false};
+  std::thread _worker;
+
+  void run() {
+    const std::chrono::milliseconds interval = this->_sink.idleInterval();
+
+    while (true) {
+      bool idle = false;
+
+      {
+        std::unique_lock lock(this->_mutex);
+        const auto ready = [this] { return !this->_running || !this->_pending.empty(); };
+
+        if (interval > std::chrono::milliseconds::zero()) {
+          idle = !this->_wake.wait_for(lock, interval, ready);
+        } else {
+          this->_wake.wait(lock, ready);
+        }
+
+        if (!idle && this->_pending.empty()) {
+          return;
+        }
+
+        if (!idle) {
+          this->_pending.drain(this->_batch, this->_batchAcquired);
+        }
+      }
+
+      if (idle) {
+        this->idle();
+        continue;
+      }
+
+      try {
+        this->_sink.write(this->_batch);
+        this->_written.increment(this->_batch.size());
+
+        const int64_t now = Timestamp::monotonicNow();
+
+        for (const int64_t acquired : this->_batchAcquired) {
+          this->_latency.observe(now - acquired);
+        }
+      } catch (const std::exception &e) {
+        this->_errors.increment();
+        spdlog::error("{} exporter failed to write {} samples: {}", this->_sink.name(), this->_batch.size(), e.what());
+      }
+
+      this->_batch.clear();
+      this->_batchAcquired.clear();
+    }
+  }
+
+  void idle() {
+    try {
+      this->_sink.idle();
+    } catch (const std::exception &e) {
+      this->_errors.increment();
+      spdlog::error("{} exporter failed while idle: {}", this->_sink.name(), e.what());
+    }
+  }
+};
+
+/**
+ * Hands samples from the acquisition thread over to a dedicated export thread, which delivers them to every sink in
+ * batches. Publishing only takes a short lock and never waits on a sink, so a slow destination can't delay a tick.
+ * Remote sinks are handed their samples on a `SinkWorker` of their own, so one waiting on its peer can't delay the
+ * others either.
+ *
+ * Each sample travels with the CLOCK_MONOTONIC time it was acquired at, and the time from acquisition until each sink
+ * has written it is recorded in a per-sink latency histogram.
+ *
+ * Only the metrics some sink consumes need to be read at all (see `metrics()`), and every sink is only handed the
+ * ones it consumes.
+ */
+class Exporter {
+public:
+  Exporter(const ExporterConfig &config, telemetry::Registry &registry) :
+      _capacity(config.QueueCapacity), _registry(registry), _pending(config.QueueCapacity) {
+    this->_batch.reserve(config.QueueCapacity);
+    this->_batchAcquired.reserve(config.QueueCapacity);
+
+    registry.counter("pisense_exporter_dropped_total",
+                     "Samples dropped because the export queue was full",
+                     this->_dropped);
+    registry.counter("pisense_exporter_errors_total", "Sink writes that failed", this->_errors);
+    registry.histogram("pisense_exporter_queue_latency_seconds",
+                       "Time from acquiring a sample to the export thread picking it up",
+                       this->_queueLatency);
+
+    if (config.Rollup.Enabled && !config.Rollup.Resolutions.empty()) {
+      this->_rollup.emplace(config.Rollup.Resolutions);
+      this->_finished.resize(this->_rollup->size());
+
+      registry.counter("pisense_rollup_buckets_total", "Rollup buckets finished", this->_buckets);
+    }
+  }
+
+  ~Exporter() { this->stop(); }
+
+  Exporter(const Exporter &) = delete;
+  Exporter &operator=(const Exporter &) = delete;
+
+  // Sinks are added during startup, while the registry can still take new entries
+  void add(std::unique_ptr<Sink> sink) {
+    spdlog::info("Registered {} exporter", sink->name());
+
+    std::string name(sink->name());
+    std::ranges::transform(name, name.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    auto &written = this->_written.emplace_back(std::make_unique<telemetry::Counter>());
+    this->_registry.counter("pisense_exporter_samples_total",
+                            "Samples written by each exporter sink",
+                            *written,
+                            telemetry::label("exporter", name));
+
+    auto &latency = this->_latencies.emplace_back(std::make_unique<telemetry::Histogram>());
+    this->_registry.histogram(std::format("pisense_{}_latency_seconds", name),
+                              std::format("Time from acquiring a sample to the {} exporter having written it",
+                                          sink->name()),
+                              *latency);
+
+    this->_workers.push_back(
+        sink->remote() ? std::make_unique<SinkWorker>(*sink, this->_capacity, *written, *latency, this->_errors)
+                       : nullptr);
+    this->_metrics |= sink->metrics();
+    this->_sinks.push_back(std::move(sink));
+  }
+
+  [[nodiscard]] bool empty() const { return this->_sinks.empty(); }
+
+  // Every metric some sink consumes
+  [[nodiscard]] uint32_t metrics() const noexcept { return this->_metrics; }
+
+  void start() {
+    if (this->_worker.joinable()) {
+      return;
+    }
+
+    for (const std::unique_ptr<SinkWorker> &worker : this->_workers) {
+      if (worker) {
+        worker->start();
+      }
+    }
+
+    this->_running = true;
+    this->_worker = std::thread([this] { this->run(); });
+  }
+
+  void stop() {
+    {
+      std::lock_guard lock(this->_mutex);
+      this->_running = false;
+    }
+
+    this->_wake.notify_all();
+
+    if (this->_worker.joinable()) {
+      this->_worker.join();
+    }
+
+    // Only once the export thread is done, so everything it handed over still gets written
+    for (const std::unique_ptr<SinkWorker> &worker : this->_workers) {
+      if (worker) {
+        worker->stop();
+      }
+    }
+  }
+
+  // `acquired` is the CLOCK_MONOTONIC time in nanoseconds the sample was read at
+  void publish(const Sample &sample, int64_t acquired) {
+    {
+      std::lock_guard lock(this->_mutex);
+
+      if (!this->_pending.push(sample, acquired)) {
+        this->_dropped.increment();
+      }
+    }
+
+    this->_wake.notify_one();
+  }
+
+private:
+  size_t _capacity;
+  telemetry::Registry &_registry;
+  std::vector<std::unique_ptr<Sink>> _sinks;
+  std::vector<std::unique_ptr<SinkWorker>> _workers; // Parallel to `_sinks`, null for sinks written right here
+  uint32_t _metrics{0};
+  SampleQueue _pending;
+  std::vector<Sample> _batch;
+  std::vector<Sample> _selected;
+  std::vector<int64_t> _selectedAcquired; // Parallel to `_selected`
+  std::vector<int64_t> _batchAcquired; // Parallel to `_batch`
+  std::vector<std::unique_ptr<telemetry::Histogram>> _latencies; // Parallel to `_sinks`
+  std::vector<std::unique_ptr<telemetry::Counter>> _written; // Parallel to `_sinks`
+  telemetry::Histogram _queueLatency;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _running{false};
+  std::thread _worker;
+  telemetry::Counter _dropped;
+  telemetry::Counter _errors;
+  std::optional<rollup::Engine> _rollup;
+  std::vector<std::vector<rollup::Bucket>> _finished;
+  std::vector<rollup::Bucket> _selectedBuckets;
+  telemetry::Counter _buckets;
+
+  void run() {
+    while (true) {
+      {
+        std::unique_lock lock(this->_mutex);
+        this->_wake.wait(lock, [this] { return !this->_running || !this->_pending.empty(); });
+
+        if (this->_pending.empty()) {
+          this->flushRollups();
+          return;
+        }
+
+        // The batch vectors keep their capacity, so steady state runs without allocating
+        this->_pending.drain(this->_batch, this->_batchAcquired);
+      }
+
+      this->observe(this->_queueLatency);
+      this->deliver();
+      this->_batch.clear();
+      this->_batchAcquired.clear();
+    }
+  }
+
+  void deliver() {
+    for (size_t i = 0; i < this->_sinks.size(); i++) {
+      const std::unique_ptr<Sink> &sink = this->_sinks[i];
+
+      const std::span<const Sample> batch = this->select(*sink);
+
+      if (batch.empty()) {
+        continue;
+      }
+
+      if (this->_workers[i]) {
+        const bool whole = batch.data() == this->_batch.data();
+        this->_dropped.increment(
+            this->_workers[i]->push(batch, whole ? this->_batchAcquired : this->_selectedAcquired));
+        continue;
+      }
+
+      try {
+        sink->write(batch);
+        this->_written[i]->increment(batch.size());
+        this->observe(*this->_latencies[i]);
+      } catch (const std::exception &e) {
+        this->_errors.increment();
+        spdlog::error("{} exporter failed to write {} samples: {}", sink->name(), batch.size(), e.what());
+      }
+    }
+
+    if (this->_rollup) {
+      for (const Sample &sample : this->_batch) {
+        this->_rollup->add(sample, [this](size_t level, const rollup::Bucket &bucket) {
+          this->_finished[level].push_back(bucket);
+        });
+      }
+
+      this->deliverRollups();
+    }
+  }
+
+  // A sink consuming every metric in the batch gets it as it is, any other one a copy with only its own metrics.
+  // Samples left without any are skipped
+  [[nodiscard]] std::span<const Sample> select(const Sink &sink) {
+    if ((this->_metrics & ~sink.metrics()) == 0) {
+      return this->_batch;
+    }
+
+    this->_selected.clear();
+    this->_selectedAcquired.clear();
+
+    for (size_t i = 0; i < this->_batch.size(); i++) {
+      Sample sample = this->_batch[i];
+      sample.present &= sink.metrics();
+
+      if (sample.present != 0) {
+        this->_selected.push_back(sample);
+        this->_selectedAcquired.push_back(this->_batchAcquired[i]);
+      }
+    }
+
+    return this->_selected;
+  }
+
+  [[nodiscard]] std::span<const rollup::Bucket> select(const Sink &sink, std::span<const rollup::Bucket> buckets) {
+    if ((this->_metrics & ~sink.metrics()) == 0) {
+      return buckets;
+    }
+
+    this->_selectedBuckets.assign(buckets.begin(), buckets.end());
+
+    for (rollup::Bucket &bucket : this->_selectedBuckets) {
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        if ((sink.metrics() & (1U << i)) == 0) {
+          bucket.metrics[i] = {};
+        }
+      }
+    }
+
+    return this->_selectedBuckets;
+  }
+
+  void observe(telemetry::Histogram &histogram) const {
+    const int64_t now = Timestamp::monotonicNow();
+
+    for (const int64_t acquired : this->_batchAcquired) {
+      histogram.observe(now - acquired);
+    }
+  }
+
+  void flushRollups() {
+    if (!this->_rollup) {
+      return;
+    }
+
+    this->_rollup->flush([this](size_t level, const rollup::Bucket &bucket) {
+      this->_finished[level].push_back(bucket);
+    });
+
+    this->deliverRollups();
+  }
+
+  void deliverRollups() {
+    for (size_t level = 0; level < this->_finished.size(); level++) {
+      std::vector<rollup::Bucket> &buckets = this->_finished[level];
+
+      if (buckets.empty()) {
+        continue;
+      }
+
+      for (const std::unique_ptr<Sink> &sink : this->_sinks) {
+        // Buckets are only stored locally, and a remote sink's own thread may be writing to it right now
+        if (sink->remote()) {
+          continue;
+        }
+
+        try {
+          sink->writeRollup(this->_rollup->resolution(level), this->select(*sink, buckets));
+        } catch (const std::exception &e) {
+          this->_errors.increment();
+          spdlog::error("{} exporter failed to write {} rollup buckets: {}", sink->name(), buckets.size(), e.what());
+        }
+      }
+
+      this->_buckets.increment(buckets.size());
+      buckets.clear();
+    }
+  }
+};
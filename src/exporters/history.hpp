@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "gorilla.hpp"
+#include "ring_store.hpp"
+#include "rollup.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace history {
+  /**
+   * Keeps a bounded local history of samples in a memory-mapped ring file. Appends are plain memory writes; the file
+   * is only synced every `SyncIntervalMs`, so the export thread makes no syscalls per sample.
+   *
+   * Rollup buckets go to one ring file per resolution next to the sample file, e.g. `history.1m.ring`.
+   */
+  class Sink : public ::Sink {
+  public:
+    Sink(const HistoryExporterConfig &config, telemetry::Registry &registry) :
+        ::Sink(config.Metrics),
+        _store(Sink::open(config)),
+        _path(config.Path),
+        _rollupSize(static_cast<size_t>(config.RollupSizeMb) * 1024 * 1024),
+        _syncInterval(config.SyncIntervalMs),
+        _lastSync(Clock::now()) {
+      registry.counter("pisense_history_records_total", "Samples appended to the history file", this->_records);
+      registry.counter("pisense_history_syncs_total", "History file syncs to storage", this->_syncs);
+    }
+
+    [[nodiscard]] std::string_view name() const override { return "History"; }
+
+    void write(std::span<const Sample> batch) override {
+      std::visit(
+          [&](auto &store) {
+            for (const Sample &sample : batch) {
+              store.append(sample);
+            }
+          },
+          this->_store);
+
+      this->_records.increment(batch.size());
+
+      const Clock::time_point now = Clock::now();
+
+      if (now - this->_lastSync >= this->_syncInterval) {
+        std::visit([](auto &store) { store.sync(); }, this->_store);
+
+        for (auto &[label, store] : this->_rollups) {
+          store->sync();
+        }
+
+        this->_syncs.increment();
+        this->_lastSync = now;
+      }
+    }
+
+    void writeRollup(const rollup::Resolution &resolution, std::span<const rollup::Bucket> buckets) override {
+      auto it = this->_rollups.find(resolution.label);
+
+      if (it == this->_rollups.end()) {
+        auto store = std::make_unique<RollupStore>(Sink::rollupPath(this->_path, resolution.label), this->_rollupSize);
+        it = this->_rollups.emplace(resolution.label, std::move(store)).first;
+      }
+
+      for (const rollup::Bucket &bucket : buckets) {
+        it->second->append(bucket);
+      }
+    }
+
+    // history.ring -> history.1m.ring
+    [[nodiscard]] static std::string rollupPath(const std::string &path, std::string_view label) {
+      std::filesystem::path result(path);
+      result.replace_extension(std::format(".{}{}", label, result.extension().string()));
+
+      return result.string();
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    using RawStore = ring::Store<Sample>;
+    using CompressedStore = ring::Store<Sample, gorilla::SampleCodec>;
+    using Store = std::variant<RawStore, CompressedStore>;
+    using RollupStore = ring::Store<rollup::Bucket>;
+
+    Store _store;
+    std::string _path;
+    size_t _rollupSize;
+    std::map<std::string, std::unique_ptr<RollupStore>, std::less<>> _rollups;
+    std::chrono::milliseconds _syncInterval;
+    Clock::time_point _lastSync;
+    telemetry::Counter _records;
+    telemetry::Counter _syncs;
+
+    static Store open(const HistoryExporterConfig &config) {
+      const size_t size = static_cast<size_t>(config.SizeMb) * 1024 * 1024;
+
+      if (config.Compression == HistoryExporterConfig::Compression::Gorilla) {
+        return Store(std::in_place_type<CompressedStore>, config.Path, size);
+      }
+
+      return Store(std::in_place_type<RawStore>, config.Path, size);
+    }
+  };
+} // namespace history
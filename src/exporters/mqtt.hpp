@@ -0,0 +1,888 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "sample.hpp"
+#include "spool.hpp"
+#include "telemetry.hpp"
+
+namespace mqtt {
+  /**
+   * Publish-only MQTT 3.1.1 / 5 client. Every present metric of a sample becomes one PUBLISH to the topic built from
+   * `Topic` (`{host}`, `{source}` and `{metric}` are substituted once, up front), with the value as a plain number
+   * payload.
+   *
+   * Messages wait in a bounded backlog and everything pending is encoded into a single buffer and sent with one write,
+   * so a batch costs one syscall however many messages it holds. With QoS 1 a message only leaves the backlog once the
+   * broker has acknowledged it, and the session is persistent, so a reconnect resends exactly what was unacknowledged.
+   * On MQTT 5 each topic is replaced by a topic alias after its first PUBLISH on a connection.
+   *
+   * With `[Exporter.Spool]` enabled, samples arriving while the broker is unreachable go to the disk spool instead of
+   * the backlog, and are published again at the spool's replay rate once the broker is back.
+   *
+   * Resolving and connecting to the broker and waiting on its acknowledgements all block, so the sink runs on a thread
+   * of its own (see `::Sink::remote`) and only ever holds up its own samples.
+   */
+  class Sink : public ::Sink {
+  public:
+    Sink(const MqttExporterConfig &config,
+         const SpoolConfig &spool,
+         const std::vector<std::string> &sources,
+         telemetry::Registry &registry) :
+        ::Sink(config.Metrics),
+        _config(config),
+        _topics(sources.size() * METRIC_COUNT),
+        _aliased(this->_topics.size()),
+        _backoff(config.ReconnectMinMs) {
+      if (spool.Enabled) {
+        this->_spool = std::make_unique<spool::Spool>(spool, "mqtt", registry);
+      }
+
+      for (size_t source = 0; source < sources.size(); source++) {
+        for (size_t i = 0; i < METRIC_COUNT; i++) {
+          this->_topics[source * METRIC_COUNT + i] =
+              MqttExporterConfig::expand(config.Topic, METRICS[i].name, sources[source]);
+        }
+      }
+
+      this->_clientId = MqttExporterConfig::expand(config.ClientId, "", "");
+
+      registry.counter("pisense_mqtt_messages_total", "MQTT messages delivered to the broker", this->_messages);
+      registry.counter("pisense_mqtt_writes_total", "Socket writes carrying coalesced MQTT packets", this->_writes);
+      registry.counter("pisense_mqtt_dropped_total",
+                       "MQTT messages dropped because the backlog was full while the broker was unreachable",
+                       this->_dropped);
+      registry.counter("pisense_mqtt_reconnects_total", "Successful MQTT (re)connections", this->_reconnects);
+      registry.gauge("pisense_mqtt_backlog", "MQTT messages waiting to be delivered", [this] {
+        return static_cast<double>(this->_backlogSize.load(std::memory_order_relaxed));
+      });
+      registry.gauge("pisense_mqtt_reconnect_seconds",
+                     "Time from losing the broker connection to delivering the backlog again, for the last outage",
+                     [this] { return this->_recoverySeconds.load(std::memory_order_relaxed); });
+    }
+
+    ~Sink() override {
+      if (this->_fd >= 0) {
+        const std::array<char, 2> disconnect{static_cast<char>(0xE0), 0};
+        this->send({disconnect.data(), disconnect.size()});
+      }
+
+      this->disconnect();
+
+      // Whatever is still backlogged is kept in the spool for the next run, one metric per sample
+      if (this->_spool && !this->_backlog.empty()) {
+        std::vector<Sample> backlog;
+        backlog.reserve(this->_backlog.size());
+
+        for (const Message &message : this->_backlog) {
+          Sample sample;
+          sample.timestamp = message.timestamp;
+          sample.source = message.source;
+          sample.set(message.metric, message.value);
+          backlog.push_back(sample);
+        }
+
+        this->_spool->append(backlog);
+      }
+    }
+
+    Sink(const Sink &) = delete;
+    Sink &operator=(const Sink &) = delete;
+
+    [[nodiscard]] std::string_view name() const override { return "MQTT"; }
+
+    [[nodiscard]] bool remote() const override { return true; }
+
+    // Half the keep-alive period, so a quiet connection is pinged well before the broker gives up on it
+    [[nodiscard]] std::chrono::milliseconds idleInterval() const override {
+      return std::chrono::milliseconds(this->_config.KeepAliveSec * 1000) / 2;
+    }
+
+    // Between batches nothing else reads the socket, so this is also where acknowledgements and a closed connection
+    // are noticed
+    void idle() override {
+      if (this->_fd >= 0 && (!this->receive() || !this->keepAlive())) {
+        spdlog::warn("MQTT connection lost, keeping {} messages for retry: {}", this->_backlog.size(), strerror(errno));
+        this->lost();
+      }
+    }
+
+    void write(std::span<const Sample> batch) override {
+      if (this->_fd < 0 && !this->connect()) {
+        this->spill(batch);
+        return;
+      }
+
+      this->enqueue(batch);
+      this->replay();
+
+      if (!this->receive() || !this->publish() || !this->keepAlive()) {
+        spdlog::warn("MQTT connection lost, keeping {} messages for retry: {}", this->_backlog.size(), strerror(errno));
+        this->lost();
+      }
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message {
+      int64_t timestamp;
+      double value;
+      Metric metric;
+      uint8_t source;
+      uint16_t packetId{0}; // Non-zero once sent with QoS 1 on the current session
+      bool acknowledged{false};
+    };
+
+    static constexpr size_t INPUT_BUFFER_SIZE = 4096;
+
+    MqttExporterConfig _config;
+    std::vector<std::string> _topics; // One per source and metric
+    std::vector<bool> _aliased;
+    std::string _clientId;
+    int _fd{-1};
+    std::string _buffer;
+    std::array<char, INPUT_BUFFER_SIZE> _input{};
+    size_t _inputLength{0};
+    std::deque<Message> _backlog;
+    std::unique_ptr<spool::Spool> _spool;
+    size_t _sent{0}; // Messages at the front of the backlog already written on this connection
+    uint16_t _nextPacketId{1};
+    uint16_t _receiveMaximum{UINT16_MAX};
+    uint16_t _topicAliasMaximum{0};
+    uint32_t _backoff;
+    Clock::time_point _nextAttempt{};
+    Clock::time_point _lastSend{};
+    Clock::time_point _lostAt{};
+    bool _recovering{false};
+    size_t _recoveryRemaining{0}; // Backlogged messages at reconnect that still have to be delivered
+    std::atomic<size_t> _backlogSize{0};
+    std::atomic<double> _recoverySeconds{0.0};
+    telemetry::Counter _messages;
+    telemetry::Counter _writes;
+    telemetry::Counter _dropped;
+    telemetry::Counter _reconnects;
+
+    [[nodiscard]] bool v5() const { return this->_config.Version == MqttExporterConfig::Version::V5; }
+
+    void enqueue(std::span<const Sample> batch) {
+      for (const Sample &sample : batch) {
+        // Spooled by a run with more instances than this one, there is no topic for it
+        if (static_cast<size_t>(sample.source) * METRIC_COUNT >= this->_topics.size()) {
+          this->_dropped.increment(static_cast<uint64_t>(std::popcount(sample.present)));
+          continue;
+        }
+
+        sample.forEach([&](Metric metric, double value) {
+          if (this->_backlog.size() >= this->_config.MaxBacklog) {
+            this->_backlog.pop_front();
+            this->_sent -= std::min<size_t>(this->_sent, 1);
+            this->_dropped.increment();
+
+            // Never delivered, so it can't end a recovery either; the next delivery past it does
+            if (this->_recovering) {
+              this->_recoveryRemaining -= std::min<size_t>(this->_recoveryRemaining, 1);
+            }
+          }
+
+          this->_backlog.push_back(
+              {.timestamp = sample.timestamp, .value = value, .metric = metric, .source = sample.source});
+        });
+      }
+
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+    }
+
+    // While the broker is unreachable, new samples go to the spool when there is one
+    void spill(std::span<const Sample> batch) {
+      if (this->_spool) {
+        this->_spool->append(batch);
+      } else {
+        this->enqueue(batch);
+      }
+    }
+
+    // Tops up the backlog from the spool, never beyond what it can hold
+    void replay() {
+      const size_t backlog = std::min<size_t>(this->_backlog.size(), this->_config.MaxBacklog);
+      const size_t room = (this->_config.MaxBacklog - backlog) / METRIC_COUNT;
+
+      if (!this->_spool || room == 0) {
+        return;
+      }
+
+      this->_spool->replay(room, [this](std::span<const Sample> samples) { this->enqueue(samples); });
+    }
+
+    bool connect() {
+      if (Clock::now() < this->_nextAttempt) {
+        return false;
+      }
+
+      if (!this->open() || !this->handshake()) {
+        spdlog::warn("Failed to connect to MQTT broker {}:{}, retrying in {}ms",
+                     this->_config.Host,
+                     this->_config.Port,
+                     this->_backoff);
+        this->disconnect();
+        this->scheduleReconnect();
+        return false;
+      }
+
+      spdlog::info("Connected to MQTT broker {}:{} ({} messages backlogged, {} samples spooled)",
+                   this->_config.Host,
+                   this->_config.Port,
+                   this->_backlog.size(),
+                   this->_spool ? this->_spool->size() : 0);
+
+      this->_backoff = this->_config.ReconnectMinMs;
+      this->_reconnects.increment();
+      this->_recoveryRemaining = this->_backlog.size();
+
+      return true;
+    }
+
+    bool open() {
+      addrinfo hints{};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+
+      addrinfo *addresses = nullptr;
+      const std::string port = std::to_string(this->_config.Port);
+
+      if (::getaddrinfo(this->_config.Host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return false;
+      }
+
+      for (const addrinfo *address = addresses; address != nullptr && this->_fd < 0; address = address->ai_next) {
+        this->_fd = ::socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (this->_fd < 0) {
+          continue;
+        }
+
+        if (::connect(this->_fd, address->ai_addr, address->ai_addrlen) < 0 &&
+            (errno != EINPROGRESS || !this->wait(POLLOUT) || Sink::socketError(this->_fd) != 0)) {
+          ::close(this->_fd);
+          this->_fd = -1;
+        }
+      }
+
+      ::freeaddrinfo(addresses);
+
+      if (this->_fd < 0) {
+        return false;
+      }
+
+      const int enable = 1;
+      ::setsockopt(this->_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+      return true;
+    }
+
+    // Sends CONNECT and waits for the CONNACK; anything left unacknowledged is resent if the session survived
+    bool handshake() {
+      std::string body;
+      Sink::putString(body, "MQTT");
+      body += static_cast<char>(this->v5() ? 5 : 4);
+
+      uint8_t flags = this->_config.CleanSession ? 0x02 : 0x00;
+      flags |= this->_config.Username.empty() ? 0 : 0x80;
+      flags |= this->_config.Password.empty() ? 0 : 0x40;
+      body += static_cast<char>(flags);
+      Sink::put16(body, this->_config.KeepAliveSec);
+
+      if (this->v5()) {
+        // Session Expiry Interval, without which an MQTT 5 session ends with the connection
+        std::string properties;
+        properties += static_cast<char>(0x11);
+        Sink::put32(properties, this->_config.CleanSession ? 0 : this->_config.SessionExpirySec);
+        Sink::putVarint(body, properties.size());
+        body += properties;
+      }
+
+      Sink::putString(body, this->_clientId);
+
+      if (!this->_config.Username.empty()) {
+        Sink::putString(body, this->_config.Username);
+      }
+
+      if (!this->_config.Password.empty()) {
+        Sink::putString(body, this->_config.Password);
+      }
+
+      this->_buffer.clear();
+      this->_buffer += static_cast<char>(0x10);
+      Sink::putVarint(this->_buffer, body.size());
+      this->_buffer += body;
+
+      this->_inputLength = 0;
+
+      if (!this->send(this->_buffer)) {
+        return false;
+      }
+
+      while (true) {
+        if (!this->wait(POLLIN) || !this->read()) {
+          return false;
+        }
+
+        std::string_view packet;
+        const size_t length = this->nextPacket(packet);
+
+        if (length == 0) {
+          continue;
+        }
+
+        const bool accepted = this->connack(packet);
+        this->consume(length);
+
+        return accepted;
+      }
+    }
+
+    bool connack(std::string_view packet) {
+      if (static_cast<uint8_t>(packet[0]) != 0x20) {
+        return false;
+      }
+
+      const std::string_view body = Sink::body(packet);
+
+      if (body.size() < 2) {
+        return false;
+      }
+
+      const bool sessionPresent = (static_cast<uint8_t>(body[0]) & 0x01) != 0;
+      const auto code = static_cast<uint8_t>(body[1]);
+
+      if (code != 0) {
+        spdlog::error("MQTT broker refused the connection (reason code {:#x})", code);
+        return false;
+      }
+
+      this->_receiveMaximum = UINT16_MAX;
+      this->_topicAliasMaximum = 0;
+      this->_aliased.assign(this->_aliased.size(), false);
+
+      if (this->v5()) {
+        this->parseConnackProperties(body.substr(2));
+      }
+
+      // Messages acknowledged out of order before the connection was lost are delivered already, and resending them
+      // would publish them twice
+      const size_t acknowledged = std::erase_if(this->_backlog, [](const Message &message) {
+        return message.acknowledged;
+      });
+
+      this->_messages.increment(acknowledged);
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+
+      // Without the old session, unacknowledged messages are new messages again
+      for (Message &message : this->_backlog) {
+        if (!sessionPresent) {
+          message.packetId = 0;
+        }
+      }
+
+      this->_sent = 0;
+
+      return true;
+    }
+
+    void parseConnackProperties(std::string_view properties) {
+      size_t offset = 0;
+      const uint64_t length = Sink::getVarint(properties, offset);
+      const size_t end = std::min<size_t>(properties.size(), offset + length);
+
+      while (offset < end) {
+        const auto id = static_cast<uint8_t>(properties[offset++]);
+
+        switch (id) {
+          case 0x21: // Receive Maximum
+            this->_receiveMaximum = Sink::get16(properties, offset);
+            break;
+          case 0x22: // Topic Alias Maximum
+            this->_topicAliasMaximum = Sink::get16(properties, offset);
+            break;
+          default:
+            offset = Sink::skipProperty(properties, offset, id);
+            break;
+        }
+      }
+    }
+
+    // Sends the whole backlog, waiting for acknowledgements whenever the QoS 1 window is full
+    bool publish() {
+      while (true) {
+        if (!this->sendWindow()) {
+          return false;
+        }
+
+        if (this->_sent == this->_backlog.size()) {
+          return true;
+        }
+
+        if (!this->wait(POLLIN)) {
+          errno = ETIMEDOUT;
+          return false;
+        }
+
+        if (!this->receive()) {
+          return false;
+        }
+      }
+    }
+
+    // Encodes every message the window allows into one buffer and writes it in one go
+    bool sendWindow() {
+      const size_t inflightLimit = std::min<size_t>(this->_config.MaxInflight, this->_receiveMaximum);
+      const bool qos1 = this->_config.Qos > 0;
+      this->_buffer.clear();
+
+      size_t inflight = 0;
+
+      for (size_t i = 0; i < this->_sent; i++) {
+        inflight += qos1 && !this->_backlog[i].acknowledged ? 1 : 0;
+      }
+
+      size_t count = this->_sent;
+
+      while (count < this->_backlog.size() && (!qos1 || inflight < inflightLimit)) {
+        Message &message = this->_backlog[count];
+        const bool resend = message.packetId != 0;
+
+        if (qos1 && !resend) {
+          message.packetId = this->nextPacketId();
+        }
+
+        this->encode(message, resend);
+        inflight += qos1 ? 1 : 0;
+        count++;
+      }
+
+      if (this->_buffer.empty()) {
+        return true;
+      }
+
+      if (!this->send(this->_buffer)) {
+        return false;
+      }
+
+      this->_sent = count;
+
+      if (!qos1) {
+        this->_messages.increment(count);
+        this->_backlog.erase(this->_backlog.begin(), this->_backlog.begin() + static_cast<ptrdiff_t>(count));
+        this->_sent = 0;
+        this->delivered(count);
+      }
+
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+
+      return true;
+    }
+
+    void encode(const Message &message, bool duplicate) {
+      const size_t index = static_cast<size_t>(message.source) * METRIC_COUNT + static_cast<size_t>(message.metric);
+      const bool qos1 = this->_config.Qos > 0;
+      const bool alias = this->v5() && index < this->_topicAliasMaximum;
+      const bool sendTopic = !alias || !this->_aliased[index];
+
+      std::array<char, 32> payload{};
+      const auto result =
+          std::format_to_n(payload.data(), static_cast<std::ptrdiff_t>(payload.size()), "{}", message.value);
+      const auto payloadSize = static_cast<size_t>(result.out - payload.data());
+
+      const std::string_view topic = sendTopic ? std::string_view(this->_topics[index]) : std::string_view{};
+
+      size_t propertiesSize = 0;
+
+      if (this->v5()) {
+        propertiesSize = alias ? 3 : 0; // Topic Alias: identifier + two bytes
+      }
+
+      const size_t remaining = 2 + topic.size() + (qos1 ? 2 : 0) + (this->v5() ? 1 + propertiesSize : 0) + payloadSize;
+
+      uint8_t header = 0x30;
+      header |= duplicate ? 0x08 : 0;
+      header |= qos1 ? 0x02 : 0;
+      header |= this->_config.Retain ? 0x01 : 0;
+
+      this->_buffer += static_cast<char>(header);
+      Sink::putVarint(this->_buffer, remaining);
+      Sink::putString(this->_buffer, topic);
+
+      if (qos1) {
+        Sink::put16(this->_buffer, message.packetId);
+      }
+
+      if (this->v5()) {
+        this->_buffer += static_cast<char>(propertiesSize);
+
+        if (alias) {
+          this->_buffer += static_cast<char>(0x23);
+          Sink::put16(this->_buffer, static_cast<uint16_t>(index + 1));
+          this->_aliased[index] = true;
+        }
+      }
+
+      this->_buffer.append(payload.data(), payloadSize);
+    }
+
+    uint16_t nextPacketId() {
+      const uint16_t id = this->_nextPacketId;
+      this->_nextPacketId = this->_nextPacketId == UINT16_MAX ? 1 : this->_nextPacketId + 1;
+      return id;
+    }
+
+    // Reads whatever the broker has sent without blocking and handles PUBACKs; false if the connection is gone
+    bool receive() {
+      while (true) {
+        const ssize_t received = ::recv(this->_fd,
+                                        this->_input.data() + this->_inputLength,
+                                        this->_input.size() - this->_inputLength,
+                                        MSG_DONTWAIT);
+
+        if (received == 0) {
+          errno = ECONNRESET;
+          return false;
+        }
+
+        if (received < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+          }
+
+          break;
+        }
+
+        this->_inputLength += static_cast<size_t>(received);
+
+        if (!this->handlePackets()) {
+          return false;
+        }
+      }
+
+      return this->handlePackets();
+    }
+
+    bool handlePackets() {
+      std::string_view packet;
+
+      while (const size_t length = this->nextPacket(packet)) {
+        const auto type = static_cast<uint8_t>(packet[0]) >> 4;
+
+        if (type == 4) {
+          const std::string_view body = Sink::body(packet);
+
+          if (body.size() >= 2) {
+            size_t offset = 0;
+            this->acknowledge(Sink::get16(body, offset));
+          }
+        } else if (type == 14) {
+          errno = ECONNRESET;
+          return false;
+        }
+
+        this->consume(length);
+      }
+
+      // A packet that can't fit the input buffer is never coming from a broker we publish to
+      if (this->_inputLength == this->_input.size()) {
+        errno = EPROTO;
+        return false;
+      }
+
+      return true;
+    }
+
+    void acknowledge(uint16_t packetId) {
+      for (size_t i = 0; i < this->_sent; i++) {
+        if (this->_backlog[i].packetId == packetId) {
+          this->_backlog[i].acknowledged = true;
+          break;
+        }
+      }
+
+      size_t done = 0;
+
+      while (done < this->_sent && this->_backlog[done].acknowledged) {
+        done++;
+      }
+
+      if (done == 0) {
+        return;
+      }
+
+      this->_backlog.erase(this->_backlog.begin(), this->_backlog.begin() + static_cast<ptrdiff_t>(done));
+      this->_sent -= done;
+      this->_messages.increment(done);
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+      this->delivered(done);
+    }
+
+    // Pings the broker once half a keep-alive period has passed without sending anything
+    bool keepAlive() {
+      const auto interval = std::chrono::seconds(this->_config.KeepAliveSec) / 2;
+
+      if (this->_config.KeepAliveSec == 0 || Clock::now() - this->_lastSend < interval) {
+        return true;
+      }
+
+      const std::array<char, 2> ping{static_cast<char>(0xC0), 0};
+      return this->send({ping.data(), ping.size()});
+    }
+
+    // Tracks how long an outage took to recover from, up to the point where everything it backlogged is delivered
+    void delivered(size_t count) {
+      if (!this->_recovering || this->_fd < 0) {
+        return;
+      }
+
+      this->_recoveryRemaining -= std::min(this->_recoveryRemaining, count);
+
+      if (this->_recoveryRemaining == 0) {
+        this->_recovering = false;
+        this->_recoverySeconds.store(std::chrono::duration<double>(Clock::now() - this->_lostAt).count(),
+                                     std::memory_order_relaxed);
+      }
+    }
+
+    void lost() {
+      this->disconnect();
+      this->scheduleReconnect();
+
+      if (!this->_recovering) {
+        this->_recovering = true;
+        this->_lostAt = Clock::now();
+      }
+    }
+
+    void disconnect() {
+      if (this->_fd >= 0) {
+        ::close(this->_fd);
+        this->_fd = -1;
+      }
+
+      this->_sent = 0;
+      this->_inputLength = 0;
+    }
+
+    void scheduleReconnect() {
+      this->_nextAttempt = Clock::now() + std::chrono::milliseconds(this->_backoff);
+      this->_backoff = std::min(this->_backoff * 2, this->_config.ReconnectMaxMs);
+    }
+
+    bool send(std::string_view data) {
+      size_t sent = 0;
+
+      while (sent < data.size()) {
+        const ssize_t written = ::send(this->_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if ((errno == EAGAIN || errno == EWOULDBLOCK) && this->wait(POLLOUT)) {
+            continue;
+          }
+
+          return false;
+        }
+
+        sent += static_cast<size_t>(written);
+        this->_writes.increment();
+      }
+
+      this->_lastSend = Clock::now();
+
+      return true;
+    }
+
+    bool read() {
+      const ssize_t received = ::recv(this->_fd,
+                                      this->_input.data() + this->_inputLength,
+                                      this->_input.size() - this->_inputLength,
+                                      MSG_DONTWAIT);
+
+      if (received <= 0) {
+        return received < 0 && (errno == EAGAIN || errno == EINTR);
+      }
+
+      this->_inputLength += static_cast<size_t>(received);
+
+      return true;
+    }
+
+    // Returns the size of the first complete packet in the input buffer, or 0 if there isn't one yet
+    size_t nextPacket(std::string_view &packet) const {
+      const std::string_view input(this->_input.data(), this->_inputLength);
+
+      if (input.size() < 2) {
+        return 0;
+      }
+
+      size_t offset = 1;
+      const uint64_t length = Sink::getVarint(input, offset);
+
+      if (offset > input.size() || offset + length > input.size()) {
+        return 0;
+      }
+
+      packet = input.substr(0, offset + length);
+
+      return packet.size();
+    }
+
+    void consume(size_t length) {
+      std::memmove(this->_input.data(), this->_input.data() + length, this->_inputLength - length);
+      this->_inputLength -= length;
+    }
+
+    [[nodiscard]] bool wait(short events) const {
+      pollfd fd{this->_fd, events, 0};
+
+      return ::poll(&fd, 1, static_cast<int>(this->_config.TimeoutMs)) > 0 && (fd.revents & (POLLERR | POLLNVAL)) == 0;
+    }
+
+    [[nodiscard]] static int socketError(int fd) {
+      int error = 0;
+      socklen_t length = sizeof(error);
+      ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+      return error;
+    }
+
+    [[nodiscard]] static std::string_view body(std::string_view packet) {
+      size_t offset = 1;
+      Sink::getVarint(packet, offset);
+      return packet.substr(std::min(offset, packet.size()));
+    }
+
+    static void put16(std::string &out, uint16_t value) {
+      out += static_cast<char>(value >> 8);
+      out += static_cast<char>(value & 0xFF);
+    }
+
+    static void put32(std::string &out, uint32_t value) {
+      Sink::put16(out, static_cast<uint16_t>(value >> 16));
+      Sink::put16(out, static_cast<uint16_t>(value & 0xFFFF));
+    }
+
+    static void putString(std::string &out, std::string_view value) {
+      Sink::put16(out, static_cast<uint16_t>(value.size()));
+      out += value;
+    }
+
+    static void putVarint(std::string &out, uint64_t value) {
+      do {
+        auto byte = static_cast<uint8_t>(value % 128);
+        value /= 128;
+        out += static_cast<char>(value > 0 ? byte | 0x80 : byte);
+      } while (value > 0);
+    }
+
+    [[nodiscard]] static uint16_t get16(std::string_view in, size_t &offset) {
+      if (offset + 2 > in.size()) {
+        offset = in.size();
+        return 0;
+      }
+
+      const auto high = static_cast<uint8_t>(in[offset]);
+      const auto low = static_cast<uint8_t>(in[offset + 1]);
+      offset += 2;
+
+      const auto value = static_cast<uint16_t>((high << 8) | low);
+      return value;
+    }
+
+    // Leaves `offset` past the end of `in` if the integer is truncated
+    static uint64_t getVarint(std::string_view in, size_t &offset) {
+      uint64_t value = 0;
+
+      for (unsigned shift = 0; shift < 28; shift += 7) {
+        if (offset >= in.size()) {
+          offset = in.size() + 1;
+          return 0;
+        }
+
+        const auto byte = static_cast<uint8_t>(in[offset++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0) {
+          break;
+        }
+      }
+
+      return value;
+    }
+
+    // Skips an MQTT 5 property this client doesn't use, based on the property's data type
+    [[nodiscard]] static size_t skipProperty(std::string_view in, size_t offset, uint8_t id) {
+      switch (id) {
+        case 0x01:
+        case 0x17:
+        case 0x19:
+        case 0x24:
+        case 0x25:
+        case 0x28:
+        case 0x29:
+        case 0x2A:
+          return offset + 1;
+        case 0x13:
+        case 0x21:
+        case 0x22:
+        case 0x23:
+          return offset + 2;
+        case 0x02:
+        case 0x11:
+        case 0x18:
+        case 0x27:
+          return offset + 4;
+        case 0x0B:
+          Sink::getVarint(in, offset);
+          return offset;
+        case 0x26: { // User Property, a pair of strings
+          const uint16_t key = Sink::get16(in, offset);
+          offset += key;
+          const uint16_t value = Sink::get16(in, offset);
+          return offset + value;
+        }
+        default: {
+          // Strings and binary data, all prefixed with a two byte length
+          const uint16_t length = Sink::get16(in, offset);
+          return offset + length;
+        }
+      }
+    }
+  };
+} // namespace mqtt
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <libpq-fe.h>
+#include <poll.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "sample.hpp"
+#include "spool.hpp"
+#include "telemetry.hpp"
+
+namespace postgres {
+  /**
+   * Streams samples into PostgreSQL with `COPY ... FROM STDIN (FORMAT binary)` over a non-blocking libpq connection.
+   *
+   * Samples are queued in a bounded backlog and only removed once the server has acknowledged the COPY, so nothing is
+   * lost while the database is unreachable (beyond what the backlog can hold). Everything that piled up during an
+   * outage goes out as a single COPY stream on reconnect. libpq's pipeline mode can't carry COPY, so coalescing the
+   * backlog into one stream is how round trips are amortised instead.
+   *
+   * With `[Exporter.Spool]` enabled, samples arriving while the database is unreachable go to the disk spool instead
+   * of the backlog, and are fed back into the COPY streams at the spool's replay rate once it is reachable again.
+   *
+   * Connecting and every step of a COPY wait on the server for up to `TimeoutMs`, so the sink runs on a thread of its
+   * own (see `::Sink::remote`) and only ever holds up its own samples.
+   */
+  class Sink : public ::Sink {
+  public:
+    // `sources` are the names of the I2C instances, indexed by Sample::source
+    Sink(const PostgresExporterConfig &config,
+         const SpoolConfig &spool,
+         std::vector<std::string> sources,
+         telemetry::Registry &registry) :
+        ::Sink(config.Metrics), _config(config), _sources(std::move(sources)), _backoff(config.ReconnectMinMs) {
+      if (spool.Enabled) {
+        this->_spool = std::make_unique<spool::Spool>(spool, "postgres", registry);
+      }
+
+      std::string columns = "timestamp";
+
+      for (const MetricInfo &info : METRICS) {
+        columns += std::format(", {}", info.name);
+      }
+
+      columns += ", source";
+
+      this->_copySql = std::format("COPY {} ({}) FROM STDIN (FORMAT binary)", config.Table, columns);
+
+      registry.counter("pisense_postgres_rows_total", "Rows copied into PostgreSQL", this->_rows);
+      registry.counter("pisense_postgres_copies_total", "COPY statements completed", this->_copies);
+      registry.counter("pisense_postgres_dropped_total",
+                       "Samples dropped because the backlog was full while PostgreSQL was unreachable",
+                       this->_dropped);
+      registry.counter("pisense_postgres_reconnects_total", "Successful PostgreSQL (re)connections", this->_reconnects);
+      registry.gauge("pisense_postgres_backlog", "Samples waiting to be copied into PostgreSQL", [this] {
+        return static_cast<double>(this->_backlogSize.load(std::memory_order_relaxed));
+      });
+      registry.gauge("pisense_postgres_copy_seconds", "Duration of the last COPY round trip", [this] {
+        return this->_copySeconds.load(std::memory_order_relaxed);
+      });
+      registry.gauge("pisense_postgres_lag_seconds",
+                     "Age of the oldest sample in the last COPY when the server acknowledged it",
+                     [this] { return this->_lagSeconds.load(std::memory_order_relaxed); });
+    }
+
+    // Whatever is still backlogged is kept in the spool for the next run
+    ~Sink() override {
+      if (this->_spool && !this->_backlog.empty()) {
+        const std::vector<Sample> backlog(this->_backlog.begin(), this->_backlog.end());
+        this->_spool->append(backlog);
+      }
+
+      this->disconnect();
+    }
+
+    Sink(const Sink &) = delete;
+    Sink &operator=(const Sink &) = delete;
+
+    [[nodiscard]] std::string_view name() const override { return "PostgreSQL"; }
+
+    [[nodiscard]] bool remote() const override { return true; }
+
+    void write(std::span<const Sample> batch) override {
+      if (this->_conn == nullptr && !this->connect()) {
+        this->spill(batch);
+        return;
+      }
+
+      this->enqueue(batch);
+      this->replay();
+
+      if (!this->copy()) {
+        spdlog::warn("PostgreSQL COPY failed, keeping {} samples for retry: {}",
+                     this->_backlog.size(),
+                     ::PQerrorMessage(this->_conn));
+        this->disconnect();
+        this->scheduleReconnect();
+      }
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    // Microseconds between the Unix epoch and the PostgreSQL epoch (2000-01-01)
+    static constexpr int64_t POSTGRES_EPOCH_OFFSET_US = 946'684'800'000'000;
+    static constexpr std::string_view COPY_SIGNATURE{"PGCOPY\n\377\r\n\0", 11};
+
+    PostgresExporterConfig _config;
+    std::vector<std::string> _sources;
+    PGconn *_conn{nullptr};
+    std::string _copySql;
+    std::string _buffer;
+    std::deque<Sample> _backlog;
+    std::unique_ptr<spool::Spool> _spool;
+    uint32_t _backoff;
+    Clock::time_point _nextAttempt{};
+    std::atomic<size_t> _backlogSize{0};
+    std::atomic<double> _copySeconds{0.0};
+    std::atomic<double> _lagSeconds{0.0};
+    telemetry::Counter _rows;
+    telemetry::Counter _copies;
+    telemetry::Counter _dropped;
+    telemetry::Counter _reconnects;
+
+    void enqueue(std::span<const Sample> batch) {
+      for (const Sample &sample : batch) {
+        if (this->_backlog.size() >= this->_config.MaxBacklog) {
+          this->_backlog.pop_front();
+          this->_dropped.increment();
+        }
+
+        this->_backlog.push_back(sample);
+      }
+
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+    }
+
+    // While the database is unreachable, new samples go to the spool when there is one
+    void spill(std::span<const Sample> batch) {
+      if (this->_spool) {
+        this->_spool->append(batch);
+      } else {
+        this->enqueue(batch);
+      }
+    }
+
+    // Tops up the backlog from the spool, never beyond what it can hold
+    void replay() {
+      if (!this->_spool || this->_backlog.size() >= this->_config.MaxBacklog) {
+        return;
+      }
+
+      this->_spool->replay(this->_config.MaxBacklog - this->_backlog.size(),
+                           [this](std::span<const Sample> samples) { this->enqueue(samples); });
+    }
+
+    bool connect() {
+      if (Clock::now() < this->_nextAttempt) {
+        return false;
+      }
+
+      this->_conn = ::PQconnectStart(this->_config.ConnectionString.c_str());
+
+      bool connected = this->_conn != nullptr && ::PQstatus(this->_conn) != CONNECTION_BAD;
+
+      while (connected) {
+        const PostgresPollingStatusType status = ::PQconnectPoll(this->_conn);
+
+        if (status == PGRES_POLLING_OK) {
+          break;
+        }
+
+        if (status == PGRES_POLLING_FAILED) {
+          connected = false;
+        } else {
+          connected = this->wait(status == PGRES_POLLING_READING ? POLLIN : POLLOUT);
+        }
+      }
+
+      if (!connected || !this->prepareTable() || ::PQsetnonblocking(this->_conn, 1) != 0) {
+        spdlog::warn("Failed to connect to PostgreSQL, retrying in {}ms: {}",
+                     this->_backoff,
+                     this->_conn != nullptr ? ::PQerrorMessage(this->_conn) : "out of memory");
+        this->disconnect();
+        this->scheduleReconnect();
+        return false;
+      }
+
+      spdlog::info("Connected to PostgreSQL ({} samples backlogged, {} spooled)",
+                   this->_backlog.size(),
+                   this->_spool ? this->_spool->size() : 0);
+
+      this->_backoff = this->_config.ReconnectMinMs;
+      this->_reconnects.increment();
+
+      return true;
+    }
+
+    void disconnect() {
+      if (this->_conn != nullptr) {
+        ::PQfinish(this->_conn);
+        this->_conn = nullptr;
+      }
+    }
+
+    void scheduleReconnect() {
+      this->_nextAttempt = Clock::now() + std::chrono::milliseconds(this->_backoff);
+      this->_backoff = std::min(this->_backoff * 2, this->_config.ReconnectMaxMs);
+    }
+
+    // Runs while the connection is still blocking, so plain PQexec is fine here
+    bool prepareTable() {
+      const auto exec = [this](const std::string &sql) {
+        PGresult *result = ::PQexec(this->_conn, sql.c_str());
+        const bool ok = ::PQresultStatus(result) == PGRES_COMMAND_OK;
+        ::PQclear(result);
+        return ok;
+      };
+
+      if (!exec(std::format("CREATE TABLE IF NOT EXISTS {} (timestamp timestamptz NOT NULL)", this->_config.Table))) {
+        return false;
+      }
+
+      for (const MetricInfo &info : METRICS) {
+        if (!exec(std::format("ALTER TABLE {} ADD COLUMN IF NOT EXISTS {} double precision",
+                              this->_config.Table,
+                              info.name))) {
+          return false;
+        }
+      }
+
+      return exec(std::format("ALTER TABLE {} ADD COLUMN IF NOT EXISTS source text", this->_config.Table));
+    }
+
+    bool copy() {
+      if (this->_backlog.empty()) {
+        return true;
+      }
+
+      const Clock::time_point start = Clock::now();
+      const size_t count = this->_backlog.size();
+
+      this->encode();
+
+      if (::PQsendQuery(this->_conn, this->_copySql.c_str()) != 1 || !this->expect(PGRES_COPY_IN)) {
+        return false;
+      }
+
+      int sent = 0;
+
+      while ((sent = ::PQputCopyData(this->_conn, this->_buffer.data(), static_cast<int>(this->_buffer.size()))) == 0) {
+        if (!this->wait(POLLOUT)) {
+          return false;
+        }
+      }
+
+      if (sent < 0 || !this->sendEnd() || !this->expect(PGRES_COMMAND_OK)) {
+        return false;
+      }
+
+      // Drain the terminating null result so the connection is ready for the next COPY
+      while (PGresult *result = ::PQgetResult(this->_conn)) {
+        ::PQclear(result);
+      }
+
+      const auto now = std::chrono::system_clock::now().time_since_epoch();
+      const int64_t oldest = this->_backlog.front().timestamp;
+
+      this->_copySeconds.store(std::chrono::duration<double>(Clock::now() - start).count(), std::memory_order_relaxed);
+      this->_lagSeconds.store(static_cast<double>(std::chrono::nanoseconds(now).count() - oldest) / 1e9,
+                              std::memory_order_relaxed);
+
+      this->_backlog.erase(this->_backlog.begin(), this->_backlog.begin() + static_cast<ptrdiff_t>(count));
+      this->_backlogSize.store(this->_backlog.size(), std::memory_order_relaxed);
+      this->_rows.increment(count);
+      this->_copies.increment();
+
+      return true;
+    }
+
+    bool sendEnd() {
+      int ended = 0;
+
+      while ((ended = ::PQputCopyEnd(this->_conn, nullptr)) == 0) {
+        if (!this->wait(POLLOUT)) {
+          return false;
+        }
+      }
+
+      if (ended < 0) {
+        return false;
+      }
+
+      int pending = 0;
+
+      while ((pending = ::PQflush(this->_conn)) == 1) {
+        if (!this->wait(POLLOUT | POLLIN)) {
+          return false;
+        }
+
+        // The server may be pushing back notices while we flush; reading them keeps both sides moving
+        if (::PQconsumeInput(this->_conn) != 1) {
+          return false;
+        }
+      }
+
+      return pending == 0;
+    }
+
+    bool expect(ExecStatusType expected) {
+      while (::PQisBusy(this->_conn) == 1) {
+        if (!this->wait(POLLIN) || ::PQconsumeInput(this->_conn) != 1) {
+          return false;
+        }
+      }
+
+      PGresult *result = ::PQgetResult(this->_conn);
+      const bool ok = ::PQresultStatus(result) == expected;
+      ::PQclear(result);
+
+      return ok;
+    }
+
+    [[nodiscard]] bool wait(short events) const {
+      pollfd fd{::PQsocket(this->_conn), events, 0};
+
+      return ::poll(&fd, 1, static_cast<int>(this->_config.TimeoutMs)) > 0 && (fd.revents & (POLLERR | POLLNVAL)) == 0;
+    }
+
+    // Builds the binary COPY stream for the whole backlog, reusing the buffer's capacity between calls
+    void encode() {
+      this->_buffer.clear();
+      this->_buffer.append(COPY_SIGNATURE);
+      this->put<int32_t>(0); // Flags
+      this->put<int32_t>(0); // Header extension length
+
+      for (const Sample &sample : this->_backlog) {
+        this->put<int16_t>(static_cast<int16_t>(METRIC_COUNT + 2));
+
+        this->put<int32_t>(sizeof(int64_t));
+        this->put<int64_t>((sample.timestamp / 1000) - POSTGRES_EPOCH_OFFSET_US);
+
+        for (size_t i = 0; i < METRIC_COUNT; i++) {
+          const auto metric = static_cast<Metric>(i);
+
+          if (!sample.has(metric)) {
+            this->put<int32_t>(-1);
+            continue;
+          }
+
+          this->put<int32_t>(sizeof(double));
+          this->put<int64_t>(std::bit_cast<int64_t>(sample.get(metric)));
+        }
+
+        // Spooled by a run with more instances than this one, the source is unknown
+        if (sample.source >= this->_sources.size()) {
+          this->put<int32_t>(-1);
+          continue;
+        }
+
+        const std::string &source = this->_sources[sample.source];
+        this->put<int32_t>(static_cast<int32_t>(source.size()));
+        this->_buffer.append(source);
+      }
+
+      this->put<int16_t>(-1); // Trailer
+    }
+
+    template <typename T>
+    void put(T value) {
+      if constexpr (std::endian::native == std::endian::little) {
+        value = std::byteswap(value);
+      }
+
+      char bytes[sizeof(T)];
+      std::memcpy(bytes, &value, sizeof(T));
+      this->_buffer.append(bytes, sizeof(T));
+    }
+  };
+} // namespace postgres
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "http.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace prometheus {
+  constexpr std::string_view CONTENT_TYPE = "text/plain; version=0.0.4; charset=utf-8";
+
+  /**
+   * Double-buffered exposition body. The export thread renders into the back buffer and publishes it by swapping the
+   * front index; scrapers take a lease on the front buffer, so serving a scrape never renders, locks or allocates.
+   */
+  class Exposition {
+  private:
+    struct Buffer {
+      std::string body;
+      std::atomic<uint32_t> readers{0};
+    };
+
+  public:
+    class Lease {
+    public:
+      explicit Lease(Buffer &buffer) :
+          _buffer(&buffer) {}
+
+      ~Lease() {
+        if (this->_buffer != nullptr) {
+          this->_buffer->readers.fetch_sub(1);
+        }
+      }
+
+      Lease(const Lease &) = delete;
+      Lease &operator=(const Lease &) = delete;
+
+      Lease(Lease &&other) noexcept :
+          _buffer(std::exchange(other._buffer, nullptr)) {}
+
+      Lease &operator=(Lease &&) = delete;
+
+      [[nodiscard]] std::string_view body() const { return this->_buffer->body; }
+
+    private:
+      Buffer *_buffer;
+    };
+
+    explicit Exposition(size_t capacity) {
+      for (Buffer &buffer : this->_buffers) {
+        buffer.body.reserve(capacity);
+      }
+    }
+
+    [[nodiscard]] Lease acquire() {
+      while (true) {
+        const uint32_t front = this->_front.load();
+        Buffer &buffer = this->_buffers[front];
+        buffer.readers.fetch_add(1);
+
+        // The writer may have swapped between loading the index and registering as a reader
+        if (this->_front.load() == front) {
+          return Lease(buffer);
+        }
+
+        buffer.readers.fetch_sub(1);
+      }
+    }
+
+    /**
+     * Renders into the back buffer and makes it the front one. Returns false without rendering if a slow scraper is
+     * still holding the back buffer from before the previous swap.
+     */
+    template <typename Render>
+    bool publish(Render &&render) {
+      const uint32_t back = 1 - this->_front.load();
+      Buffer &buffer = this->_buffers[back];
+
+      if (buffer.readers.load() != 0) {
+        return false;
+      }
+
+      buffer.body.clear();
+      render(buffer.body);
+      this->_front.store(back);
+
+      return true;
+    }
+
+  private:
+    std::array<Buffer, 2> _buffers;
+    std::atomic<uint32_t> _front{0};
+  };
+
+  /**
+   * Serves the latest value of every metric from each acquisition source, plus the internal telemetry. Values are kept
+   * per source and merged sample by sample, so a metric a sample leaves out (e.g. held back by the deadband) keeps its
+   * last reported value instead of disappearing from the exposition.
+   */
+  class Sink : public ::Sink {
+  public:
+    Sink(const PrometheusExporterConfig &config, std::vector<std::string> sources, telemetry::Registry &registry) :
+        ::Sink(config.Metrics),
+        _registry(registry),
+        _sources(std::move(sources)),
+        _latest(this->_sources.size()),
+        _exposition(config.BufferSize),
+        _server(this->_exposition, config.Path, CONTENT_TYPE, registry, config.MaxConnections) {
+      registry.counter("pisense_prometheus_renders_skipped_total",
+                       "Exposition renders skipped because a scraper still held the back buffer",
+                       this->_skipped);
+
+      this->_server.start(config.Address, config.Port);
+    }
+
+    [[nodiscard]] std::string_view name() const override { return "Prometheus"; }
+
+    void write(std::span<const Sample> batch) override {
+      if (batch.empty()) {
+        return;
+      }
+
+      for (const Sample &sample : batch) {
+        if (sample.source >= this->_latest.size()) {
+          continue;
+        }
+
+        Latest &latest = this->_latest[sample.source];
+        sample.forEach([&](Metric metric, double value) { latest.values[static_cast<size_t>(metric)] = value; });
+        latest.present |= sample.present;
+      }
+
+      const bool published = this->_exposition.publish([&](std::string &body) {
+        auto out = std::back_inserter(body);
+
+        this->renderMetrics(out);
+        this->renderTelemetry(out);
+      });
+
+      if (!published) {
+        this->_skipped.increment();
+      }
+    }
+
+  private:
+    struct Latest {
+      std::array<double, METRIC_COUNT> values{};
+      uint32_t present{0};
+    };
+
+    telemetry::Registry &_registry;
+    std::vector<std::string> _sources;
+    std::vector<Latest> _latest; // Indexed by Sample::source
+    std::vector<bool> _rendered; // Scratch space for grouping registry entries by name
+    Exposition _exposition;
+    http::Server<Exposition> _server;
+    telemetry::Counter _skipped;
+
+    // With a single source the metrics keep their plain names, otherwise each line is labelled with its source
+    template <typename Out>
+    void renderMetrics(Out out) const {
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const MetricInfo &info = METRICS[i];
+        bool header = false;
+
+        for (size_t source = 0; source < this->_latest.size(); source++) {
+          if ((this->_latest[source].present & (1U << i)) == 0) {
+            continue;
+          }
+
+          if (!header) {
+            Sink::renderHeader(out, "pisense_", info.name, info.help, "gauge");
+            header = true;
+          }
+
+          const std::string labels = this->_sources.size() > 1 ? telemetry::label("source", this->_sources[source])
+                                                               : std::string();
+          Sink::renderValue(out, "pisense_", info.name, labels, this->_latest[source].values[i]);
+        }
+      }
+    }
+
+    // The text format wants every line of a metric family together, so entries sharing a name are gathered under one
+    // header wherever they were registered
+    template <typename Out>
+    void renderTelemetry(Out out) {
+      const std::vector<telemetry::Registry::Entry> &entries = this->_registry.entries();
+      this->_rendered.assign(entries.size(), false);
+
+      for (size_t i = 0; i < entries.size(); i++) {
+        if (this->_rendered[i]) {
+          continue;
+        }
+
+        const telemetry::Registry::Entry &family = entries[i];
+        const std::string_view type = family.kind == telemetry::Kind::Counter   ? "counter"
+                                      : family.kind == telemetry::Kind::Gauge ? "gauge"
+                                                                              : "histogram";
+        Sink::renderHeader(out, "", family.name, family.help, type);
+
+        for (size_t j = i; j < entries.size(); j++) {
+          const telemetry::Registry::Entry &entry = entries[j];
+
+          if (this->_rendered[j] || entry.name != family.name) {
+            continue;
+          }
+
+          this->_rendered[j] = true;
+
+          if (entry.kind == telemetry::Kind::Histogram) {
+            Sink::renderHistogram(out, entry.name, entry.labels, *entry.histogram);
+          } else {
+            Sink::renderValue(out, "", entry.name, entry.labels, entry.read());
+          }
+        }
+      }
+    }
+
+    template <typename Out>
+    static void renderHeader(Out out,
+                             std::string_view prefix,
+                             std::string_view name,
+                             std::string_view help,
+                             std::string_view type) {
+      std::format_to(out, "# HELP {0}{1} {2}\n# TYPE {0}{1} {3}\n", prefix, name, help, type);
+    }
+
+    template <typename Out>
+    static void renderValue(Out out,
+                            std::string_view prefix,
+                            std::string_view name,
+                            std::string_view labels,
+                            double value) {
+      if (labels.empty()) {
+        std::format_to(out, "{}{} ", prefix, name);
+      } else {
+        std::format_to(out, "{}{}{{{}}} ", prefix, name, labels);
+      }
+
+      if (std::isnan(value)) {
+        std::format_to(out, "NaN\n");
+      } else if (std::isinf(value)) {
+        std::format_to(out, "{}Inf\n", value > 0 ? "+" : "-");
+      } else {
+        std::format_to(out, "{}\n", value);
+      }
+    }
+
+    template <typename Out>
+    static void renderHistogram(Out out,
+                                std::string_view name,
+                                std::string_view labels,
+                                const telemetry::Histogram &histogram) {
+      const std::string_view separator = labels.empty() ? "" : ",";
+      uint64_t count = 0;
+
+      // Read bucket by bucket so +Inf and _count always agree with the buckets, even while observations land
+      for (size_t i = 0; i < telemetry::Histogram::BUCKETS.size(); i++) {
+        count += histogram.bucket(i);
+        std::format_to(out,
+                       "{}_bucket{{{}{}le=\"{}\"}} {}\n",
+                       name,
+                       labels,
+                       separator,
+                       telemetry::Histogram::BUCKETS[i],
+                       count);
+      }
+
+      count += histogram.bucket(telemetry::Histogram::BUCKETS.size());
+
+      std::format_to(out, "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, separator, count);
+
+      if (labels.empty()) {
+        std::format_to(out, "{}_sum {}\n{}_count {}\n", name, histogram.sum(), name, count);
+      } else {
+        std::format_to(out, "{0}_sum{{{1}}} {2}\n{0}_count{{{1}}} {3}\n", name, labels, histogram.sum(), count);
+      }
+    }
+  };
+} // namespace prometheus
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <pisense/latest.h>
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace shm {
+  static_assert(METRIC_COUNT <= PISENSE_LATEST_MAX_METRICS);
+
+  /**
+   * Publishes the latest value of every metric into a POSIX shared memory segment for local consumers, using the
+   * layout and seqlock protocol in `pisense/latest.h`. Publishing is a few plain stores between two sequence bumps,
+   * so the writer never waits on readers and readers never make a syscall.
+   */
+  class Sink : public ::Sink {
+  public:
+    Sink(const SharedMemoryExporterConfig &config, telemetry::Registry &registry) :
+        ::Sink(config.Metrics), _name(config.Name) {
+      const int fd = ::shm_open(config.Name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+      if (fd < 0) {
+        spdlog::error("Failed to open shared memory segment {}: {}", config.Name, strerror(errno));
+        throw std::runtime_error("Failed to open shared memory segment");
+      }
+
+      if (::ftruncate(fd, sizeof(pisense_latest)) < 0) {
+        ::close(fd);
+        spdlog::error("Failed to size shared memory segment {}: {}", config.Name, strerror(errno));
+        throw std::runtime_error("Failed to size shared memory segment");
+      }
+
+      void *map = ::mmap(nullptr, sizeof(pisense_latest), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+
+      if (map == MAP_FAILED) {
+        spdlog::error("Failed to map shared memory segment {}: {}", config.Name, strerror(errno));
+        throw std::runtime_error("Failed to map shared memory segment");
+      }
+
+      this->_latest = static_cast<pisense_latest *>(map);
+      this->initialize();
+
+      registry.counter("pisense_shm_updates_total", "Updates published to the shared memory segment", this->_updates);
+
+      SPDLOG_DEBUG("Publishing latest values to shared memory segment {}", config.Name);
+    }
+
+    // The segment is left in place so readers that already mapped it keep working across restarts
+    ~Sink() override { ::munmap(this->_latest, sizeof(pisense_latest)); }
+
+    Sink(const Sink &) = delete;
+    Sink &operator=(const Sink &) = delete;
+
+    [[nodiscard]] std::string_view name() const override { return "SharedMemory"; }
+
+    // Only the end state of the batch matters to readers, so the whole batch is folded into a single update
+    void write(std::span<const Sample> batch) override {
+      if (batch.empty()) {
+        return;
+      }
+
+      std::atomic_ref sequence(this->_latest->sequence);
+      const uint64_t start = sequence.load(std::memory_order_relaxed);
+
+      sequence.store(start + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+
+      pisense_latest_snapshot &data = this->_latest->data;
+
+      for (const Sample &sample : batch) {
+        sample.forEach([&](Metric metric, double value) {
+          data.values[static_cast<size_t>(metric)] = {.value = value, .timestamp = sample.timestamp};
+        });
+      }
+
+      data.timestamp = batch.back().timestamp;
+      data.samples += batch.size();
+
+      sequence.store(start + 2, std::memory_order_release);
+      this->_updates.increment();
+    }
+
+  private:
+    std::string _name;
+    pisense_latest *_latest{nullptr};
+    telemetry::Counter _updates;
+
+    // Keeps the values of a segment left behind by a previous run as long as its layout still matches this build
+    void initialize() {
+      pisense_latest &latest = *this->_latest;
+      std::atomic_ref magic(latest.magic);
+
+      if (magic.load(std::memory_order_acquire) == PISENSE_LATEST_MAGIC && latest.version == PISENSE_LATEST_VERSION &&
+          latest.metric_count == METRIC_COUNT && this->namesMatch()) {
+        // A writer that died mid-update left the sequence odd, which would have readers treat every later update as
+        // torn and every torn one as done
+        std::atomic_ref sequence(latest.sequence);
+        const uint64_t current = sequence.load(std::memory_order_relaxed);
+        sequence.store(current + (current & 1), std::memory_order_release);
+        return;
+      }
+
+      magic.store(0, std::memory_order_relaxed);
+      std::memset(static_cast<void *>(&latest), 0, sizeof(pisense_latest));
+
+      latest.version = PISENSE_LATEST_VERSION;
+      latest.metric_count = METRIC_COUNT;
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const std::string_view name = METRICS[i].name;
+        std::memcpy(latest.names[i], name.data(), std::min(name.size(), size_t{PISENSE_LATEST_NAME_SIZE - 1}));
+      }
+
+      magic.store(PISENSE_LATEST_MAGIC, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool namesMatch() const {
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const char *name = this->_latest->names[i];
+
+        if (std::string_view(name, ::strnlen(name, PISENSE_LATEST_NAME_SIZE)) != METRICS[i].name) {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  };
+} // namespace shm
@@ -0,0 +1,294 @@
+#pragma once
+
+#include <format>
+#include <functional>
+#include <map>
+#include <set>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sqlite3.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "rollup.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace sqlite {
+  /**
+   * Persists samples into a local SQLite database, one row per sample with a column per metric and the name of the
+   * board it was read from (`source`). The database runs in
+   * WAL mode, every row reuses a single prepared INSERT, and each export batch is committed as one transaction so the
+   * cost of syncing is paid once per batch rather than once per row.
+   *
+   * Rollup buckets go to one table per resolution (e.g. `samples_1m`) with min/max/sum/last/count columns per metric,
+   * created on the first bucket of that resolution.
+   */
+  class Sink : public ::Sink {
+  public:
+    // `sources` are the names of the I2C instances, indexed by Sample::source
+    Sink(const SQLiteExporterConfig &config, std::vector<std::string> sources, telemetry::Registry &registry) :
+        ::Sink(config.Metrics), _table(config.Table), _sources(std::move(sources)) {
+      if (::sqlite3_open_v2(config.Path.c_str(), &this->_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr) !=
+          SQLITE_OK) {
+        spdlog::error("Failed to open SQLite database {}: {}", config.Path, ::sqlite3_errmsg(this->_db));
+        ::sqlite3_close(this->_db);
+        throw std::runtime_error("Failed to open SQLite database");
+      }
+
+      // The destructor doesn't run for a constructor that throws, so the handle is closed here
+      try {
+        this->exec("PRAGMA journal_mode = WAL");
+        this->exec(std::format("PRAGMA synchronous = {}", SQLiteExporterConfig::toString(config.Synchronous)));
+        this->exec(std::format("PRAGMA busy_timeout = {}", config.BusyTimeoutMs));
+
+        std::vector<Column> columns;
+
+        for (const MetricInfo &info : METRICS) {
+          columns.emplace_back(info.name, "REAL");
+        }
+
+        columns.emplace_back("source", "TEXT");
+
+        this->_insert = this->createTable(this->_table, columns);
+        this->_begin = this->prepare("BEGIN");
+        this->_commit = this->prepare("COMMIT");
+        this->_rollback = this->prepare("ROLLBACK");
+      } catch (const std::runtime_error &) {
+        this->close();
+        throw;
+      }
+
+      registry.counter("pisense_sqlite_rows_total", "Rows inserted into the SQLite database", this->_rows);
+      registry.counter("pisense_sqlite_transactions_total", "SQLite transactions committed", this->_transactions);
+
+      SPDLOG_DEBUG("SQLite database {} opened with synchronous={}",
+                   config.Path,
+                   SQLiteExporterConfig::toString(config.Synchronous));
+    }
+
+    ~Sink() override { this->close(); }
+
+    Sink(const Sink &) = delete;
+    Sink &operator=(const Sink &) = delete;
+
+    [[nodiscard]] std::string_view name() const override { return "SQLite"; }
+
+    void write(std::span<const Sample> batch) override {
+      if (batch.empty()) {
+        return;
+      }
+
+      this->step(this->_begin, "BEGIN");
+
+      try {
+        for (const Sample &sample : batch) {
+          this->insert(sample);
+        }
+
+        this->step(this->_commit, "COMMIT");
+      } catch (...) {
+        this->step(this->_rollback, "ROLLBACK");
+        throw;
+      }
+
+      this->_rows.increment(batch.size());
+      this->_transactions.increment();
+    }
+
+    void writeRollup(const rollup::Resolution &resolution, std::span<const rollup::Bucket> buckets) override {
+      if (buckets.empty()) {
+        return;
+      }
+
+      sqlite3_stmt *statement = this->rollupInsert(resolution);
+
+      this->step(this->_begin, "BEGIN");
+
+      try {
+        for (const rollup::Bucket &bucket : buckets) {
+          this->insert(statement, bucket);
+        }
+
+        this->step(this->_commit, "COMMIT");
+      } catch (...) {
+        this->step(this->_rollback, "ROLLBACK");
+        throw;
+      }
+
+      this->_rows.increment(buckets.size());
+      this->_transactions.increment();
+    }
+
+  private:
+    using Column = std::pair<std::string, std::string_view>; // Name and SQLite type
+
+    std::string _table;
+    std::vector<std::string> _sources;
+    sqlite3 *_db{nullptr};
+    sqlite3_stmt *_insert{nullptr};
+    sqlite3_stmt *_begin{nullptr};
+    sqlite3_stmt *_commit{nullptr};
+    sqlite3_stmt *_rollback{nullptr};
+    std::map<std::string, sqlite3_stmt *, std::less<>> _rollupInserts;
+    telemetry::Counter _rows;
+    telemetry::Counter _transactions;
+
+    void insert(const Sample &sample) {
+      ::sqlite3_bind_int64(this->_insert, 1, sample.timestamp);
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const auto metric = static_cast<Metric>(i);
+        const int column = static_cast<int>(i) + 2;
+
+        if (sample.has(metric)) {
+          ::sqlite3_bind_double(this->_insert, column, sample.get(metric));
+        } else {
+          ::sqlite3_bind_null(this->_insert, column);
+        }
+      }
+
+      const int sourceColumn = static_cast<int>(METRIC_COUNT) + 2;
+
+      if (sample.source < this->_sources.size()) {
+        const std::string &source = this->_sources[sample.source];
+        ::sqlite3_bind_text(this->_insert,
+                            sourceColumn,
+                            source.data(),
+                            static_cast<int>(source.size()),
+                            SQLITE_STATIC);
+      } else {
+        ::sqlite3_bind_null(this->_insert, sourceColumn);
+      }
+
+      this->step(this->_insert, "INSERT");
+    }
+
+    void insert(sqlite3_stmt *statement, const rollup::Bucket &bucket) {
+      ::sqlite3_bind_int64(statement, 1, bucket.timestamp);
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        const auto metric = static_cast<Metric>(i);
+        const rollup::Aggregate &aggregate = bucket.get(metric);
+        const int column = (static_cast<int>(i) * 5) + 2;
+
+        if (bucket.has(metric)) {
+          ::sqlite3_bind_double(statement, column, aggregate.min);
+          ::sqlite3_bind_double(statement, column + 1, aggregate.max);
+          ::sqlite3_bind_double(statement, column + 2, aggregate.sum);
+          ::sqlite3_bind_double(statement, column + 3, aggregate.last);
+          ::sqlite3_bind_int64(statement, column + 4, static_cast<sqlite3_int64>(aggregate.count));
+        } else {
+          for (int offset = 0; offset < 5; offset++) {
+            ::sqlite3_bind_null(statement, column + offset);
+          }
+        }
+      }
+
+      this->step(statement, "INSERT");
+    }
+
+    sqlite3_stmt *rollupInsert(const rollup::Resolution &resolution) {
+      if (const auto it = this->_rollupInserts.find(resolution.label); it != this->_rollupInserts.end()) {
+        return it->second;
+      }
+
+      std::vector<Column> columns;
+
+      for (const MetricInfo &info : METRICS) {
+        columns.emplace_back(std::format("{}_min", info.name), "REAL");
+        columns.emplace_back(std::format("{}_max", info.name), "REAL");
+        columns.emplace_back(std::format("{}_sum", info.name), "REAL");
+        columns.emplace_back(std::format("{}_last", info.name), "REAL");
+        columns.emplace_back(std::format("{}_count", info.name), "INTEGER");
+      }
+
+      sqlite3_stmt *statement = this->createTable(std::format("{}_{}", this->_table, resolution.label), columns);
+      this->_rollupInserts.emplace(resolution.label, statement);
+
+      return statement;
+    }
+
+    void step(sqlite3_stmt *statement, std::string_view what) {
+      const int result = ::sqlite3_step(statement);
+      ::sqlite3_reset(statement);
+
+      if (result != SQLITE_DONE) {
+        throw std::runtime_error(std::format("SQLite {} failed: {}", what, ::sqlite3_errmsg(this->_db)));
+      }
+    }
+
+    [[nodiscard]] sqlite3_stmt *prepare(const std::string &sql) {
+      sqlite3_stmt *statement = nullptr;
+
+      if (::sqlite3_prepare_v3(this->_db, sql.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &statement, nullptr) !=
+          SQLITE_OK) {
+        spdlog::error("Failed to prepare SQLite statement '{}': {}", sql, ::sqlite3_errmsg(this->_db));
+        throw std::runtime_error("Failed to prepare SQLite statement");
+      }
+
+      return statement;
+    }
+
+    // Statements have to be finalized first, sqlite3_close refuses to close a handle that still has any
+    void close() noexcept {
+      for (sqlite3_stmt *statement : {this->_insert, this->_begin, this->_commit, this->_rollback}) {
+        ::sqlite3_finalize(statement);
+      }
+
+      for (auto &[label, statement] : this->_rollupInserts) {
+        ::sqlite3_finalize(statement);
+      }
+
+      ::sqlite3_close(this->_db);
+    }
+
+    void exec(const std::string &sql) {
+      char *error = nullptr;
+
+      if (::sqlite3_exec(this->_db, sql.c_str(), nullptr, nullptr, &error) != SQLITE_OK) {
+        spdlog::error("Failed to execute SQLite statement '{}': {}", sql, error != nullptr ? error : "unknown error");
+        ::sqlite3_free(error);
+        throw std::runtime_error("Failed to execute SQLite statement");
+      }
+    }
+
+    /**
+     * Creates the table on first run, adds columns for metrics introduced since the database was created, and returns
+     * a prepared INSERT binding the timestamp followed by `columns` in order.
+     */
+    [[nodiscard]] sqlite3_stmt *createTable(const std::string &table, const std::vector<Column> &columns) {
+      this->exec(std::format("CREATE TABLE IF NOT EXISTS {} (timestamp INTEGER NOT NULL)", table));
+      this->exec(std::format("CREATE INDEX IF NOT EXISTS {0}_timestamp ON {0} (timestamp)", table));
+
+      std::set<std::string, std::less<>> existing;
+      sqlite3_stmt *info = this->prepare(std::format("PRAGMA table_info({})", table));
+
+      while (::sqlite3_step(info) == SQLITE_ROW) {
+        existing.emplace(reinterpret_cast<const char *>(::sqlite3_column_text(info, 1)));
+      }
+
+      ::sqlite3_finalize(info);
+
+      std::string names = "timestamp";
+      std::string placeholders = "?";
+
+      for (const auto &[name, type] : columns) {
+        if (!existing.contains(name)) {
+          this->exec(std::format("ALTER TABLE {} ADD COLUMN {} {}", table, name, type));
+        }
+
+        names += std::format(", {}", name);
+        placeholders += ", ?";
+      }
+
+      return this->prepare(std::format("INSERT INTO {} ({}) VALUES ({})", table, names, placeholders));
+    }
+  };
+} // namespace sqlite
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "config.hpp"
+#include "exporter.hpp"
+#include "pubsub.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace stream {
+  // Live JSON lines for local subscribers over a Unix domain socket, see `pubsub::Server`
+  class Sink : public ::Sink {
+  public:
+    Sink(const StreamExporterConfig &config, std::vector<std::string> sources, telemetry::Registry &registry) :
+        ::Sink(config.Metrics),
+        _server(registry,
+                std::move(sources),
+                config.MaxSubscribers,
+                static_cast<size_t>(config.MaxQueueKb) * 1024,
+                Sink::policy(config)) {
+      this->_server.start(config.Path);
+    }
+
+    [[nodiscard]] std::string_view name() const override { return "Stream"; }
+
+    void write(std::span<const Sample> batch) override { this->_server.publish(batch); }
+
+  private:
+    pubsub::Server _server;
+
+    [[nodiscard]] static pubsub::SlowPolicy policy(const StreamExporterConfig &config) {
+      if (config.SlowSubscriber == StreamExporterConfig::SlowSubscriber::Disconnect) {
+        return pubsub::SlowPolicy::Disconnect;
+      }
+
+      return pubsub::SlowPolicy::Drop;
+    }
+  };
+} // namespace stream
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include "ring_store.hpp"
+#include "sample.hpp"
+
+/**
+ * Gorilla-style time-series compression (Pelkonen et al., VLDB 2015): delta-of-delta timestamps and XOR-compressed
+ * doubles. Each column keeps its own state and writes into a shared bit stream, which lets a fixed-size block be
+ * filled row by row in place.
+ */
+namespace gorilla {
+  class BitWriter {
+  public:
+    BitWriter() = default;
+
+    // Bits past `position` must be zero, writes only ever OR into the buffer
+    explicit BitWriter(std::span<std::byte> buffer, size_t position = 0) :
+        _buffer(buffer), _position(position) {}
+
+    [[nodiscard]] size_t position() const { return this->_position; }
+    [[nodiscard]] size_t capacity() const { return this->_buffer.size() * 8; }
+
+    void write(uint64_t value, unsigned bits) {
+      while (bits > 0) {
+        const unsigned offset = this->_position % 8;
+        const unsigned take = std::min(8 - offset, bits);
+        const auto chunk = static_cast<uint8_t>((value >> (bits - take)) & ((1U << take) - 1));
+
+        this->_buffer[this->_position / 8] |= static_cast<std::byte>(chunk << (8 - offset - take));
+
+        bits -= take;
+        this->_position += take;
+      }
+    }
+
+  private:
+    std::span<std::byte> _buffer;
+    size_t _position{0};
+  };
+
+  class BitReader {
+  public:
+    explicit BitReader(std::span<const std::byte> buffer) :
+        _buffer(buffer) {}
+
+    [[nodiscard]] size_t position() const { return this->_position; }
+
+    uint64_t read(unsigned bits) {
+      uint64_t value = 0;
+
+      while (bits > 0) {
+        const unsigned offset = this->_position % 8;
+        const unsigned take = std::min(8 - offset, bits);
+        const auto byte = static_cast<uint8_t>(this->_buffer[this->_position / 8]);
+
+        value = (value << take) | ((byte >> (8 - offset - take)) & ((1U << take) - 1));
+
+        bits -= take;
+        this->_position += take;
+      }
+
+      return value;
+    }
+
+    bool readBit() { return this->read(1) != 0; }
+
+  private:
+    std::span<const std::byte> _buffer;
+    size_t _position{0};
+  };
+
+  namespace detail {
+    [[nodiscard]] constexpr bool fits(int64_t value, unsigned bits) {
+      const int64_t limit = int64_t{1} << (bits - 1);
+      return value >= -limit && value < limit;
+    }
+
+    [[nodiscard]] constexpr int64_t signExtend(uint64_t value, unsigned bits) {
+      const unsigned shift = 64 - bits;
+      return static_cast<int64_t>(value << shift) >> shift;
+    }
+  } // namespace detail
+
+  /**
+   * Delta-of-delta nanosecond timestamps. The buckets are wider than the paper's second-resolution ones so that the
+   * scheduling jitter of a periodic poll (tens to hundreds of microseconds) usually lands in the 20 bit bucket.
+   */
+  class TimestampColumn {
+  public:
+    static constexpr unsigned MAX_BITS = 4 + 64;
+
+    void encode(BitWriter &out, int64_t timestamp) {
+      if (!this->_started) {
+        out.write(static_cast<uint64_t>(timestamp), 64);
+      } else {
+        const int64_t delta = timestamp - this->_previous;
+        const int64_t deltaOfDelta = delta - this->_delta;
+
+        if (deltaOfDelta == 0) {
+          out.write(0b0, 1);
+        } else if (detail::fits(deltaOfDelta, 20)) {
+          out.write(0b10, 2);
+          out.write(static_cast<uint64_t>(deltaOfDelta), 20);
+        } else if (detail::fits(deltaOfDelta, 28)) {
+          out.write(0b110, 3);
+          out.write(static_cast<uint64_t>(deltaOfDelta), 28);
+        } else if (detail::fits(deltaOfDelta, 40)) {
+          out.write(0b1110, 4);
+          out.write(static_cast<uint64_t>(deltaOfDelta), 40);
+        } else {
+          out.write(0b1111, 4);
+          out.write(static_cast<uint64_t>(deltaOfDelta), 64);
+        }
+
+        this->_delta = delta;
+      }
+
+      this->_previous = timestamp;
+      this->_started = true;
+    }
+
+    int64_t decode(BitReader &in) {
+      if (!this->_started) {
+        this->_previous = static_cast<int64_t>(in.read(64));
+        this->_started = true;
+        return this->_previous;
+      }
+
+      int64_t deltaOfDelta = 0;
+
+      if (in.readBit()) {
+        if (!in.readBit()) {
+          deltaOfDelta = detail::signExtend(in.read(20), 20);
+        } else if (!in.readBit()) {
+          deltaOfDelta = detail::signExtend(in.read(28), 28);
+        } else if (!in.readBit()) {
+          deltaOfDelta = detail::signExtend(in.read(40), 40);
+        } else {
+          deltaOfDelta = static_cast<int64_t>(in.read(64));
+        }
+      }
+
+      this->_delta += deltaOfDelta;
+      this->_previous += this->_delta;
+
+      return this->_previous;
+    }
+
+  private:
+    int64_t _previous{0};
+    int64_t _delta{0};
+    bool _started{false};
+  };
+
+  // XOR against the previous value, reusing the previous leading/trailing zero window when the new one fits inside it
+  class FloatColumn {
+  public:
+    static constexpr unsigned MAX_BITS = 2 + 5 + 6 + 64;
+
+    void encode(BitWriter &out, double value) {
+      const auto bits = std::bit_cast<uint64_t>(value);
+
+      if (!this->_started) {
+        out.write(bits, 64);
+        this->_previous = bits;
+        this->_started = true;
+        return;
+      }
+
+      const uint64_t xored = bits ^ this->_previous;
+      this->_previous = bits;
+
+      if (xored == 0) {
+        out.write(0b0, 1);
+        return;
+      }
+
+      const auto leading = static_cast<unsigned>(std::min(std::countl_zero(xored), 31));
+      const auto trailing = static_cast<unsigned>(std::countr_zero(xored));
+
+      if (this->_windowSet && leading >= this->_leading && trailing >= this->_trailing) {
+        out.write(0b10, 2);
+        out.write(xored >> this->_trailing, 64 - this->_leading - this->_trailing);
+        return;
+      }
+
+      const unsigned meaningful = 64 - leading - trailing;
+
+      out.write(0b11, 2);
+      out.write(leading, 5);
+      out.write(meaningful - 1, 6);
+      out.write(xored >> trailing, meaningful);
+
+      this->_leading = leading;
+      this->_trailing = trailing;
+      this->_windowSet = true;
+    }
+
+    double decode(BitReader &in) {
+      if (!this->_started) {
+        this->_previous = in.read(64);
+        this->_started = true;
+        return std::bit_cast<double>(this->_previous);
+      }
+
+      if (in.readBit()) {
+        if (in.readBit()) {
+          this->_leading = static_cast<unsigned>(in.read(5));
+          this->_trailing = 64 - this->_leading - (static_cast<unsigned>(in.read(6)) + 1);
+          this->_windowSet = true;
+        }
+
+        const unsigned meaningful = 64 - this->_leading - this->_trailing;
+        this->_previous ^= in.read(meaningful) << this->_trailing;
+      }
+
+      return std::bit_cast<double>(this->_previous);
+    }
+
+  private:
+    uint64_t _previous{0};
+    unsigned _leading{0};
+    unsigned _trailing{0};
+    bool _windowSet{false};
+    bool _started{false};
+  };
+
+  /**
+   * Row layout shared by the encoder and decoder: timestamp, presence mask (1 bit when unchanged), source (1 bit when
+   * unchanged) and the present metrics. Rows of blocks written before samples had a source have no source field.
+   */
+  template <bool Sources>
+  class SampleColumns {
+  public:
+    static constexpr unsigned MAX_ROW_BITS = TimestampColumn::MAX_BITS + 1 + METRIC_COUNT + (Sources ? 1 + 8 : 0) +
+                                             (METRIC_COUNT * FloatColumn::MAX_BITS);
+
+    void encode(BitWriter &out, const Sample &sample) {
+      this->_timestamp.encode(out, sample.timestamp);
+
+      if (sample.present == this->_present) {
+        out.write(0b0, 1);
+      } else {
+        out.write(0b1, 1);
+        out.write(sample.present, METRIC_COUNT);
+        this->_present = sample.present;
+      }
+
+      if constexpr (Sources) {
+        if (sample.source == this->_source) {
+          out.write(0b0, 1);
+        } else {
+          out.write(0b1, 1);
+          out.write(sample.source, 8);
+          this->_source = sample.source;
+        }
+      }
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        if ((sample.present & (1U << i)) != 0) {
+          this->_values[i].encode(out, sample.values[i]);
+        }
+      }
+    }
+
+    Sample decode(BitReader &in) {
+      Sample sample;
+      sample.timestamp = this->_timestamp.decode(in);
+
+      if (in.readBit()) {
+        this->_present = static_cast<uint32_t>(in.read(METRIC_COUNT));
+      }
+
+      sample.present = this->_present;
+
+      if constexpr (Sources) {
+        if (in.readBit()) {
+          this->_source = static_cast<uint8_t>(in.read(8));
+        }
+
+        sample.source = this->_source;
+      }
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        if ((sample.present & (1U << i)) != 0) {
+          sample.values[i] = this->_values[i].decode(in);
+        }
+      }
+
+      return sample;
+    }
+
+  private:
+    TimestampColumn _timestamp;
+    uint32_t _present{0};
+    uint8_t _source{0};
+    std::array<FloatColumn, METRIC_COUNT> _values{};
+  };
+
+  /**
+   * Block codec for `ring::Store<Sample>`. Rows are appended straight into the mapped block; a row is only started
+   * when the worst case still fits, so a block never ends with a truncated row.
+   */
+  template <ring::Encoding Encoding>
+  class BasicSampleCodec {
+    using Columns = SampleColumns<Encoding == ring::Encoding::GorillaSources>;
+
+  public:
+    static constexpr ring::Encoding ENCODING = Encoding;
+
+    void reset(std::span<std::byte> payload) {
+      this->_writer = BitWriter(payload);
+      this->_columns = Columns{};
+      this->_count = 0;
+    }
+
+    // Replays the committed rows to rebuild the column state, then clears anything written after the last commit
+    void resume(std::span<std::byte> payload, const ring::BlockHeader &block) {
+      this->_columns = Columns{};
+      BitReader reader(payload);
+
+      for (uint32_t i = 0; i < block.count; i++) {
+        this->_columns.decode(reader);
+      }
+
+      const size_t position = reader.position();
+      const size_t partial = position % 8;
+
+      if (partial != 0) {
+        payload[position / 8] &= static_cast<std::byte>(0xFF << (8 - partial));
+      }
+
+      const size_t clearFrom = (position + 7) / 8;
+      std::memset(payload.data() + clearFrom, 0, payload.size() - clearFrom);
+
+      this->_writer = BitWriter(payload, position);
+      this->_count = block.count;
+    }
+
+    bool append(const Sample &sample) {
+      if (this->_writer.position() + Columns::MAX_ROW_BITS > this->_writer.capacity()) {
+        return false;
+      }
+
+      this->_columns.encode(this->_writer, sample);
+      this->_count++;
+
+      return true;
+    }
+
+    [[nodiscard]] uint32_t count() const { return this->_count; }
+    [[nodiscard]] size_t bits() const { return this->_writer.position(); }
+
+    template <typename Fn>
+    static void decode(std::span<const std::byte> payload, const ring::BlockHeader &block, Fn &&fn) {
+      Columns columns;
+      BitReader reader(payload);
+
+      for (uint32_t i = 0; i < block.count; i++) {
+        fn(columns.decode(reader));
+      }
+    }
+
+  private:
+    BitWriter _writer;
+    Columns _columns;
+    uint32_t _count{0};
+  };
+
+  using SampleCodec = BasicSampleCodec<ring::Encoding::GorillaSources>;
+
+  // Only read, for blocks written before samples had a source; their samples all come from the first one
+  using LegacySampleCodec = BasicSampleCodec<ring::Encoding::Gorilla>;
+} // namespace gorilla
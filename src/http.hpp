@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "telemetry.hpp"
+
+namespace http {
+  /**
+   * Minimal HTTP/1.1 server that answers `GET <path>` with whatever the `Source` currently holds. It runs a single
+   * epoll thread, supports keep-alive and pipelined requests, and never copies or allocates per request: the response
+   * body is a lease on the source's buffer that is held until the last byte has been written.
+   *
+   * `Source` must provide `acquire()` returning a movable `Lease` with a `body()` accessor.
+   */
+  template <typename Source>
+  class Server {
+  public:
+    Server(Source &source,
+           std::string path,
+           std::string_view contentType,
+           telemetry::Registry &registry,
+           uint32_t maxConnections) :
+        _source(source), _path(std::move(path)), _contentType(contentType), _maxConnections(maxConnections) {
+      registry.counter("pisense_http_requests_total", "HTTP requests served", this->_requests);
+      registry.counter("pisense_http_rejected_connections_total",
+                       "HTTP connections refused because the connection limit was reached",
+                       this->_rejected);
+      registry.gauge("pisense_http_connections", "Open HTTP connections", [this] {
+        return static_cast<double>(this->_connectionCount.load(std::memory_order_relaxed));
+      });
+    }
+
+    ~Server() noexcept { this->stop(); }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    void start(const std::string &address, uint16_t port) {
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(port);
+
+      if (::inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        spdlog::error("Invalid HTTP listen address '{}'", address);
+        throw std::runtime_error("Invalid HTTP listen address");
+      }
+
+      this->_listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+      const int enable = 1;
+      ::setsockopt(this->_listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+      if (this->_listenFd < 0 || ::bind(this->_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+          ::listen(this->_listenFd, SOMAXCONN) < 0) {
+        spdlog::error("Failed to listen on {}:{}: {}", address, port, strerror(errno));
+        this->closeAll();
+        throw std::runtime_error("Failed to start HTTP server");
+      }
+
+      this->_epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+      this->_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      this->watch(this->_listenFd, EPOLLIN, &this->_listenFd);
+      this->watch(this->_wakeFd, EPOLLIN, &this->_wakeFd);
+
+      spdlog::info("HTTP server listening on {}:{}{}", address, port, this->_path);
+
+      this->_worker = std::thread([this] { this->run(); });
+    }
+
+    void stop() noexcept {
+      if (this->_worker.joinable()) {
+        const uint64_t one = 1;
+        (void)::write(this->_wakeFd, &one, sizeof(one));
+        this->_worker.join();
+      }
+
+      this->closeAll();
+    }
+
+  private:
+    using Lease = decltype(std::declval<Source &>().acquire());
+
+    static constexpr size_t REQUEST_BUFFER_SIZE = 4096;
+    static constexpr size_t MAX_EVENTS = 64;
+
+    struct Connection {
+      int fd;
+      std::array<char, REQUEST_BUFFER_SIZE> request{};
+      size_t requestLength{0};
+      std::array<char, 256> head{};
+      size_t headLength{0};
+      std::optional<Lease> lease;
+      std::string_view body;
+      size_t sent{0};
+      bool writing{false};
+      bool keepAlive{true};
+    };
+
+    Source &_source;
+    std::string _path;
+    std::string_view _contentType;
+    uint32_t _maxConnections;
+    int _listenFd{-1};
+    int _epollFd{-1};
+    int _wakeFd{-1};
+    std::thread _worker;
+    std::unordered_map<int, std::unique_ptr<Connection>> _connections;
+    std::atomic<uint32_t> _connectionCount{0};
+    telemetry::Counter _requests;
+    telemetry::Counter _rejected;
+
+    void watch(int fd, uint32_t events, void *tag) const {
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = tag;
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void rewatch(Connection &conn, uint32_t events) const {
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = &conn;
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_MOD, conn.fd, &event);
+    }
+
+    void run() {
+      std::array<epoll_event, MAX_EVENTS> events{};
+
+      while (true) {
+        const int count = ::epoll_wait(this->_epollFd, events.data(), static_cast<int>(events.size()), -1);
+
+        if (count < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          spdlog::error("HTTP server epoll_wait failed: {}", strerror(errno));
+          return;
+        }
+
+        for (int i = 0; i < count; i++) {
+          const epoll_event &event = events[i];
+
+          if (event.data.ptr == &this->_wakeFd) {
+            return;
+          }
+
+          if (event.data.ptr == &this->_listenFd) {
+            this->accept();
+            continue;
+          }
+
+          Connection &conn = *static_cast<Connection *>(event.data.ptr);
+
+          if ((event.events & (EPOLLERR | EPOLLHUP)) != 0) {
+            this->close(conn);
+          } else if (conn.writing) {
+            this->resume(conn);
+          } else {
+            this->receive(conn);
+          }
+        }
+      }
+    }
+
+    void accept() {
+      while (true) {
+        const int fd = ::accept4(this->_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            spdlog::warn("HTTP server failed to accept connection: {}", strerror(errno));
+          }
+
+          return;
+        }
+
+        if (this->_connections.size() >= this->_maxConnections) {
+          this->_rejected.increment();
+          ::close(fd);
+          continue;
+        }
+
+        const int enable = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        this->watch(fd, EPOLLIN, conn.get());
+        this->_connections.emplace(fd, std::move(conn));
+        this->_connectionCount.store(this->_connections.size(), std::memory_order_relaxed);
+      }
+    }
+
+    void close(Connection &conn) {
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_DEL, conn.fd, nullptr);
+      ::close(conn.fd);
+      this->_connections.erase(conn.fd);
+      this->_connectionCount.store(this->_connections.size(), std::memory_order_relaxed);
+    }
+
+    void receive(Connection &conn) {
+      while (conn.requestLength < conn.request.size()) {
+        const ssize_t received = ::read(conn.fd,
+                                        conn.request.data() + conn.requestLength,
+                                        conn.request.size() - conn.requestLength);
+
+        if (received == 0) {
+          this->close(conn);
+          return;
+        }
+
+        if (received < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            this->close(conn);
+            return;
+          }
+
+          break;
+        }
+
+        conn.requestLength += static_cast<size_t>(received);
+      }
+
+      this->process(conn);
+    }
+
+    // Answers every complete request sitting in the buffer, stopping early if the socket can't take more data
+    void process(Connection &conn) {
+      while (!conn.writing) {
+        const std::string_view buffered(conn.request.data(), conn.requestLength);
+        const size_t headerEnd = buffered.find("\r\n\r\n");
+
+        if (headerEnd == std::string_view::npos) {
+          if (conn.requestLength == conn.request.size()) {
+            conn.keepAlive = false;
+            this->respond(conn, 431, "Request Header Fields Too Large", false, false);
+            this->flush(conn);
+          }
+
+          return;
+        }
+
+        this->handle(conn, buffered.substr(0, headerEnd));
+
+        const size_t consumed = headerEnd + 4;
+        std::memmove(conn.request.data(), conn.request.data() + consumed, conn.requestLength - consumed);
+        conn.requestLength -= consumed;
+
+        if (!this->flush(conn)) {
+          return;
+        }
+      }
+    }
+
+    void handle(Connection &conn, std::string_view header) {
+      this->_requests.increment();
+
+      const size_t lineEnd = header.find("\r\n");
+      const std::string_view requestLine = header.substr(0, lineEnd);
+      const std::string_view fields = lineEnd == std::string_view::npos ? std::string_view{} : header.substr(lineEnd);
+
+      const size_t methodEnd = requestLine.find(' ');
+      const size_t targetEnd = requestLine.find(' ', methodEnd + 1);
+
+      if (methodEnd == std::string_view::npos || targetEnd == std::string_view::npos) {
+        conn.keepAlive = false;
+        this->respond(conn, 400, "Bad Request", false, false);
+        return;
+      }
+
+      const std::string_view method = requestLine.substr(0, methodEnd);
+      const std::string_view target = requestLine.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+      const std::string_view version = requestLine.substr(targetEnd + 1);
+      const std::string_view path = target.substr(0, target.find('?'));
+
+      conn.keepAlive = Server::wantsKeepAlive(version, fields);
+
+      if (method != "GET" && method != "HEAD") {
+        this->respond(conn, 405, "Method Not Allowed", false, false);
+        return;
+      }
+
+      if (path != this->_path) {
+        this->respond(conn, 404, "Not Found", false, false);
+        return;
+      }
+
+      this->respond(conn, 200, "OK", true, method == "HEAD");
+    }
+
+    void respond(Connection &conn, int status, std::string_view reason, bool withBody, bool headOnly) {
+      conn.lease.reset();
+      conn.body = {};
+
+      if (withBody) {
+        conn.lease.emplace(this->_source.acquire());
+        conn.body = conn.lease->body();
+      }
+
+      const auto result = std::format_to_n(conn.head.data(),
+                                           static_cast<std::ptrdiff_t>(conn.head.size()),
+                                           "HTTP/1.1 {} {}\r\n"
+                                           "Content-Type: {}\r\n"
+                                           "Content-Length: {}\r\n"
+                                           "Connection: {}\r\n\r\n",
+                                           status,
+                                           reason,
+                                           withBody ? this->_contentType : "text/plain",
+                                           conn.body.size(),
+                                           conn.keepAlive ? "keep-alive" : "close");
+
+      // `size` is what the head would have taken untruncated, only what was written can be sent
+      conn.headLength = static_cast<size_t>(result.out - conn.head.data());
+      conn.sent = 0;
+
+      if (headOnly) {
+        conn.lease.reset();
+        conn.body = {};
+      }
+    }
+
+    // Returns true once the whole response is out; otherwise waits for EPOLLOUT and finishes in resume()
+    bool flush(Connection &conn) {
+      const size_t total = conn.headLength + conn.body.size();
+
+      while (conn.sent < total) {
+        std::array<iovec, 2> iov{};
+        int iovCount = 0;
+
+        if (conn.sent < conn.headLength) {
+          iov[iovCount++] = {conn.head.data() + conn.sent, conn.headLength - conn.sent};
+        }
+
+        const size_t bodyOffset = conn.sent > conn.headLength ? conn.sent - conn.headLength : 0;
+
+        if (bodyOffset < conn.body.size()) {
+          iov[iovCount++] = {const_cast<char *>(conn.body.data()) + bodyOffset, conn.body.size() - bodyOffset};
+        }
+
+        const ssize_t written = ::writev(conn.fd, iov.data(), iovCount);
+
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!conn.writing) {
+              conn.writing = true;
+              this->rewatch(conn, EPOLLOUT);
+            }
+
+            return false;
+          }
+
+          this->close(conn);
+          return false;
+        }
+
+        conn.sent += static_cast<size_t>(written);
+      }
+
+      conn.lease.reset();
+      conn.body = {};
+
+      if (!conn.keepAlive) {
+        this->close(conn);
+        return false;
+      }
+
+      if (conn.writing) {
+        conn.writing = false;
+        this->rewatch(conn, EPOLLIN);
+      }
+
+      return true;
+    }
+
+    void resume(Connection &conn) {
+      if (this->flush(conn)) {
+        this->process(conn);
+      }
+    }
+
+    static bool wantsKeepAlive(std::string_view version, std::string_view fields) {
+      const auto contains = [fields](std::string_view needle) {
+        return std::ranges::search(fields, needle, [](char a, char b) {
+                 return std::tolower(static_cast<unsigned char>(a)) == b;
+               }).begin() != fields.end();
+      };
+
+      if (contains("connection: close")) {
+        return false;
+      }
+
+      return version == "HTTP/1.1" || contains("connection: keep-alive");
+    }
+
+    void closeAll() noexcept {
+      for (auto &[fd, conn] : this->_connections) {
+        ::close(fd);
+      }
+
+      this->_connections.clear();
+      this->_connectionCount.store(0, std::memory_order_relaxed);
+
+      for (int *fd : {&this->_listenFd, &this->_epollFd, &this->_wakeFd}) {
+        if (*fd >= 0) {
+          ::close(*fd);
+          *fd = -1;
+        }
+      }
+    }
+  };
+} // namespace http
@@ -1,11 +1,24 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <cerrno>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <expected>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <span>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
@@ -14,153 +27,601 @@
 #include <spdlog/spdlog.h>
 #include <sys/ioctl.h>
 
+#include "config.hpp"
+#include "register.hpp"
+#include "telemetry.hpp"
+#include "timestamp.hpp"
+
 namespace i2c {
+  enum class Operation : uint8_t { SetAddress, SelectChannel, SelectRegister, Read, Write, Validate };
+
+  /**
+   * A failed bus transaction: what was being done, to which device and register, and the errno it failed with. Plain
+   * data, so reporting a failure never allocates or unwinds; callers decide whether and how to log it.
+   */
+  struct BusError {
+    Operation operation;
+    int error; // errno, or EINVAL when a device returned data that doesn't make sense
+    uint8_t address;
+    uint8_t reg;
+
+    [[nodiscard]] std::string_view description() const noexcept {
+      switch (this->operation) {
+        case Operation::SetAddress:
+          return "selecting device";
+        case Operation::SelectChannel:
+          return "selecting mux channel";
+        case Operation::SelectRegister:
+          return "selecting register";
+        case Operation::Read:
+          return "reading register";
+        case Operation::Write:
+          return "writing register";
+        case Operation::Validate:
+          return "validating register";
+      }
+
+      return "accessing";
+    }
+  };
+
+  template <typename T>
+  using Result = std::expected<T, BusError>;
+
+  template <typename... Regs>
+  using Values = std::conditional_t<sizeof...(Regs) == 1,
+                                    typename std::tuple_element_t<0, std::tuple<Regs...>>::type,
+                                    std::tuple<typename Regs::type...>>;
+
+  /**
+   * An open I2C adapter. Every transaction goes through `transact`, which retries transient failures (a NACK, a lost
+   * arbitration, a timeout) with exponential backoff and reopens the adapter once enough of them fail in a row. The
+   * adapter timeout bounds each attempt, so a transaction takes at most Attempts times that plus the backoff.
+   *
+   * With a TCA9548A mux on the bus, devices are addressed by channel as well. The bus remembers which channel the mux
+   * was left on, so the control byte is only written when a transaction needs a different one.
+   */
   class Bus {
   public:
-    explicit Bus(std::string bus) :
-        _bus(std::move(bus)) {
-      spdlog::debug("Opening I2C bus: {}", this->_bus);
-
-      this->_fd = ::open(this->_bus.c_str(), O_RDWR);
+    Bus(const I2cConfig &config, telemetry::Registry &registry) :
+        _config(config) {
+      SPDLOG_DEBUG("Opening I2C bus: {}", this->_config.Bus);
 
-      if (this->_fd < 0) {
-        spdlog::error("Failed to open I2C bus {}: {}", this->_bus, strerror(errno));
+      if (!this->open()) {
+        spdlog::error("Failed to open I2C bus {}: {}", this->_config.Bus, strerror(errno));
         throw std::runtime_error("Failed to open I2C bus");
       }
 
-      spdlog::debug("I2C bus {} opened successfully: fd={}", this->_bus, this->_fd);
+      SPDLOG_DEBUG("I2C bus {} opened successfully: fd={}", this->_config.Bus, this->_fd);
+
+      const std::string labels = telemetry::label("adapter", this->_config.Bus);
+
+      registry.counter("pisense_i2c_retries_total",
+                       "I2C transactions retried after a failed attempt",
+                       this->_retries,
+                       labels);
+      registry.counter("pisense_i2c_failures_total",
+                       "I2C transactions that failed on every attempt",
+                       this->_failures,
+                       labels);
+      registry.counter("pisense_i2c_recoveries_total",
+                       "Times the I2C bus was reopened after repeated failures",
+                       this->_recoveries,
+                       labels);
+      registry.counter("pisense_i2c_recovery_failures_total",
+                       "Times reopening the I2C bus failed",
+                       this->_recoveryFailures,
+                       labels);
+
+      if (this->_config.MuxAddress != 0) {
+        registry.counter("pisense_i2c_mux_switches_total",
+                         "Times the I2C mux was switched to another channel",
+                         this->_muxSwitches,
+                         labels);
+      }
     }
 
     ~Bus() noexcept {
       if (this->_fd >= 0) {
-        spdlog::debug("Closing I2C bus {}: fd={}", this->_bus, this->_fd);
+        SPDLOG_DEBUG("Closing I2C bus {}: fd={}", this->_config.Bus, this->_fd);
 
         if (::close(this->_fd) < 0) {
-          spdlog::error("Failed to close I2C bus {}: fd={} | error={}", this->_bus, this->_fd, strerror(errno));
+          spdlog::error("Failed to close I2C bus {}: fd={} | error={}", this->_config.Bus, this->_fd, strerror(errno));
         } else {
-          spdlog::debug("I2C bus {} closed successfully: fd={}", this->_bus, this->_fd);
+          SPDLOG_DEBUG("I2C bus {} closed successfully: fd={}", this->_config.Bus, this->_fd);
         }
       }
     }
 
+    // The counters are registered by address, so the bus stays where it was created
     Bus(const Bus &) = delete;
     Bus &operator=(const Bus &) = delete;
 
-    Bus(Bus &&other) noexcept :
-        _bus(std::move(other._bus)), _fd(other._fd), _activeAddr(other._activeAddr) {
-      other._fd = -1;
-      other._activeAddr = -1;
-    }
+    int fd() const noexcept { return this->_fd; }
+
+    // The device the adapter currently talks to, -1 before the first transaction
+    [[nodiscard]] int address() const noexcept { return this->_activeAddr; }
+
+    // Bumped every time the bus is reopened, so devices know their configuration has to be written again
+    [[nodiscard]] uint32_t generation() const noexcept { return this->_generation; }
+
+    // The mux channel transactions currently go to, if the bus has a mux and it is known
+    [[nodiscard]] std::optional<uint8_t> channel() const noexcept { return this->_activeChannel; }
+
+    [[nodiscard]] uint64_t muxSwitches() const noexcept { return this->_muxSwitches.value(); }
 
-    Bus &operator=(Bus &&other) noexcept {
-      if (this == &other) {
-        return *this;
+    // Points the mux at the channel of the next transaction. Devices not behind a mux pass no channel
+    [[nodiscard]] Result<void> selectChannel(std::optional<uint8_t> channel) const noexcept {
+      if (!channel || this->_config.MuxAddress == 0 || this->_activeChannel == channel) {
+        return {};
       }
 
-      if (this->_fd >= 0) {
-        ::close(this->_fd);
+      if (const Result<void> result = this->setAddress(this->_config.MuxAddress); !result) {
+        return result;
       }
 
-      this->_bus = std::move(other._bus);
-      this->_fd = other._fd;
-      this->_activeAddr = other._activeAddr;
-      other._fd = -1;
-      other._activeAddr = -1;
+      SPDLOG_TRACE("Switching I2C mux 0x{:02X} to channel {}", this->_config.MuxAddress, *channel);
 
-      return *this;
-    }
+      // The TCA9548A has a single control register, written without a register address: one bit per enabled channel
+      const auto control = static_cast<uint8_t>(1U << *channel);
 
-    int fd() const noexcept { return this->_fd; }
+      if (::write(this->_fd, &control, 1) != 1) {
+        // The mux may or may not have taken the byte
+        this->_activeChannel.reset();
+
+        return std::unexpected(BusError{.operation = Operation::SelectChannel,
+                                        .error = errno != 0 ? errno : EIO,
+                                        .address = this->_config.MuxAddress,
+                                        .reg = *channel});
+      }
+
+      this->_activeChannel = channel;
+      this->_muxSwitches.increment();
 
-    void setAddress(uint8_t addr) const {
+      return {};
+    }
+
+    [[nodiscard]] Result<void> setAddress(uint8_t addr) const noexcept {
       if (this->_activeAddr == static_cast<int>(addr)) {
-        return;
+        return {};
       }
 
-      spdlog::trace("Setting I2C device address to 0x{:02X} of fd={}", addr, this->_fd);
+      SPDLOG_TRACE("Setting I2C device address to 0x{:02X} of fd={}", addr, this->_fd);
 
       if (::ioctl(this->_fd, I2C_SLAVE, addr) < 0) {
-        spdlog::error("Failed to set I2C device address to 0x{:02X} on {}: fd={} "
-                      "| error={}",
-                      addr,
-                      this->_bus,
-                      this->_fd,
-                      strerror(errno));
-        throw std::runtime_error("Failed to set I2C device address");
+        return std::unexpected(BusError{.operation = Operation::SetAddress, .error = errno, .address = addr, .reg = 0});
       }
 
       this->_activeAddr = static_cast<int>(addr);
+
+      return {};
+    }
+
+    // Runs a transaction until it succeeds or runs out of attempts. The transaction has to be safe to repeat from the
+    // start, e.g. selecting the register again before reading it
+    template <typename Transaction>
+    [[nodiscard]] std::invoke_result_t<Transaction> transact(Transaction &&transaction) noexcept {
+      uint32_t backoff = this->_config.BackoffUs;
+
+      for (uint32_t attempt = 1;; attempt++) {
+        std::invoke_result_t<Transaction> result = transaction();
+
+        if (result) {
+          this->_consecutiveFailures = 0;
+          return result;
+        }
+
+        if (attempt >= this->_config.Attempts || !Bus::retryable(result.error())) {
+          this->failed(result.error());
+          return result;
+        }
+
+        this->_retries.increment();
+        SPDLOG_TRACE("Retrying I2C transaction with device 0x{:02X} in {}us: {}",
+                     result.error().address,
+                     backoff,
+                     strerror(result.error().error));
+
+        std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+        backoff = std::min(backoff * 2, this->_config.MaxBackoffUs);
+      }
     }
 
   private:
-    std::string _bus;
+    I2cConfig _config;
     int _fd{-1};
     mutable int _activeAddr{-1};
+    mutable std::optional<uint8_t> _activeChannel;
+    uint32_t _generation{0};
+    uint32_t _consecutiveFailures{0};
+    telemetry::Counter _retries;
+    telemetry::Counter _failures;
+    telemetry::Counter _recoveries;
+    telemetry::Counter _recoveryFailures;
+    mutable telemetry::Counter _muxSwitches;
+
+    // Without a file descriptor there is nothing to retry; anything else may well be gone on the next attempt
+    [[nodiscard]] static bool retryable(const BusError &error) noexcept {
+      return error.operation != Operation::Validate && error.error != EBADF;
+    }
+
+    bool open() noexcept {
+      this->_fd = ::open(this->_config.Bus.c_str(), O_RDWR | O_CLOEXEC);
+      this->_activeAddr = -1;
+      this->_activeChannel.reset();
+
+      if (this->_fd < 0) {
+        return false;
+      }
+
+      // Not every adapter supports these, and the bus works without them, so failing to set them isn't fatal
+      if (this->_config.TimeoutMs != 0 &&
+          ::ioctl(this->_fd, I2C_TIMEOUT, std::max<unsigned long>(this->_config.TimeoutMs / 10, 1)) < 0) {
+        spdlog::warn("Failed to set timeout of I2C bus {}: {}", this->_config.Bus, strerror(errno));
+      }
+
+      if (::ioctl(this->_fd, I2C_RETRIES, static_cast<unsigned long>(this->_config.AdapterRetries)) < 0) {
+        spdlog::warn("Failed to set adapter retries of I2C bus {}: {}", this->_config.Bus, strerror(errno));
+      }
+
+      return true;
+    }
+
+    void failed(const BusError &error) noexcept {
+      this->_failures.increment();
+      this->_consecutiveFailures++;
+
+      if (this->_config.RecoveryThreshold == 0 || this->_consecutiveFailures < this->_config.RecoveryThreshold) {
+        return;
+      }
+
+      this->recover(error);
+    }
+
+    // Closing and reopening the adapter resets the driver state; a device that lost power on the way also loses its
+    // configuration, which the generation bump tells the devices to write again
+    void recover(const BusError &error) noexcept {
+      spdlog::warn("Reopening I2C bus {} after {} failed transactions in a row, last: {}",
+                   this->_config.Bus,
+                   this->_consecutiveFailures,
+                   strerror(error.error));
+
+      this->_recoveries.increment();
+      this->_consecutiveFailures = 0;
+
+      if (this->_fd >= 0) {
+        ::close(this->_fd);
+      }
+
+      if (!this->open()) {
+        this->_recoveryFailures.increment();
+        spdlog::error("Failed to reopen I2C bus {}: {}", this->_config.Bus, strerror(errno));
+        return;
+      }
+
+      this->_generation++;
+    }
+  };
+
+  /**
+   * Per-device transaction statistics. Everything is a relaxed atomic bumped once per attempt, so keeping them costs a
+   * few uncontended adds next to a bus transfer that takes hundreds of microseconds.
+   */
+  struct DeviceStats {
+    // Linux errno values end at EHWPOISON (133), anything above that shares the last slot
+    static constexpr size_t ERRNO_SLOTS = 134;
+
+    telemetry::Counter transactions;
+    telemetry::Counter failures;
+    telemetry::Counter bytesRead;
+    telemetry::Counter bytesWritten;
+    telemetry::Counter addressSwitches;
+    telemetry::Counter skippedWrites;
+    telemetry::Counter busyNanoseconds;
+    std::array<telemetry::Counter, ERRNO_SLOTS> errors;
+    telemetry::HdrHistogram latency;
   };
 
+  /**
+   * One device on a bus, addressed by its mux channel (none when it isn't behind a mux) and its address. Registers
+   * listed as shadowed keep a copy of their last known value, so writing the value they already hold is skipped and
+   * changing some of their bits takes a single write. The copies are dropped whenever the bus is reopened, since the
+   * device may have been reset along with it.
+   */
   class Device {
   public:
-    Device(Bus &bus, std::string name, uint8_t addr) :
-        _bus(bus), _name(std::move(name)), _addr(addr) {}
+    Device(Bus &bus,
+           std::string name,
+           std::optional<uint8_t> channel,
+           uint8_t addr,
+           std::span<const uint8_t> shadowed = {}) :
+        _bus(bus), _name(std::move(name)), _channel(channel), _addr(addr) {
+      for (const uint8_t reg : shadowed) {
+        this->_shadowed.set(reg);
+      }
+    }
+
+    Device(Bus &bus, std::string name, uint8_t addr, std::span<const uint8_t> shadowed = {}) :
+        Device(bus, std::move(name), std::nullopt, addr, shadowed) {}
 
     [[nodiscard]] const std::string &name() const { return this->_name; }
 
-    [[nodiscard]] uint8_t readByte(uint8_t reg) const {
-      this->_bus.setAddress(this->_addr);
+    [[nodiscard]] uint8_t address() const noexcept { return this->_addr; }
+
+    [[nodiscard]] std::optional<uint8_t> channel() const noexcept { return this->_channel; }
 
-      if (::write(this->_bus.fd(), &reg, 1) != 1) {
-        spdlog::error("Failed to write register address 0x{:02X} to I2C device "
-                      "{} at address 0x{:02X}: {}",
-                      reg,
-                      this->_name,
-                      this->_addr,
-                      strerror(errno));
-        throw std::runtime_error("Failed to write register address to I2C device");
+    [[nodiscard]] const DeviceStats &stats() const noexcept { return this->_stats; }
+
+    // One line on how busy the device kept the bus, how fast it answered and how it failed
+    [[nodiscard]] std::string summary() const {
+      const DeviceStats &stats = this->_stats;
+      std::string errors;
+
+      for (size_t error = 0; error < DeviceStats::ERRNO_SLOTS; error++) {
+        if (const uint64_t count = stats.errors[error].value(); count != 0) {
+          const char *name = ::strerrorname_np(static_cast<int>(error));
+          std::format_to(std::back_inserter(errors), " {}={}", name != nullptr ? name : "?", count);
+        }
       }
 
-      uint8_t value = 0;
+      return std::format("{} (0x{:02X}): {} transactions, {} failed{}, {} B read, {} B written, {} address switches, "
+                         "{} writes skipped, busy {:.3f} s, latency p50 {:.1f} us p99 {:.1f} us max {:.1f} us",
+                         this->_name,
+                         this->_addr,
+                         stats.transactions.value(),
+                         stats.failures.value(),
+                         errors,
+                         stats.bytesRead.value(),
+                         stats.bytesWritten.value(),
+                         stats.addressSwitches.value(),
+                         stats.skippedWrites.value(),
+                         static_cast<double>(stats.busyNanoseconds.value()) / 1e9,
+                         static_cast<double>(stats.latency.percentile(0.5)) / 1e3,
+                         static_cast<double>(stats.latency.percentile(0.99)) / 1e3,
+                         static_cast<double>(stats.latency.max()) / 1e3);
+    }
 
-      if (::read(this->_bus.fd(), &value, 1) != 1) {
-        spdlog::error("Failed to read byte from I2C device {} at address "
-                      "0x{:02X}, register 0x{:02X}: {}",
-                      this->_name,
-                      this->_addr,
-                      reg,
-                      strerror(errno));
-        throw std::runtime_error("Failed to read byte from I2C device");
+    [[nodiscard]] Result<uint8_t> readByte(uint8_t reg) const noexcept {
+      const Result<uint8_t> value = this->_bus.transact([&] { return this->readByteOnce(reg); });
+
+      if (value) {
+        this->remember(reg, *value);
       }
 
       return value;
     }
 
-    [[nodiscard]] int16_t readShort(uint8_t loReg, uint8_t hiReg) const {
-      const uint8_t low = this->readByte(loReg);
-      const uint8_t high = this->readByte(hiReg);
+    /**
+     * Reads the given registers, merging the contiguous ones into burst reads at compile time. Returns the value of a
+     * single register as is and those of several as a tuple, in the order they were asked for.
+     */
+    template <typename... Regs>
+    [[nodiscard]] Result<Values<Regs...>> read() const noexcept {
+      using Plan = ReadPlan<Regs...>;
+
+      std::array<uint8_t, Plan::SIZE> buffer{};
 
-      const uint16_t value = (static_cast<uint16_t>(high) << 8) | static_cast<uint16_t>(low);
+      for (const typename Plan::Burst &burst : Plan::BURSTS) {
+        const uint8_t address = burst.length > 1 ? burst.address | Plan::AUTO_INCREMENT : burst.address;
+        uint8_t *bytes = buffer.data() + (burst.address - Plan::BASE);
 
-      return static_cast<int16_t>(value);
+        const Result<void> result = this->_bus.transact([&] { return this->readOnce(address, bytes, burst.length); });
+
+        if (!result) {
+          return std::unexpected(result.error());
+        }
+
+        for (uint8_t i = 0; i < burst.length; i++) {
+          this->remember(burst.address + i, bytes[i]);
+        }
+      }
+
+      const auto decode = [&]<typename Reg>() {
+        const uint8_t *bytes = buffer.data() + Plan::template offset<Reg>();
+        return Reg::decode(std::span<const uint8_t, Reg::WIDTH>(bytes, Reg::WIDTH));
+      };
+
+      if constexpr (sizeof...(Regs) == 1) {
+        return decode.template operator()<Regs...>();
+      } else {
+        return std::tuple{decode.template operator()<Regs>()...};
+      }
+    }
+
+    // Writes the given fields of a register and leaves its other bits as they are
+    template <typename Reg, typename... Fields>
+    [[nodiscard]] Result<void> write(Fields... fields) const noexcept {
+      static_assert(Reg::ACCESS != Access::Read, "Read-only registers can't be written");
+      static_assert((std::is_same_v<typename Fields::Register, Reg> && ...), "Fields must belong to the register");
+
+      constexpr uint8_t mask = (Fields::MASK | ... | 0);
+      const uint8_t bits = (fields.bits | ... | 0);
+
+      if constexpr (mask == 0xFF) {
+        return this->writeByte(Reg::ADDRESS, bits);
+      } else {
+        return this->update(Reg::ADDRESS, mask, bits);
+      }
     }
 
-    void writeByte(uint8_t reg, uint8_t value) const {
-      this->_bus.setAddress(this->_addr);
+    [[nodiscard]] Result<void> writeByte(uint8_t reg, uint8_t value) const noexcept {
+      if (this->shadow(reg) == value) {
+        this->_stats.skippedWrites.increment();
+        return {};
+      }
 
-      const std::array<uint8_t, 2> buffer = {reg, value};
+      const Result<void> result = this->_bus.transact([&] { return this->writeByteOnce(reg, value); });
 
-      if (::write(this->_bus.fd(), buffer.data(), 2) != 2) {
-        spdlog::error("Failed to write byte to I2C device {} at address "
-                      "0x{:02X}, register 0x{:02X}: {}",
-                      this->_name,
-                      this->_addr,
-                      reg,
-                      strerror(errno));
-        throw std::runtime_error("Failed to write byte to I2C device");
+      // After a failed write the register could hold either value
+      if (result) {
+        this->remember(reg, value);
+      } else {
+        this->forget(reg);
       }
+
+      return result;
+    }
+
+    // Sets the bits of a register selected by mask to those of bits. A shadowed register whose value is known takes a
+    // single write, or none when those bits are already set; anything else is read first
+    [[nodiscard]] Result<void> update(uint8_t reg, uint8_t mask, uint8_t bits) const noexcept {
+      std::optional<uint8_t> current = this->shadow(reg);
+
+      if (!current) {
+        const Result<uint8_t> value = this->readByte(reg);
+
+        if (!value) {
+          return std::unexpected(value.error());
+        }
+
+        current = *value;
+      }
+
+      return this->writeByte(reg, static_cast<uint8_t>((*current & ~mask) | (bits & mask)));
+    }
+
+    // Reads every shadowed register back from the device, for when something else may have changed them
+    [[nodiscard]] Result<void> resync() const noexcept {
+      this->_known.reset();
+
+      for (size_t reg = 0; reg < this->_shadowed.size(); reg++) {
+        if (!this->_shadowed.test(reg)) {
+          continue;
+        }
+
+        if (const Result<uint8_t> value = this->readByte(static_cast<uint8_t>(reg)); !value) {
+          return std::unexpected(value.error());
+        }
+      }
+
+      return {};
+    }
+
+    // The last value written to or read from a shadowed register, if it is still known
+    [[nodiscard]] std::optional<uint8_t> shadow(uint8_t reg) const noexcept {
+      this->expire();
+
+      if (!this->_known.test(reg)) {
+        return std::nullopt;
+      }
+
+      return this->_shadow[reg];
+    }
+
+    // For data that was read fine but can't be right, e.g. calibration constants that would divide by zero
+    [[nodiscard]] BusError invalid(uint8_t reg) const noexcept {
+      return {.operation = Operation::Validate, .error = EINVAL, .address = this->_addr, .reg = reg};
     }
 
   private:
     Bus &_bus;
     std::string _name;
+    std::optional<uint8_t> _channel;
     uint8_t _addr;
+    std::bitset<256> _shadowed;
+    mutable std::bitset<256> _known;
+    mutable std::array<uint8_t, 256> _shadow{};
+    mutable uint32_t _shadowGeneration{0};
+    mutable DeviceStats _stats;
+
+    void remember(uint8_t reg, uint8_t value) const noexcept {
+      if (!this->_shadowed.test(reg)) {
+        return;
+      }
+
+      this->expire();
+      this->_shadow[reg] = value;
+      this->_known.set(reg);
+    }
+
+    void forget(uint8_t reg) const noexcept { this->_known.reset(reg); }
+
+    void expire() const noexcept {
+      if (this->_shadowGeneration != this->_bus.generation()) {
+        this->_known.reset();
+        this->_shadowGeneration = this->_bus.generation();
+      }
+    }
+
+    [[nodiscard]] Result<uint8_t> readByteOnce(uint8_t reg) const noexcept {
+      uint8_t value = 0;
+
+      if (const Result<void> result = this->readOnce(reg, &value, 1); !result) {
+        return std::unexpected(result.error());
+      }
+
+      return value;
+    }
+
+    // Selecting the register is part of every attempt, a failed read may have left the device pointing elsewhere
+    [[nodiscard]] Result<void> readOnce(uint8_t reg, uint8_t *bytes, size_t length) const noexcept {
+      return this->measure(length, 1, [&]() -> Result<void> {
+        if (::write(this->_bus.fd(), &reg, 1) != 1) {
+          return std::unexpected(this->error(Operation::SelectRegister, reg));
+        }
+
+        if (::read(this->_bus.fd(), bytes, length) != static_cast<ssize_t>(length)) {
+          return std::unexpected(this->error(Operation::Read, reg));
+        }
+
+        return {};
+      });
+    }
+
+    [[nodiscard]] Result<void> writeByteOnce(uint8_t reg, uint8_t value) const noexcept {
+      return this->measure(0, 2, [&]() -> Result<void> {
+        const std::array<uint8_t, 2> buffer = {reg, value};
+
+        if (::write(this->_bus.fd(), buffer.data(), 2) != 2) {
+          return std::unexpected(this->error(Operation::Write, reg));
+        }
+
+        return {};
+      });
+    }
+
+    // Selects the device and runs one attempt at a transfer, recording it in the stats
+    template <typename Transfer>
+    [[nodiscard]] Result<void> measure(size_t read, size_t written, Transfer &&transfer) const noexcept {
+      const bool switching = this->_bus.address() != static_cast<int>(this->_addr) ||
+                             this->_bus.channel() != this->_channel;
+      const int64_t start = Timestamp::monotonicNow();
+
+      Result<void> result = this->_bus.selectChannel(this->_channel);
+
+      if (result) {
+        result = this->_bus.setAddress(this->_addr);
+      }
+
+      if (result) {
+        result = transfer();
+      }
+
+      const int64_t elapsed = Timestamp::monotonicNow() - start;
+      DeviceStats &stats = this->_stats;
+
+      stats.transactions.increment();
+      stats.busyNanoseconds.increment(static_cast<uint64_t>(elapsed));
+      stats.latency.record(elapsed);
+
+      if (switching && this->_bus.address() == static_cast<int>(this->_addr)) {
+        stats.addressSwitches.increment();
+      }
+
+      if (result) {
+        stats.bytesRead.increment(read);
+        stats.bytesWritten.increment(written);
+      } else {
+        stats.failures.increment();
+        stats.errors[std::min<size_t>(result.error().error, DeviceStats::ERRNO_SLOTS - 1)].increment();
+      }
+
+      return result;
+    }
+
+    // A short or failed transfer may leave errno at 0, which would read as success to whoever logs it
+    [[nodiscard]] BusError error(Operation operation, uint8_t reg) const noexcept {
+      return {.operation = operation, .error = errno != 0 ? errno : EIO, .address = this->_addr, .reg = reg};
+    }
   };
 } // namespace i2c
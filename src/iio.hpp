@@ -0,0 +1,377 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+
+namespace iio {
+  // sysfs attributes are short text files; a missing or unreadable one reads as nothing
+  [[nodiscard]] inline std::optional<std::string> readAttribute(const std::filesystem::path &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+      return std::nullopt;
+    }
+
+    std::array<char, 256> buffer{};
+    const ssize_t length = ::read(fd, buffer.data(), buffer.size());
+    ::close(fd);
+
+    if (length < 0) {
+      return std::nullopt;
+    }
+
+    std::string_view value(buffer.data(), static_cast<size_t>(length));
+
+    while (!value.empty() && (value.back() == '\n' || value.back() == ' ')) {
+      value.remove_suffix(1);
+    }
+
+    return std::string(value);
+  }
+
+  // Truncating makes no difference to sysfs, but keeps a file standing in for an attribute holding just the value
+  [[nodiscard]] inline bool writeAttribute(const std::filesystem::path &path, std::string_view value) {
+    const int fd = ::open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+
+    if (fd < 0) {
+      return false;
+    }
+
+    const bool written = ::write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+    ::close(fd);
+
+    return written;
+  }
+
+  /**
+   * One channel of a buffered scan. Where it sits and how it is encoded comes from scan_elements, how to turn it into
+   * a value from the scale and offset attributes of the device.
+   */
+  struct Channel {
+    std::string name; // e.g. "temp", "humidityrelative" or "timestamp"
+    uint32_t index{0};
+    bool bigEndian{false};
+    bool isSigned{false};
+    uint8_t bits{0};
+    uint8_t storageBytes{0};
+    uint8_t shift{0};
+    size_t offset{0}; // Bytes from the start of the scan
+    double scale{1.0};
+    double rawOffset{0.0};
+
+    // Parses a scan element type, "[be|le]:[s|u]bits/storagebits>>shift" (e.g. "le:s16/16>>0")
+    [[nodiscard]] static std::optional<Channel> parse(std::string name, uint32_t index, std::string_view type) {
+      Channel channel{.name = std::move(name), .index = index};
+
+      if (type.size() < 4 || (!type.starts_with("le:") && !type.starts_with("be:"))) {
+        return std::nullopt;
+      }
+
+      channel.bigEndian = type.starts_with("be:");
+      type.remove_prefix(3);
+
+      if (type.empty() || (type.front() != 's' && type.front() != 'u')) {
+        return std::nullopt;
+      }
+
+      channel.isSigned = type.front() == 's';
+      type.remove_prefix(1);
+
+      const auto number = [&type](unsigned &value) {
+        const auto [end, error] = std::from_chars(type.data(), type.data() + type.size(), value);
+        type.remove_prefix(static_cast<size_t>(end - type.data()));
+        return error == std::errc{};
+      };
+
+      unsigned bits = 0;
+      unsigned storageBits = 0;
+      unsigned shift = 0;
+
+      if (!number(bits) || !type.starts_with('/')) {
+        return std::nullopt;
+      }
+
+      type.remove_prefix(1);
+
+      // Repeated channels (an "X<count>" after the storage bits) hold several values none of the sensors here have
+      if (!number(storageBits) || !type.starts_with(">>")) {
+        return std::nullopt;
+      }
+
+      type.remove_prefix(2);
+
+      if (!number(shift) || !type.empty()) {
+        return std::nullopt;
+      }
+
+      if (storageBits == 0 || storageBits > 64 || storageBits % 8 != 0 || bits == 0 || bits + shift > storageBits) {
+        return std::nullopt;
+      }
+
+      channel.bits = static_cast<uint8_t>(bits);
+      channel.storageBytes = static_cast<uint8_t>(storageBits / 8);
+      channel.shift = static_cast<uint8_t>(shift);
+
+      return channel;
+    }
+
+    [[nodiscard]] int64_t raw(const uint8_t *scan) const noexcept {
+      uint64_t value = 0;
+
+      for (size_t i = 0; i < this->storageBytes; i++) {
+        const size_t byte = this->bigEndian ? i : this->storageBytes - 1 - i;
+        value = (value << 8) | scan[this->offset + byte];
+      }
+
+      value >>= this->shift;
+
+      if (this->bits < 64) {
+        const uint64_t mask = (uint64_t{1} << this->bits) - 1;
+        value &= mask;
+
+        if (this->isSigned && (value & (uint64_t{1} << (this->bits - 1))) != 0) {
+          value |= ~mask;
+        }
+      }
+
+      return static_cast<int64_t>(value);
+    }
+
+    // In the unit of the IIO ABI for the channel type, e.g. milli degrees Celsius for temp
+    [[nodiscard]] double value(const uint8_t *scan) const noexcept {
+      return (static_cast<double>(this->raw(scan)) + this->rawOffset) * this->scale;
+    }
+  };
+
+  // The enabled channels of a scan in the order the kernel writes them, each aligned to its own size
+  struct Layout {
+    std::vector<Channel> channels;
+    size_t size{0}; // Bytes per scan, padded so the next scan starts aligned too
+
+    [[nodiscard]] const Channel *find(std::string_view name) const {
+      const auto channel = std::ranges::find(this->channels, name, &Channel::name);
+      return channel == this->channels.end() ? nullptr : &*channel;
+    }
+  };
+
+  /**
+   * The buffer of an IIO device. The kernel driver services the data-ready interrupt and queues complete scans, so a
+   * single read() hands over everything queued since the last one. Only the requested channels and the timestamp are
+   * enabled, and timestamps are taken from the monotonic clock so they line up with the rest of the pipeline.
+   */
+  class Buffer {
+  public:
+    Buffer(const I2cConfig &config, std::span<const std::string_view> channels, size_t capacity) :
+        _device(config.IioDevice) {
+      // The character device is named after the sysfs directory, e.g. /dev/iio:device0
+      const std::filesystem::path device =
+          this->_device.filename().empty() ? this->_device.parent_path() : this->_device;
+      const std::string node = config.IioBuffer.empty() ? "/dev/" + device.filename().string() : config.IioBuffer;
+
+      // Only one reader can hold the buffer, and while another one does its scan elements and enable attribute are
+      // that reader's, so nothing in sysfs is touched before the device is ours
+      this->_fd = ::open(node.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+
+      if (this->_fd < 0) {
+        spdlog::error("Failed to open IIO buffer {}: {}", node, strerror(errno));
+        throw std::runtime_error("Failed to open IIO buffer");
+      }
+
+      try {
+        this->configure(config, channels, capacity);
+      } catch (const std::runtime_error &) {
+        ::close(this->_fd);
+        throw;
+      }
+
+      this->_data.resize(capacity * this->_layout.size);
+
+      SPDLOG_DEBUG("Reading IIO device {} from {}: {} channels, {} bytes per scan",
+                   this->_device.string(),
+                   node,
+                   this->_layout.channels.size(),
+                   this->_layout.size);
+    }
+
+    ~Buffer() {
+      if (!writeAttribute(this->_device / "buffer" / "enable", "0")) {
+        spdlog::warn("Failed to disable the buffer of IIO device {}: {}", this->_device.string(), strerror(errno));
+      }
+
+      ::close(this->_fd);
+    }
+
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    [[nodiscard]] int fd() const noexcept { return this->_fd; }
+
+    [[nodiscard]] const Layout &layout() const noexcept { return this->_layout; }
+
+    [[nodiscard]] std::string name() const { return readAttribute(this->_device / "name").value_or("?"); }
+
+    // Whole scans read in one go, up to the capacity; empty when nothing is queued. Fails with the errno of the read
+    [[nodiscard]] std::expected<std::span<const uint8_t>, int> read() noexcept {
+      const ssize_t length = ::read(this->_fd, this->_data.data(), this->_data.size());
+
+      if (length < 0) {
+        if (errno == EAGAIN) {
+          return std::span<const uint8_t>{};
+        }
+
+        return std::unexpected(errno);
+      }
+
+      // The kernel only hands out whole scans, a partial one can only come from a file standing in for the device
+      const auto bytes = static_cast<size_t>(length);
+      return std::span<const uint8_t>(this->_data.data(), bytes - (bytes % this->_layout.size));
+    }
+
+  private:
+    std::filesystem::path _device;
+    Layout _layout;
+    int _fd{-1};
+    std::vector<uint8_t> _data;
+
+    void configure(const I2cConfig &config, std::span<const std::string_view> channels, size_t capacity) {
+      const std::filesystem::path buffer = this->_device / "buffer";
+
+      // Scan elements can't change while the buffer runs, e.g. when a previous run didn't get to disable it
+      if (!writeAttribute(buffer / "enable", "0")) {
+        spdlog::warn("Failed to disable the buffer of IIO device {}: {}", this->_device.string(), strerror(errno));
+      }
+
+      this->_layout = Buffer::configureScan(this->_device, channels);
+
+      if (!writeAttribute(this->_device / "current_timestamp_clock", "monotonic")) {
+        spdlog::warn("Failed to set the timestamp clock of IIO device {}, timestamps may be off",
+                     this->_device.string());
+      }
+
+      if (!config.IioTrigger.empty() &&
+          !writeAttribute(this->_device / "trigger" / "current_trigger", config.IioTrigger)) {
+        spdlog::error("Failed to attach trigger {} to IIO device {}: {}",
+                      config.IioTrigger,
+                      this->_device.string(),
+                      strerror(errno));
+        throw std::runtime_error("Failed to attach IIO trigger");
+      }
+
+      const size_t length = std::max<size_t>(capacity, config.IioWatermark);
+
+      if (!writeAttribute(buffer / "length", std::to_string(length)) ||
+          !writeAttribute(buffer / "watermark", std::to_string(config.IioWatermark))) {
+        spdlog::warn("Failed to size the buffer of IIO device {}: {}", this->_device.string(), strerror(errno));
+      }
+
+      if (!writeAttribute(buffer / "enable", "1")) {
+        spdlog::error("Failed to enable the buffer of IIO device {}: {}", this->_device.string(), strerror(errno));
+        throw std::runtime_error("Failed to enable IIO buffer");
+      }
+    }
+
+    [[nodiscard]] static Layout configureScan(const std::filesystem::path &device,
+                                              std::span<const std::string_view> wanted) {
+      const std::filesystem::path elements = device / "scan_elements";
+      std::error_code error;
+      Layout layout;
+
+      for (const auto &entry : std::filesystem::directory_iterator(elements, error)) {
+        const std::string file = entry.path().filename().string();
+
+        if (!file.starts_with("in_") || !file.ends_with("_en")) {
+          continue;
+        }
+
+        std::string name = file.substr(3, file.size() - 6);
+        const bool enable = name == "timestamp" || std::ranges::find(wanted, name) != wanted.end();
+
+        if (!writeAttribute(entry.path(), enable ? "1" : "0")) {
+          spdlog::error("Failed to {} IIO channel {} of {}: {}",
+                        enable ? "enable" : "disable",
+                        name,
+                        device.string(),
+                        strerror(errno));
+          throw std::runtime_error("Failed to configure IIO scan elements");
+        }
+
+        if (!enable) {
+          continue;
+        }
+
+        const std::optional<std::string> index = readAttribute(elements / std::format("in_{}_index", name));
+        const std::optional<std::string> type = readAttribute(elements / std::format("in_{}_type", name));
+        uint32_t position = 0;
+
+        if (!index || std::from_chars(index->data(), index->data() + index->size(), position).ec != std::errc{}) {
+          spdlog::error("Missing or invalid scan index of IIO channel {} of {}", name, device.string());
+          throw std::runtime_error("Invalid IIO scan element");
+        }
+
+        std::optional<Channel> channel = type ? Channel::parse(name, position, *type) : std::nullopt;
+
+        if (!channel) {
+          spdlog::error("Unsupported scan type '{}' of IIO channel {} of {}", type.value_or(""), name, device.string());
+          throw std::runtime_error("Invalid IIO scan element");
+        }
+
+        channel->scale = Buffer::number(device / std::format("in_{}_scale", name)).value_or(1.0);
+        channel->rawOffset = Buffer::number(device / std::format("in_{}_offset", name)).value_or(0.0);
+
+        layout.channels.push_back(std::move(*channel));
+      }
+
+      if (std::ranges::none_of(layout.channels, [](const Channel &channel) { return channel.name != "timestamp"; })) {
+        spdlog::error("IIO device {} has none of the channels to read in {}", device.string(), elements.string());
+        throw std::runtime_error("No IIO channels to read");
+      }
+
+      std::ranges::sort(layout.channels, {}, &Channel::index);
+
+      size_t alignment = 1;
+
+      for (Channel &channel : layout.channels) {
+        layout.size = (layout.size + channel.storageBytes - 1) / channel.storageBytes * channel.storageBytes;
+        channel.offset = layout.size;
+        layout.size += channel.storageBytes;
+        alignment = std::max<size_t>(alignment, channel.storageBytes);
+      }
+
+      layout.size = (layout.size + alignment - 1) / alignment * alignment;
+
+      return layout;
+    }
+
+    [[nodiscard]] static std::optional<double> number(const std::filesystem::path &path) {
+      const std::optional<std::string> text = readAttribute(path);
+      double value = 0.0;
+
+      if (!text || std::from_chars(text->data(), text->data() + text->size(), value).ec != std::errc{}) {
+        return std::nullopt;
+      }
+
+      return value;
+    }
+  };
+} // namespace iio
@@ -1,14 +1,25 @@
 #include <atomic>
+#include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <print>
 #include <string>
 
 #include <argparse.hpp>
+#include <spdlog/async.h>
 #include <spdlog/common.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include "config.hpp"
+#include "control.hpp"
 #include "pisense.hpp"
+#include "query.hpp"
 
 namespace {
   std::atomic<bool> shouldExit{false};
@@ -18,6 +29,119 @@ namespace {
     shouldExit.store(true, std::memory_order_relaxed);
     exitSignal.store(signal, std::memory_order_relaxed);
   }
+
+  /**
+   * In async mode log calls only format the message and push it onto a bounded queue; a background thread does the
+   * writing, so a slow terminal or journal can't hold up a tick. With OverrunOldest a full queue drops old messages
+   * instead of blocking the caller.
+   */
+  void configureLogger(const LoggerConfig &config) {
+    if (!config.Async) {
+      return;
+    }
+
+    const auto policy = config.OverflowPolicy == LoggerConfig::OverflowPolicy::Block
+                            ? spdlog::async_overflow_policy::block
+                            : spdlog::async_overflow_policy::overrun_oldest;
+
+    spdlog::init_thread_pool(config.QueueSize, 1);
+
+    auto sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    spdlog::set_default_logger(std::make_shared<spdlog::async_logger>("pisense", sink, spdlog::thread_pool(), policy));
+  }
+
+  int runQuery(const argparse::ArgumentParser &command, const std::string &configPath) {
+    // Query output goes to stdout, so anything logged has to go elsewhere
+    spdlog::set_default_logger(spdlog::stderr_color_mt("query"));
+    spdlog::set_level(spdlog::level::warn);
+
+    const Config config(configPath);
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch())
+                            .count();
+
+    query::Options options;
+    options.path = command.present("--file").value_or(config.Exporter.History.Path);
+    options.resolution = command.present("--resolution");
+
+    for (const I2cConfig &i2c : config.I2C) {
+      options.sources.push_back(i2c.Name);
+    }
+
+    const std::optional<int64_t> from = query::toTimestamp(command.get<std::string>("--from"), now);
+    const std::optional<int64_t> to = query::toTimestamp(command.get<std::string>("--to"), now);
+    const std::optional<query::Format> format = query::toFormat(command.get<std::string>("--format"));
+
+    if (!from || !to || !format) {
+      spdlog::error("Invalid --from, --to or --format value");
+      return 1;
+    }
+
+    options.from = *from;
+    options.to = *to;
+    options.format = *format;
+
+    return query::run(options);
+  }
+
+  /**
+   * Gets the latest samples from the running instance, which owns the bus. Returns the exit code once it answered, or
+   * nothing when none is running and the sensors can be read directly instead; a client never reads them itself.
+   */
+  std::optional<int> askRunningInstance(const ControlConfig &config, bool client) {
+    if (!config.Enabled) {
+      if (client) {
+        std::println(stderr, "--client needs the control socket, but [Control] is disabled");
+        return 1;
+      }
+
+      return std::nullopt;
+    }
+
+    const std::expected<std::string, int> latest = control::query(config.Path, control::TIMEOUT_MS);
+
+    if (!latest && control::absent(latest.error()) && !client) {
+      return std::nullopt;
+    }
+
+    if (!latest) {
+      std::println(stderr, "Failed to query the running instance on {}: {}", config.Path, strerror(latest.error()));
+      return 1;
+    }
+
+    if (latest->empty()) {
+      std::println(stderr, "The running instance hasn't read any samples yet");
+      return 1;
+    }
+
+    std::print("{}", *latest);
+    return 0;
+  }
+
+  /**
+   * Whether another instance may be running, judged by the control socket. Both would poll the same sensors, so this
+   * has to be known before the boards are opened and configured, not after. Only a missing socket or one nobody
+   * listens on means there is none; a socket that can't be queried may well belong to a running instance.
+   */
+  bool anotherInstanceRunning(const ControlConfig &config) {
+    if (!config.Enabled) {
+      return false;
+    }
+
+    const std::expected<std::string, int> latest = control::query(config.Path, control::TIMEOUT_MS);
+
+    if (latest) {
+      spdlog::error("Another instance is already running, it answers on {}", config.Path);
+      return true;
+    }
+
+    if (control::absent(latest.error())) {
+      return false;
+    }
+
+    spdlog::error("Failed to check for a running instance on {}: {}", config.Path, strerror(latest.error()));
+    return true;
+  }
 } // namespace
 
 int main(int argc, const char *argv[]) {
@@ -33,7 +157,17 @@ int main(int argc, const char *argv[]) {
   program.add_epilog("Created by Kasim Ahmic. Source code available at https://github.com/KasimAhmic/pisense");
 
   program.add_argument("--once", "-o")
-      .help("polls the SenseHat one time, outputs the data, and exits")
+      .help("outputs the latest data of the running instance (or polls the SenseHat if none is running) and exits")
+      .default_value(false)
+      .implicit_value(true);
+
+  program.add_argument("--client")
+      .help("prints the latest samples of the running instance and exits, failing if there is none")
+      .default_value(false)
+      .implicit_value(true);
+
+  program.add_argument("--stats", "-s")
+      .help("prints transaction statistics of every I2C device on exit")
       .default_value(false)
       .implicit_value(true);
 
@@ -42,17 +176,67 @@ int main(int argc, const char *argv[]) {
       .default_value("config.ini")
       .implicit_value(false);
 
+  argparse::ArgumentParser queryCommand("query");
+  queryCommand.add_description(
+      "Prints samples from the local history file (see [Exporter.History]) within a time range.");
+
+  queryCommand.add_argument("--from")
+      .help("start of the range: \"now\", a duration before now such as \"24h\", or Unix time in seconds")
+      .default_value(std::string("1h"));
+
+  queryCommand.add_argument("--to")
+      .help("end of the range, in the same formats as --from")
+      .default_value(std::string("now"));
+
+  queryCommand.add_argument("--format")
+      .help("output format: json (one object per line), csv, or binary (raw records)")
+      .default_value(std::string("json"));
+
+  queryCommand.add_argument("--resolution", "-r")
+      .help("read rollup buckets of this resolution (e.g. 1m, see [Exporter.Rollup]) instead of raw samples");
+
+  queryCommand.add_argument("--file", "-f").help("history file to read instead of the configured one");
+
+  program.add_subparser(queryCommand);
+
   program.parse_args(argc, argv);
 
+  if (program.is_subcommand_used(queryCommand)) {
+    return runQuery(queryCommand, program.get<std::string>("--config"));
+  }
+
   const bool once = program.get<bool>("--once");
+  const bool client = program.get<bool>("--client");
 
-  if (once) {
+  if (once || client) {
     spdlog::set_level(spdlog::level::off);
   }
 
   Config config(program.get<std::string>("--config"));
 
-  PiSense app(config, shouldExit, exitSignal);
+  // The running instance owns the bus, a one-shot read only opens it when there is none
+  if (once || client) {
+    if (const std::optional<int> result = askRunningInstance(config.Control, client)) {
+      return *result;
+    }
+  }
+
+  configureLogger(config.Logger);
+
+  if (!once && anotherInstanceRunning(config.Control)) {
+    spdlog::shutdown();
+    return 1;
+  }
+
+  int result = 0;
+
+  {
+    PiSense app(config, shouldExit, exitSignal);
+    result = app.run(once, program.get<bool>("--stats"));
+  }
+
+  // Drains the async queue, if any, before exiting
+  spdlog::shutdown();
 
-  return app.run(once);
+  return result;
 };
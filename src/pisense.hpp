@@ -1,46 +1,127 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <print>
-#include <string_view>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
-#include <json.hpp>
-#include <spdlog/common.h>
 #include <spdlog/spdlog.h>
 
+#include "acquisition.hpp"
 #include "config.hpp"
-#include "sense_hat.hpp"
-#include "timer.hpp"
-
-using nlohmann::json;
+#include "control.hpp"
+#include "exporter.hpp"
+#include "exporters/history.hpp"
+#include "exporters/mqtt.hpp"
+#include "exporters/prometheus.hpp"
+#include "exporters/shared_memory.hpp"
+#include "exporters/stream.hpp"
+#ifdef PISENSE_EXPORTER_SQLITE
+#include "exporters/sqlite.hpp"
+#endif
+#ifdef PISENSE_EXPORTER_POSTGRES
+#include "exporters/postgres.hpp"
+#endif
+#include "scheduler.hpp"
+#include "telemetry.hpp"
 
 class PiSense {
 public:
   PiSense(Config config, const std::atomic<bool> &shouldExit, const std::atomic<int> &exitSig) :
-      _config(config), _shouldExit(shouldExit), _exitSignal(exitSig) {}
+      _config(config), _shouldExit(shouldExit), _exitSignal(exitSig) {
+    // Instances on the same adapter share its bus and worker, in the order they were listed
+    std::vector<std::vector<uint8_t>> buses;
+
+    for (size_t i = 0; i < this->_config.I2C.size(); i++) {
+      // The kernel driver owns the bus of an IIO device, so it needs no scheduling of its own
+      if (this->_config.I2C[i].Backend == I2cConfig::Driver::Iio) {
+        this->_buffered.push_back(std::make_unique<BufferedAcquisition>(this->_config,
+                                                                        this->_config.I2C[i],
+                                                                        static_cast<uint8_t>(i),
+                                                                        this->_telemetry));
+        continue;
+      }
+
+      const auto bus = std::ranges::find_if(buses, [&](const std::vector<uint8_t> &sources) {
+        return this->_config.I2C[sources.front()].Bus == this->_config.I2C[i].Bus;
+      });
+
+      if (bus == buses.end()) {
+        buses.push_back({static_cast<uint8_t>(i)});
+      } else {
+        bus->push_back(static_cast<uint8_t>(i));
+      }
+    }
+
+    for (const std::vector<uint8_t> &sources : buses) {
+      this->_schedulers.push_back(std::make_unique<Scheduler>(this->_config, sources, this->_telemetry));
+    }
+  }
 
   ~PiSense() = default;
 
-  int run(bool once) {
+  int run(bool once, bool stats) {
     spdlog::set_level(once ? spdlog::level::off : this->_config.Logger.LogLevel);
 
     spdlog::info("Starting Sense application...");
 
     if (once) {
       spdlog::info("Running once...");
-      this->tick();
+
+      // The console line shows every metric
+      for (const std::unique_ptr<Scheduler> &scheduler : this->_schedulers) {
+        scheduler->activate(ALL_METRICS);
+        scheduler->tick();
+      }
+
+      for (const std::unique_ptr<BufferedAcquisition> &acquisition : this->_buffered) {
+        acquisition->tick(BufferedAcquisition::ONCE_WAIT_MS);
+      }
+
+      if (stats) {
+        this->printStats();
+      }
+
       return 0;
     }
 
     if (this->_config.Debug.RunHealthCheckOnStartup) {
       spdlog::info("Running health check...");
-      this->_senseHat.testHardware();
+
+      for (const std::unique_ptr<Scheduler> &scheduler : this->_schedulers) {
+        scheduler->testHardware();
+      }
+
+      for (const std::unique_ptr<BufferedAcquisition> &acquisition : this->_buffered) {
+        acquisition->testHardware();
+      }
+    }
+
+    if (this->_config.Control.Enabled) {
+      this->startControl();
     }
 
-    Timer timer([&]() { this->tick(); }, this->_config.App.PollingIntervalMs);
-    timer.start();
+    if (this->_config.Exporter.Enabled) {
+      this->startExporter();
+    }
+
+    const uint32_t metrics = this->consumedMetrics();
+
+    for (const std::unique_ptr<Scheduler> &scheduler : this->_schedulers) {
+      scheduler->start(this->_exporter.get(), this->_cache.get(), metrics);
+    }
+
+    for (const std::unique_ptr<BufferedAcquisition> &acquisition : this->_buffered) {
+      acquisition->start(this->_exporter.get(), this->_cache.get(), metrics);
+    }
 
     while (!this->shouldClose()) {
       std::this_thread::sleep_for(std::chrono::milliseconds(this->_config.App.ExitCheckIntervalMs));
@@ -49,7 +130,21 @@ public:
     std::println(); // So the exit message doesn't appear on the same line as the control character
     spdlog::warn("Exiting... (signal: {})", this->getExitSignal());
 
-    timer.stop();
+    for (const std::unique_ptr<Scheduler> &scheduler : this->_schedulers) {
+      scheduler->stop();
+    }
+
+    for (const std::unique_ptr<BufferedAcquisition> &acquisition : this->_buffered) {
+      acquisition->stop();
+    }
+
+    // Drains whatever is still queued before the sinks shut down
+    this->_exporter.reset();
+    this->_control.reset();
+
+    if (stats) {
+      this->printStats();
+    }
 
     spdlog::info("Sense application closed");
 
@@ -57,34 +152,129 @@ public:
   }
 
 private:
-  struct SpdLogger {
-    static void trace(std::string_view msg) { spdlog::trace(msg); }
-    static void debug(std::string_view msg) { spdlog::debug(msg); }
-    static void info(std::string_view msg) { spdlog::info(msg); }
-    static void warn(std::string_view msg) { spdlog::warn(msg); }
-    static void error(std::string_view msg) { spdlog::error(msg); }
-    static void critical(std::string_view msg) { spdlog::critical(msg); }
-  };
-
   Config _config;
-  SenseHat<SpdLogger> _senseHat;
+  telemetry::Registry _telemetry;
   const std::atomic<bool> &_shouldExit;
   const std::atomic<int> &_exitSignal;
+  std::unique_ptr<control::Cache> _cache;
+  std::unique_ptr<control::Server> _control;
+  std::vector<std::unique_ptr<Scheduler>> _schedulers;
+  std::vector<std::unique_ptr<BufferedAcquisition>> _buffered;
+  std::unique_ptr<Exporter> _exporter;
 
   bool shouldClose() const { return _shouldExit.load(std::memory_order_relaxed); }
   int getExitSignal() const { return _exitSignal.load(std::memory_order_relaxed); }
 
-  void tick() const {
-    const double tempC = this->_senseHat.readTemperature();
-    const double tempF = (tempC * (9.0 / 5.0)) + 32.0;
-    const double humidity = this->_senseHat.readHumidity();
+  [[nodiscard]] std::vector<std::string> sourceNames() const {
+    std::vector<std::string> sources;
+
+    for (const I2cConfig &i2c : this->_config.I2C) {
+      sources.push_back(i2c.Name);
+    }
+
+    return sources;
+  }
 
-    const json::object_t output{
-        {"temperature_celsius", tempC},
-        {"temperature_fahrenheit", tempF},
-        {"humidity", humidity},
-    };
+  /**
+   * Serves the latest samples on the control socket, so `--once` and `--client` never open the bus next to this
+   * instance. Without the socket (e.g. its directory is missing) everything else still runs.
+   */
+  void startControl() {
+    this->_cache = std::make_unique<control::Cache>(this->sourceNames());
+    this->_control = std::make_unique<control::Server>(*this->_cache, this->_telemetry);
 
-    std::println("{}", json(output).dump());
+    try {
+      this->_control->start(this->_config.Control.Path);
+    } catch (const std::runtime_error &) {
+      spdlog::warn("Running without the control socket, --once and --client will read the sensors directly");
+      this->_control.reset();
+    }
+  }
+
+  void startExporter() {
+    this->_exporter = std::make_unique<Exporter>(this->_config.Exporter, this->_telemetry);
+
+    if (this->_config.Exporter.Prometheus.Enabled) {
+      this->_exporter->add(
+          std::make_unique<prometheus::Sink>(this->_config.Exporter.Prometheus, this->sourceNames(), this->_telemetry));
+    }
+
+    if (this->_config.Exporter.History.Enabled) {
+      this->_exporter->add(std::make_unique<history::Sink>(this->_config.Exporter.History, this->_telemetry));
+    }
+
+    if (this->_config.Exporter.SharedMemory.Enabled) {
+      this->_exporter->add(std::make_unique<shm::Sink>(this->_config.Exporter.SharedMemory, this->_telemetry));
+    }
+
+    if (this->_config.Exporter.Stream.Enabled) {
+      this->_exporter->add(
+          std::make_unique<stream::Sink>(this->_config.Exporter.Stream, this->sourceNames(), this->_telemetry));
+    }
+
+    if (this->_config.Exporter.Mqtt.Enabled) {
+      this->_exporter->add(std::make_unique<mqtt::Sink>(this->_config.Exporter.Mqtt,
+                                                        this->_config.Exporter.Spool,
+                                                        this->sourceNames(),
+                                                        this->_telemetry));
+    }
+
+    if (this->_config.Exporter.SQLite.Enabled) {
+#ifdef PISENSE_EXPORTER_SQLITE
+      this->_exporter->add(
+          std::make_unique<sqlite::Sink>(this->_config.Exporter.SQLite, this->sourceNames(), this->_telemetry));
+#else
+      spdlog::warn("SQLite exporter is enabled but PiSense was built without it (PISENSE_EXPORTER_SQLITE=OFF)");
+#endif
+    }
+
+    if (this->_config.Exporter.Postgres.Enabled) {
+#ifdef PISENSE_EXPORTER_POSTGRES
+      this->_exporter->add(std::make_unique<postgres::Sink>(this->_config.Exporter.Postgres,
+                                                            this->_config.Exporter.Spool,
+                                                            this->sourceNames(),
+                                                            this->_telemetry));
+#else
+      spdlog::warn("PostgreSQL exporter is enabled but PiSense was built without it (PISENSE_EXPORTER_POSTGRES=OFF)");
+#endif
+    }
+
+    if (this->_exporter->empty()) {
+      spdlog::warn("Exporter is enabled but no exporters are configured");
+      this->_exporter.reset();
+      return;
+    }
+
+    this->_exporter->start();
+  }
+
+  /**
+   * What the sensors are read for: every metric some sink consumes. Without any sinks the console line is all there
+   * is, and it shows everything. So do the samples served on the control socket, which stand in for a direct --once.
+   */
+  [[nodiscard]] uint32_t consumedMetrics() const {
+    if (!this->_exporter || this->_control) {
+      return ALL_METRICS;
+    }
+
+    const uint32_t metrics = this->_exporter->metrics();
+
+    for (size_t i = 0; i < METRIC_COUNT; i++) {
+      if ((metrics & (1U << i)) == 0) {
+        spdlog::info("No exporter consumes {}, it isn't read", METRICS[i].name);
+      }
+    }
+
+    return metrics;
+  }
+
+  void printStats() const {
+    for (const std::unique_ptr<Scheduler> &scheduler : this->_schedulers) {
+      scheduler->printStats();
+    }
+
+    for (const std::unique_ptr<BufferedAcquisition> &acquisition : this->_buffered) {
+      acquisition->printStats();
+    }
   }
 };
@@ -0,0 +1,539 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace pubsub {
+  enum class SlowPolicy : uint8_t { Drop, Disconnect };
+
+  /**
+   * Streams samples as JSON lines to any number of local subscribers over an `AF_UNIX` stream socket. A subscriber
+   * receives every metric until it sends a line naming the ones it wants (`humidity,temperature_celsius`, or `*` for
+   * all of them again). With several boards every line also names the one it came from in a `source` field.
+   *
+   * A single epoll thread owns every subscriber. Each published batch is serialized once per distinct filter in use
+   * and the same refcounted buffer is queued on every matching subscriber, then written with `writev`. A subscriber
+   * whose send queue grows past `maxQueueBytes` either misses batches or is disconnected, so one stalled reader never
+   * holds back the others or grows memory without bound.
+   */
+  class Server {
+  public:
+    Server(telemetry::Registry &registry,
+           std::vector<std::string> sources,
+           uint32_t maxSubscribers,
+           size_t maxQueueBytes,
+           SlowPolicy slowPolicy) :
+        _sources(std::move(sources)),
+        _maxSubscribers(maxSubscribers),
+        _maxQueueBytes(maxQueueBytes),
+        _slowPolicy(slowPolicy) {
+      registry.counter("pisense_pubsub_bytes_total", "Bytes written to stream subscribers", this->_bytes);
+      registry.counter("pisense_pubsub_dropped_total",
+                       "Batches not delivered to a subscriber because its send queue was full",
+                       this->_dropped);
+      registry.counter("pisense_pubsub_disconnected_total",
+                       "Subscribers disconnected because their send queue was full",
+                       this->_disconnected);
+      registry.counter("pisense_pubsub_rejected_total",
+                       "Subscribers refused because the subscriber limit was reached",
+                       this->_rejected);
+      registry.gauge("pisense_pubsub_subscribers", "Connected stream subscribers", [this] {
+        return static_cast<double>(this->_subscriberCount.load(std::memory_order_relaxed));
+      });
+    }
+
+    ~Server() noexcept { this->stop(); }
+
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    void start(const std::string &path) {
+      sockaddr_un addr{};
+      addr.sun_family = AF_UNIX;
+
+      if (path.size() >= sizeof(addr.sun_path)) {
+        spdlog::error("Stream socket path '{}' is too long", path);
+        throw std::runtime_error("Stream socket path too long");
+      }
+
+      std::memcpy(addr.sun_path, path.c_str(), path.size());
+
+      // A socket file left behind by a previous run would make bind fail
+      ::unlink(path.c_str());
+
+      this->_listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+      if (this->_listenFd < 0 || ::bind(this->_listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+          ::listen(this->_listenFd, SOMAXCONN) < 0) {
+        spdlog::error("Failed to listen on {}: {}", path, strerror(errno));
+        this->closeAll();
+        throw std::runtime_error("Failed to start stream server");
+      }
+
+      this->_path = path;
+      this->_epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+      this->_wakeFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      this->watch(this->_listenFd, EPOLLIN, &this->_listenFd);
+      this->watch(this->_wakeFd, EPOLLIN, &this->_wakeFd);
+
+      spdlog::info("Stream server listening on {}", path);
+
+      this->_running = true;
+      this->_worker = std::thread([this] { this->run(); });
+    }
+
+    void stop() noexcept {
+      if (this->_worker.joinable()) {
+        {
+          std::lock_guard lock(this->_mutex);
+          this->_running = false;
+        }
+
+        this->wake();
+        this->_worker.join();
+      }
+
+      this->closeAll();
+    }
+
+    // Hands a batch to the server thread; only copies the samples, serialization happens over there
+    void publish(std::span<const Sample> batch) {
+      {
+        std::lock_guard lock(this->_mutex);
+        this->_pending.insert(this->_pending.end(), batch.begin(), batch.end());
+      }
+
+      this->wake();
+    }
+
+  private:
+    using Chunk = std::shared_ptr<const std::string>;
+
+    static constexpr size_t INPUT_BUFFER_SIZE = 512;
+    static constexpr size_t MAX_EVENTS = 64;
+    static constexpr size_t MAX_IOV = 64;
+
+    struct Subscriber {
+      int fd;
+      uint32_t filter{ALL_METRICS};
+      std::deque<Chunk> queue;
+      size_t offset{0}; // Bytes of the front chunk already written
+      size_t queued{0}; // Bytes waiting in the queue, including the front chunk's unwritten part
+      std::array<char, INPUT_BUFFER_SIZE> input{};
+      size_t inputLength{0};
+      bool writing{false};
+    };
+
+    std::vector<std::string> _sources;
+    uint32_t _maxSubscribers;
+    size_t _maxQueueBytes;
+    SlowPolicy _slowPolicy;
+    std::string _path;
+    int _listenFd{-1};
+    int _epollFd{-1};
+    int _wakeFd{-1};
+    std::thread _worker;
+    std::mutex _mutex;
+    bool _running{false};
+    std::vector<Sample> _pending;
+    std::vector<Sample> _batch;
+    std::unordered_map<int, std::unique_ptr<Subscriber>> _subscribers;
+    std::vector<std::unique_ptr<Subscriber>> _closed;
+    std::atomic<uint32_t> _subscriberCount{0};
+    telemetry::Counter _bytes;
+    telemetry::Counter _dropped;
+    telemetry::Counter _disconnected;
+    telemetry::Counter _rejected;
+
+    void watch(int fd, uint32_t events, void *tag) const {
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = tag;
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void rewatch(Subscriber &subscriber, uint32_t events) const {
+      epoll_event event{};
+      event.events = events;
+      event.data.ptr = &subscriber;
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_MOD, subscriber.fd, &event);
+    }
+
+    void wake() const noexcept {
+      const uint64_t one = 1;
+      (void)::write(this->_wakeFd, &one, sizeof(one));
+    }
+
+    void run() {
+      std::array<epoll_event, MAX_EVENTS> events{};
+
+      while (true) {
+        const int count = ::epoll_wait(this->_epollFd, events.data(), static_cast<int>(events.size()), -1);
+
+        if (count < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          spdlog::error("Stream server epoll_wait failed: {}", strerror(errno));
+          return;
+        }
+
+        for (int i = 0; i < count; i++) {
+          const epoll_event &event = events[i];
+
+          if (event.data.ptr == &this->_wakeFd) {
+            if (!this->drain()) {
+              return;
+            }
+
+            continue;
+          }
+
+          if (event.data.ptr == &this->_listenFd) {
+            this->accept();
+            continue;
+          }
+
+          auto &subscriber = *static_cast<Subscriber *>(event.data.ptr);
+
+          if (subscriber.fd < 0) {
+            continue;
+          }
+
+          if ((event.events & (EPOLLERR | EPOLLHUP)) != 0) {
+            this->close(subscriber);
+          } else if ((event.events & EPOLLOUT) != 0) {
+            this->flush(subscriber);
+          } else {
+            this->receive(subscriber);
+          }
+        }
+
+        this->_closed.clear();
+      }
+    }
+
+    // Takes the published samples and fans them out; returns false once the server is stopping
+    bool drain() {
+      uint64_t wakes = 0;
+      (void)::read(this->_wakeFd, &wakes, sizeof(wakes));
+
+      {
+        std::lock_guard lock(this->_mutex);
+
+        if (!this->_running) {
+          return false;
+        }
+
+        std::swap(this->_pending, this->_batch);
+      }
+
+      if (!this->_batch.empty() && !this->_subscribers.empty()) {
+        this->fanOut();
+      }
+
+      this->_batch.clear();
+
+      return true;
+    }
+
+    void fanOut() {
+      // Serialized lazily, once per distinct filter among the connected subscribers
+      std::unordered_map<uint32_t, Chunk> chunks;
+      std::vector<Subscriber *> ready;
+
+      for (auto &[fd, subscriber] : this->_subscribers) {
+        auto [it, inserted] = chunks.try_emplace(subscriber->filter);
+
+        if (inserted) {
+          it->second = this->serialize(this->_batch, subscriber->filter);
+        }
+
+        if (!it->second->empty()) {
+          ready.push_back(subscriber.get());
+        }
+      }
+
+      for (Subscriber *subscriber : ready) {
+        const Chunk &chunk = chunks[subscriber->filter];
+
+        if (subscriber->queued + chunk->size() > this->_maxQueueBytes) {
+          if (this->_slowPolicy == SlowPolicy::Disconnect) {
+            this->_disconnected.increment();
+            this->close(*subscriber);
+          } else {
+            this->_dropped.increment();
+          }
+
+          continue;
+        }
+
+        subscriber->queue.push_back(chunk);
+        subscriber->queued += chunk->size();
+
+        if (!subscriber->writing) {
+          this->flush(*subscriber);
+        }
+      }
+    }
+
+    [[nodiscard]] Chunk serialize(std::span<const Sample> batch, uint32_t filter) const {
+      auto chunk = std::make_shared<std::string>();
+      auto out = std::back_inserter(*chunk);
+
+      for (const Sample &sample : batch) {
+        if ((sample.present & filter) == 0) {
+          continue;
+        }
+
+        std::format_to(out, "{{\"timestamp\":{}", sample.timestamp);
+
+        // Like the console line, a single board isn't named
+        if (this->_sources.size() > 1 && sample.source < this->_sources.size()) {
+          std::format_to(out, ",\"source\":\"{}\"", this->_sources[sample.source]);
+        }
+
+        sample.forEach([&](Metric metric, double value) {
+          if ((filter & (1U << static_cast<uint32_t>(metric))) == 0) {
+            return;
+          }
+
+          if (std::isfinite(value)) {
+            std::format_to(out, ",\"{}\":{}", metricInfo(metric).name, value);
+          } else {
+            std::format_to(out, ",\"{}\":null", metricInfo(metric).name);
+          }
+        });
+
+        std::format_to(out, "}}\n");
+      }
+
+      return chunk;
+    }
+
+    void accept() {
+      while (true) {
+        const int fd = ::accept4(this->_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            spdlog::warn("Stream server failed to accept connection: {}", strerror(errno));
+          }
+
+          return;
+        }
+
+        if (this->_subscribers.size() >= this->_maxSubscribers) {
+          this->_rejected.increment();
+          ::close(fd);
+          continue;
+        }
+
+        auto subscriber = std::make_unique<Subscriber>();
+        subscriber->fd = fd;
+        this->watch(fd, EPOLLIN, subscriber.get());
+        this->_subscribers.emplace(fd, std::move(subscriber));
+        this->_subscriberCount.store(this->_subscribers.size(), std::memory_order_relaxed);
+      }
+    }
+
+    // Fan-out can close subscribers that still have events pending in the current epoll batch, so they're only freed
+    // once the batch has been handled
+    void close(Subscriber &subscriber) {
+      const auto it = this->_subscribers.find(subscriber.fd);
+
+      ::epoll_ctl(this->_epollFd, EPOLL_CTL_DEL, subscriber.fd, nullptr);
+      ::close(subscriber.fd);
+      subscriber.fd = -1;
+
+      this->_closed.push_back(std::move(it->second));
+      this->_subscribers.erase(it);
+      this->_subscriberCount.store(this->_subscribers.size(), std::memory_order_relaxed);
+    }
+
+    // Subscribers only ever send filter lines; anything that doesn't fit the buffer is discarded
+    void receive(Subscriber &subscriber) {
+      while (true) {
+        const ssize_t received = ::read(subscriber.fd,
+                                        subscriber.input.data() + subscriber.inputLength,
+                                        subscriber.input.size() - subscriber.inputLength);
+
+        if (received == 0) {
+          this->close(subscriber);
+          return;
+        }
+
+        if (received < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            this->close(subscriber);
+          }
+
+          return;
+        }
+
+        subscriber.inputLength += static_cast<size_t>(received);
+
+        while (true) {
+          const std::string_view buffered(subscriber.input.data(), subscriber.inputLength);
+          const size_t lineEnd = buffered.find('\n');
+
+          if (lineEnd == std::string_view::npos) {
+            if (subscriber.inputLength == subscriber.input.size()) {
+              subscriber.inputLength = 0;
+            }
+
+            break;
+          }
+
+          subscriber.filter = Server::parseFilter(buffered.substr(0, lineEnd));
+
+          const size_t consumed = lineEnd + 1;
+          std::memmove(subscriber.input.data(), subscriber.input.data() + consumed, subscriber.inputLength - consumed);
+          subscriber.inputLength -= consumed;
+        }
+      }
+    }
+
+    [[nodiscard]] static uint32_t parseFilter(std::string_view line) {
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+
+      if (line.empty() || line == "*") {
+        return ALL_METRICS;
+      }
+
+      uint32_t filter = 0;
+
+      while (!line.empty()) {
+        const size_t comma = line.find(',');
+        const std::string_view name = line.substr(0, comma);
+        line = comma == std::string_view::npos ? std::string_view{} : line.substr(comma + 1);
+
+        for (size_t i = 0; i < METRIC_COUNT; i++) {
+          if (METRICS[i].name == name) {
+            filter |= 1U << i;
+          }
+        }
+      }
+
+      return filter;
+    }
+
+    // Writes as much of the queue as the socket takes, then waits for EPOLLOUT if anything is left
+    void flush(Subscriber &subscriber) {
+      while (!subscriber.queue.empty()) {
+        std::array<iovec, MAX_IOV> iov{};
+        size_t iovCount = 0;
+
+        for (const Chunk &chunk : subscriber.queue) {
+          if (iovCount == iov.size()) {
+            break;
+          }
+
+          const size_t skip = iovCount == 0 ? subscriber.offset : 0;
+          iov[iovCount++] = {const_cast<char *>(chunk->data()) + skip, chunk->size() - skip};
+        }
+
+        const ssize_t written = ::writev(subscriber.fd, iov.data(), static_cast<int>(iovCount));
+
+        if (written < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+
+          if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!subscriber.writing) {
+              subscriber.writing = true;
+              this->rewatch(subscriber, EPOLLIN | EPOLLOUT);
+            }
+
+            return;
+          }
+
+          this->close(subscriber);
+          return;
+        }
+
+        this->_bytes.increment(static_cast<uint64_t>(written));
+        subscriber.queued -= static_cast<size_t>(written);
+
+        auto remaining = static_cast<size_t>(written);
+
+        while (remaining > 0) {
+          const size_t left = subscriber.queue.front()->size() - subscriber.offset;
+
+          if (remaining < left) {
+            subscriber.offset += remaining;
+            break;
+          }
+
+          remaining -= left;
+          subscriber.queue.pop_front();
+          subscriber.offset = 0;
+        }
+      }
+
+      if (subscriber.writing) {
+        subscriber.writing = false;
+        this->rewatch(subscriber, EPOLLIN);
+      }
+    }
+
+    void closeAll() noexcept {
+      for (auto &[fd, subscriber] : this->_subscribers) {
+        ::close(fd);
+      }
+
+      this->_subscribers.clear();
+      this->_closed.clear();
+      this->_subscriberCount.store(0, std::memory_order_relaxed);
+
+      for (int *fd : {&this->_listenFd, &this->_epollFd, &this->_wakeFd}) {
+        if (*fd >= 0) {
+          ::close(*fd);
+          *fd = -1;
+        }
+      }
+
+      if (!this->_path.empty()) {
+        ::unlink(this->_path.c_str());
+        this->_path.clear();
+      }
+    }
+  };
+} // namespace pubsub
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "exporters/history.hpp"
+#include "gorilla.hpp"
+#include "ring_store.hpp"
+#include "rollup.hpp"
+#include "sample.hpp"
+
+/**
+ * Implements `pisense query`: reads a time range straight out of the local history ring files, without going through
+ * a database. Output is streamed through a buffer so a large range costs one `fwrite` per 64 KiB rather than per row.
+ */
+namespace query {
+  enum class Format { Json, Csv, Binary };
+
+  struct Options {
+    std::string path;
+    std::optional<std::string> resolution; // Rollup label such as "1m", raw samples when unset
+    int64_t from{std::numeric_limits<int64_t>::min()};
+    int64_t to{std::numeric_limits<int64_t>::max()};
+    Format format{Format::Json};
+    std::vector<std::string> sources; // [I2C] instance names, by `Sample::source`
+  };
+
+  [[nodiscard]] inline std::optional<Format> toFormat(std::string_view format) {
+    if (format == "json") {
+      return Format::Json;
+    }
+
+    if (format == "csv") {
+      return Format::Csv;
+    }
+
+    if (format == "binary") {
+      return Format::Binary;
+    }
+
+    return std::nullopt;
+  }
+
+  /**
+   * Accepts "now", a duration before now such as "24h" (see `RollupConfig::toDuration`), or Unix time in seconds.
+   * Returns Unix time in nanoseconds.
+   */
+  [[nodiscard]] inline std::optional<int64_t> toTimestamp(std::string_view time, int64_t now) {
+    if (time == "now") {
+      return now;
+    }
+
+    if (const std::optional<int64_t> duration = RollupConfig::toDuration(time)) {
+      return now - *duration;
+    }
+
+    int64_t seconds = 0;
+    const auto [end, error] = std::from_chars(time.data(), time.data() + time.size(), seconds);
+
+    if (error != std::errc{} || end != time.data() + time.size()) {
+      return std::nullopt;
+    }
+
+    return seconds * 1'000'000'000LL;
+  }
+
+  class Output {
+  public:
+    explicit Output(std::FILE *file) :
+        _file(file) {
+      this->_buffer.reserve(Output::CAPACITY);
+    }
+
+    ~Output() { this->flush(); }
+
+    Output(const Output &) = delete;
+    Output &operator=(const Output &) = delete;
+
+    template <typename... Args>
+    void print(std::format_string<Args...> format, Args &&...args) {
+      std::format_to(std::back_inserter(this->_buffer), format, std::forward<Args>(args)...);
+      this->drain();
+    }
+
+    void raw(const void *data, size_t size) {
+      this->_buffer.append(static_cast<const char *>(data), size);
+      this->drain();
+    }
+
+    // JSON has no NaN or infinity, so those are written as null (or an empty CSV field)
+    void number(double value, std::string_view missing) {
+      if (std::isfinite(value)) {
+        this->print("{}", value);
+      } else {
+        this->_buffer += missing;
+      }
+    }
+
+    void flush() {
+      if (!this->_buffer.empty()) {
+        std::fwrite(this->_buffer.data(), 1, this->_buffer.size(), this->_file);
+        this->_buffer.clear();
+      }
+
+      std::fflush(this->_file);
+    }
+
+  private:
+    static constexpr size_t CAPACITY = 64 * 1024;
+
+    std::FILE *_file;
+    std::string _buffer;
+
+    void drain() {
+      if (this->_buffer.size() >= Output::CAPACITY) {
+        std::fwrite(this->_buffer.data(), 1, this->_buffer.size(), this->_file);
+        this->_buffer.clear();
+      }
+    }
+  };
+
+  inline void header(Output &out, Format format, bool rollup) {
+    if (format != Format::Csv) {
+      return;
+    }
+
+    out.print("timestamp");
+
+    if (!rollup) {
+      out.print(",source");
+    }
+
+    for (const MetricInfo &info : METRICS) {
+      if (rollup) {
+        out.print(",{0}_min,{0}_max,{0}_mean,{0}_last,{0}_count", info.name);
+      } else {
+        out.print(",{}", info.name);
+      }
+    }
+
+    out.print("\n");
+  }
+
+  // Recorded by a run with more instances than configured now, a source is only known by its index
+  [[nodiscard]] inline std::string sourceName(const Options &options, uint8_t source) {
+    return source < options.sources.size() ? options.sources[source] : std::to_string(source);
+  }
+
+  inline void write(Output &out, const Options &options, const Sample &sample) {
+    if (options.format == Format::Binary) {
+      out.raw(&sample, sizeof(Sample));
+      return;
+    }
+
+    if (options.format == Format::Csv) {
+      out.print("{},{}", sample.timestamp, sourceName(options, sample.source));
+
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        out.print(",");
+
+        if (sample.has(static_cast<Metric>(i))) {
+          out.number(sample.values[i], "");
+        }
+      }
+
+      out.print("\n");
+      return;
+    }
+
+    out.print("{{\"timestamp\":{},\"source\":\"{}\"", sample.timestamp, sourceName(options, sample.source));
+
+    sample.forEach([&](Metric metric, double value) {
+      out.print(",\"{}\":", metricInfo(metric).name);
+      out.number(value, "null");
+    });
+
+    out.print("}}\n");
+  }
+
+  inline void write(Output &out, const Options &options, const rollup::Bucket &bucket) {
+    if (options.format == Format::Binary) {
+      out.raw(&bucket, sizeof(rollup::Bucket));
+      return;
+    }
+
+    const bool csv = options.format == Format::Csv;
+
+    if (csv) {
+      out.print("{}", bucket.timestamp);
+    } else {
+      out.print("{{\"timestamp\":{}", bucket.timestamp);
+    }
+
+    for (size_t i = 0; i < METRIC_COUNT; i++) {
+      const auto metric = static_cast<Metric>(i);
+      const rollup::Aggregate &aggregate = bucket.get(metric);
+
+      if (csv) {
+        if (bucket.has(metric)) {
+          for (const double value : {aggregate.min, aggregate.max, aggregate.mean(), aggregate.last}) {
+            out.print(",");
+            out.number(value, "");
+          }
+
+          out.print(",{}", aggregate.count);
+        } else {
+          out.print(",,,,,");
+        }
+
+        continue;
+      }
+
+      if (!bucket.has(metric)) {
+        continue;
+      }
+
+      out.print(",\"{}\":{{\"min\":", metricInfo(metric).name);
+      out.number(aggregate.min, "null");
+      out.print(",\"max\":");
+      out.number(aggregate.max, "null");
+      out.print(",\"mean\":");
+      out.number(aggregate.mean(), "null");
+      out.print(",\"last\":");
+      out.number(aggregate.last, "null");
+      out.print(",\"count\":{}}}", aggregate.count);
+    }
+
+    if (csv) {
+      out.print("\n");
+    } else {
+      out.print("}}\n");
+    }
+  }
+
+  template <typename Record, typename... Codecs>
+  size_t stream(const std::string &path, const Options &options) {
+    const ring::Reader<Record, Codecs...> reader(path);
+    Output out(stdout);
+    size_t records = 0;
+
+    header(out, options.format, std::is_same_v<Record, rollup::Bucket>);
+
+    const size_t skipped = reader.read(options.from, options.to, [&](const Record &record) {
+      write(out, options, record);
+      records++;
+    });
+
+    if (skipped > 0) {
+      spdlog::warn("Skipped {} corrupt blocks in {}", skipped, path);
+    }
+
+    return records;
+  }
+
+  inline int run(const Options &options) {
+    try {
+      [[maybe_unused]] const auto start = std::chrono::steady_clock::now();
+      [[maybe_unused]] size_t records = 0;
+
+      if (options.resolution) {
+        const std::string path = history::Sink::rollupPath(options.path, *options.resolution);
+        records = stream<rollup::Bucket, ring::RawCodec<rollup::Bucket>>(path, options);
+      } else {
+        records = stream<Sample, ring::RawCodec<Sample>, gorilla::SampleCodec, gorilla::LegacySampleCodec>(
+            options.path, options);
+      }
+
+      SPDLOG_DEBUG("Queried {} records in {}",
+                   records,
+                   std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+    } catch (const std::runtime_error &) {
+      // Already logged where it was thrown
+      return 1;
+    }
+
+    return 0;
+  }
+} // namespace query
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <type_traits>
+
+namespace i2c {
+  enum class Access : uint8_t { Read, Write, ReadWrite };
+
+  /**
+   * Compile-time description of a device register: where it starts, how many bytes it spans (from its value type) and
+   * in which order, and whether it can be read or written. Devices that need a flag in the register address to
+   * auto-increment through multi-byte reads pass it as AutoIncrement.
+   */
+  template <uint8_t Address,
+            std::integral T = uint8_t,
+            Access Mode = Access::Read,
+            std::endian Order = std::endian::little,
+            uint8_t AutoIncrement = 0x00>
+  struct Register {
+    using type = T;
+
+    static constexpr uint8_t ADDRESS = Address;
+    static constexpr size_t WIDTH = sizeof(T);
+    static constexpr Access ACCESS = Mode;
+    static constexpr std::endian ORDER = Order;
+    static constexpr uint8_t AUTO_INCREMENT = AutoIncrement;
+
+    static_assert(Address + WIDTH <= 0x100, "Register runs past the end of the address space");
+
+    [[nodiscard]] static constexpr T decode(std::span<const uint8_t, WIDTH> bytes) noexcept {
+      std::make_unsigned_t<T> value = 0;
+
+      for (size_t i = 0; i < WIDTH; i++) {
+        const size_t shift = Order == std::endian::little ? i : WIDTH - 1 - i;
+        value |= static_cast<std::make_unsigned_t<T>>(static_cast<std::make_unsigned_t<T>>(bytes[i]) << (shift * 8));
+      }
+
+      return std::bit_cast<T>(value);
+    }
+  };
+
+  // A bitfield of a single-byte register, holding the value to write to it already shifted into place
+  template <typename Reg, uint8_t Shift, uint8_t Width>
+  struct Field {
+    using Register = Reg;
+
+    static_assert(Reg::WIDTH == 1 && Shift + Width <= 8, "Fields must fit in a single-byte register");
+
+    static constexpr uint8_t MASK = static_cast<uint8_t>(((1U << Width) - 1) << Shift);
+
+    uint8_t bits;
+
+    constexpr explicit Field(unsigned value) :
+        bits(static_cast<uint8_t>((value << Shift) & MASK)) {}
+  };
+
+  /**
+   * The transactions a read of several registers turns into: every run of contiguous bytes is read in one burst, worked
+   * out at compile time so the read itself is just a fixed sequence of transfers into one buffer.
+   */
+  template <typename... Regs>
+  struct ReadPlan {
+    static_assert(sizeof...(Regs) > 0, "Nothing to read");
+    static_assert(((Regs::ACCESS != Access::Write) && ...), "Write-only registers can't be read");
+    static_assert(((Regs::AUTO_INCREMENT == std::get<0>(std::tuple{Regs::AUTO_INCREMENT...})) && ...),
+                  "Registers read together must belong to the same device");
+
+    struct Burst {
+      uint8_t address;
+      uint8_t length;
+    };
+
+    static constexpr uint8_t BASE = std::min({Regs::ADDRESS...});
+    static constexpr size_t SIZE = std::max({Regs::ADDRESS + Regs::WIDTH...}) - BASE;
+    static constexpr uint8_t AUTO_INCREMENT = std::get<0>(std::tuple{Regs::AUTO_INCREMENT...});
+
+    template <typename Reg>
+    static constexpr size_t offset() noexcept {
+      return Reg::ADDRESS - BASE;
+    }
+
+    static constexpr std::array<bool, SIZE> covered() noexcept {
+      std::array<bool, SIZE> covered{};
+      ((std::fill_n(covered.begin() + offset<Regs>(), Regs::WIDTH, true)), ...);
+      return covered;
+    }
+
+    static constexpr size_t count() noexcept {
+      const std::array<bool, SIZE> bytes = covered();
+      size_t count = 0;
+
+      for (size_t i = 0; i < SIZE; i++) {
+        count += bytes[i] && (i == 0 || !bytes[i - 1]) ? 1 : 0;
+      }
+
+      return count;
+    }
+
+    static constexpr std::array<Burst, count()> BURSTS = [] {
+      const std::array<bool, SIZE> bytes = covered();
+      std::array<Burst, count()> bursts{};
+      size_t burst = 0;
+
+      for (size_t i = 0; i < SIZE; i++) {
+        if (!bytes[i]) {
+          continue;
+        }
+
+        if (i == 0 || !bytes[i - 1]) {
+          bursts[burst++] = {.address = static_cast<uint8_t>(BASE + i), .length = 0};
+        }
+
+        bursts[burst - 1].length++;
+      }
+
+      return bursts;
+    }();
+  };
+} // namespace i2c
@@ -0,0 +1,525 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "crc32.hpp"
+
+namespace ring {
+  constexpr uint64_t MAGIC = 0x474E495245534950; // "PISERING" in little endian
+  constexpr uint32_t VERSION = 2;
+  constexpr size_t BLOCK_SIZE = 4096;
+
+  struct FileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint64_t head; // Sequence of the block currently being written
+    uint64_t tail; // Sequence of the oldest block still in the file
+  };
+
+  // Gorilla blocks are from before compressed rows carried the sample's source, GorillaSources ones carry it
+  enum class Encoding : uint16_t { Raw, Gorilla, GorillaSources };
+
+  /**
+   * Sequences start at 1 so zero-filled slots are never mistaken for data. `count`, `length` and `checksum` are only
+   * ever updated together when a block is committed; records appended after that sit past `length` until the next
+   * commit, so a block written back by the kernel at any point still validates with its last committed contents.
+   */
+  struct BlockHeader {
+    uint64_t sequence{0};
+    int64_t firstTimestamp{0};
+    int64_t lastTimestamp{0};
+    uint32_t count{0};
+    Encoding encoding{Encoding::Raw};
+    uint16_t reserved{0};
+    uint32_t length{0}; // Committed payload size in bits
+    uint32_t checksum{0};
+  };
+
+  constexpr size_t PAYLOAD_SIZE = BLOCK_SIZE - sizeof(BlockHeader);
+
+  static_assert(sizeof(FileHeader) <= BLOCK_SIZE);
+  static_assert(sizeof(BlockHeader) % 8 == 0);
+
+  // Covers the header fields before `checksum` and the committed payload bits, masking off any uncommitted ones
+  [[nodiscard]] inline uint32_t checksum(const BlockHeader *block) {
+    const auto *bytes = reinterpret_cast<const std::byte *>(block);
+    const std::byte *payload = bytes + sizeof(BlockHeader);
+    const size_t whole = block->length / 8;
+    const size_t partial = block->length % 8;
+
+    uint32_t crc = crc32::update(0, {bytes, offsetof(BlockHeader, checksum)});
+    crc = crc32::update(crc, {payload, whole});
+
+    if (partial != 0) {
+      const std::byte last = payload[whole] & static_cast<std::byte>(0xFF << (8 - partial));
+      crc = crc32::update(crc, {&last, 1});
+    }
+
+    return crc;
+  }
+
+  [[nodiscard]] inline bool valid(const BlockHeader *block) {
+    return block->sequence != 0 && block->length <= PAYLOAD_SIZE * 8 && block->checksum == checksum(block);
+  }
+
+  // Stores records as-is, for record types without a dedicated compressed codec
+  template <typename Record>
+  class RawCodec {
+  public:
+    static constexpr Encoding ENCODING = Encoding::Raw;
+
+    void reset(std::span<std::byte> payload) {
+      this->_payload = payload;
+      this->_count = 0;
+    }
+
+    void resume(std::span<std::byte> payload, const BlockHeader &block) {
+      this->_payload = payload;
+      this->_count = block.count;
+    }
+
+    bool append(const Record &record) {
+      if ((this->_count + 1) * sizeof(Record) > this->_payload.size()) {
+        return false;
+      }
+
+      std::memcpy(this->_payload.data() + (this->_count * sizeof(Record)), &record, sizeof(Record));
+      this->_count++;
+
+      return true;
+    }
+
+    [[nodiscard]] uint32_t count() const { return this->_count; }
+    [[nodiscard]] size_t bits() const { return this->_count * sizeof(Record) * 8; }
+
+    template <typename Fn>
+    static void decode(std::span<const std::byte> payload, const BlockHeader &block, Fn &&fn) {
+      for (uint32_t i = 0; i < block.count; i++) {
+        Record record;
+        std::memcpy(&record, payload.data() + (i * sizeof(Record)), sizeof(Record));
+        fn(record);
+      }
+    }
+
+  private:
+    std::span<std::byte> _payload;
+    uint32_t _count{0};
+  };
+
+  /**
+   * Fixed-size, memory-mapped circular file of records grouped into checksummed blocks, each encoded by `Codec`.
+   * Appending is a plain store into the mapping; durability is batched into `sync()`, which commits the open block and
+   * `msync`s everything dirtied since the previous sync. On open, every block is validated and writing resumes after
+   * the newest intact one, so a power cut costs at most the records appended since the last sync.
+   */
+  template <typename Record, typename Codec = RawCodec<Record>>
+  class Store {
+    static_assert(std::is_trivially_copyable_v<Record>);
+
+  public:
+    Store(const std::string &path, size_t sizeBytes) :
+        _path(path), _blockCount(static_cast<uint32_t>(std::max<size_t>(sizeBytes / BLOCK_SIZE, 2) - 1)) {
+      this->_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+      if (this->_fd < 0) {
+        spdlog::error("Failed to open ring store {}: {}", path, strerror(errno));
+        throw std::runtime_error("Failed to open ring store");
+      }
+
+      struct stat info{};
+      ::fstat(this->_fd, &info);
+
+      this->_mapSize = BLOCK_SIZE * (static_cast<size_t>(this->_blockCount) + 1);
+      const bool fresh = info.st_size == 0;
+
+      if (!fresh && static_cast<size_t>(info.st_size) != this->_mapSize) {
+        ::close(this->_fd);
+        spdlog::error("Ring store {} is {} bytes but {} are configured; move it aside to change its size",
+                      path,
+                      info.st_size,
+                      this->_mapSize);
+        throw std::runtime_error("Ring store size mismatch");
+      }
+
+      // Reserve the blocks up front so running out of space surfaces here rather than as SIGBUS mid-write
+      if (fresh && ::posix_fallocate(this->_fd, 0, static_cast<off_t>(this->_mapSize)) != 0) {
+        ::close(this->_fd);
+        spdlog::error("Failed to allocate {} bytes for ring store {}", this->_mapSize, path);
+        throw std::runtime_error("Failed to allocate ring store");
+      }
+
+      void *map = ::mmap(nullptr, this->_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->_fd, 0);
+
+      if (map == MAP_FAILED) {
+        ::close(this->_fd);
+        spdlog::error("Failed to map ring store {}: {}", path, strerror(errno));
+        throw std::runtime_error("Failed to map ring store");
+      }
+
+      this->_map = static_cast<std::byte *>(map);
+      this->_header = reinterpret_cast<FileHeader *>(this->_map);
+
+      if (fresh) {
+        this->initialize();
+      } else {
+        this->recover();
+      }
+
+      this->_pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+      this->_dirtyFrom = this->_header->head;
+    }
+
+    ~Store() noexcept {
+      if (this->_map != nullptr) {
+        this->sync();
+        ::munmap(this->_map, this->_mapSize);
+      }
+
+      if (this->_fd >= 0) {
+        ::close(this->_fd);
+      }
+    }
+
+    Store(const Store &) = delete;
+    Store &operator=(const Store &) = delete;
+
+    void append(const Record &record) {
+      if (this->_codec.count() == 0) {
+        this->_first = record.timestamp;
+      }
+
+      if (!this->_codec.append(record)) {
+        this->commit();
+        this->advance();
+        this->_first = record.timestamp;
+        this->_codec.append(record);
+      }
+
+      this->_last = record.timestamp;
+    }
+
+    // Commits the open block and flushes every block touched since the previous sync
+    void sync() noexcept {
+      this->commit();
+
+      const uint64_t head = this->_header->head;
+
+      if (head - this->_dirtyFrom >= this->_blockCount) {
+        this->flush(0, this->_mapSize);
+      } else {
+        const size_t from = this->offset(this->_dirtyFrom);
+        const size_t to = this->offset(head) + BLOCK_SIZE;
+
+        if (from < to) {
+          this->flush(from, to);
+        } else {
+          this->flush(from, this->_mapSize);
+          this->flush(BLOCK_SIZE, to);
+        }
+      }
+
+      this->flush(0, BLOCK_SIZE);
+      this->_dirtyFrom = head;
+    }
+
+    [[nodiscard]] const FileHeader &header() const { return *this->_header; }
+
+  private:
+    std::string _path;
+    uint32_t _blockCount;
+    int _fd{-1};
+    std::byte *_map{nullptr};
+    size_t _mapSize{0};
+    size_t _pageSize{BLOCK_SIZE};
+    FileHeader *_header{nullptr};
+    Codec _codec;
+    int64_t _first{0};
+    int64_t _last{0};
+    uint64_t _dirtyFrom{1};
+
+    [[nodiscard]] size_t offset(uint64_t sequence) const {
+      return BLOCK_SIZE * (1 + ((sequence - 1) % this->_blockCount));
+    }
+
+    [[nodiscard]] BlockHeader *block(uint64_t sequence) const {
+      return reinterpret_cast<BlockHeader *>(this->_map + this->offset(sequence));
+    }
+
+    [[nodiscard]] static std::span<std::byte> payload(BlockHeader *block) {
+      return {reinterpret_cast<std::byte *>(block) + sizeof(BlockHeader), PAYLOAD_SIZE};
+    }
+
+    void commit() {
+      BlockHeader *block = this->block(this->_header->head);
+
+      if (this->_codec.count() > 0) {
+        block->firstTimestamp = this->_first;
+        block->lastTimestamp = this->_last;
+      }
+
+      block->count = this->_codec.count();
+      block->length = static_cast<uint32_t>(this->_codec.bits());
+      block->checksum = checksum(block);
+    }
+
+    void advance() {
+      const uint64_t sequence = this->_header->head + 1;
+
+      BlockHeader *block = this->block(sequence);
+      *block = BlockHeader{.sequence = sequence, .encoding = Codec::ENCODING};
+
+      const std::span<std::byte> payload = Store::payload(block);
+      std::ranges::fill(payload, std::byte{0});
+      this->_codec.reset(payload);
+
+      this->_header->head = sequence;
+
+      if (sequence - this->_header->tail >= this->_blockCount) {
+        this->_header->tail = sequence - this->_blockCount + 1;
+      }
+
+      this->commit();
+    }
+
+    void flush(size_t from, size_t to) const noexcept {
+      const size_t aligned = from - (from % this->_pageSize);
+
+      if (::msync(this->_map + aligned, to - aligned, MS_SYNC) < 0) {
+        spdlog::error("Failed to sync ring store {}: {}", this->_path, strerror(errno));
+      }
+    }
+
+    void initialize() {
+      *this->_header = FileHeader{
+          .magic = MAGIC,
+          .version = VERSION,
+          .recordSize = sizeof(Record),
+          .blockSize = BLOCK_SIZE,
+          .blockCount = this->_blockCount,
+          .head = 0,
+          .tail = 1,
+      };
+
+      this->advance();
+
+      spdlog::info("Created ring store {} with {} blocks", this->_path, this->_blockCount);
+    }
+
+    // The header's head/tail may be stale after a crash, so the blocks themselves are the source of truth
+    void recover() {
+      const FileHeader &header = *this->_header;
+
+      if (header.magic != MAGIC || header.version != VERSION || header.recordSize != sizeof(Record) ||
+          header.blockSize != BLOCK_SIZE || header.blockCount != this->_blockCount) {
+        ::munmap(this->_map, this->_mapSize);
+        ::close(this->_fd);
+        this->_map = nullptr;
+        this->_fd = -1;
+        spdlog::error("Ring store {} has an incompatible layout; move it aside to start a new one", this->_path);
+        throw std::runtime_error("Incompatible ring store");
+      }
+
+      uint64_t newest = 0;
+      uint64_t oldest = UINT64_MAX;
+      size_t corrupt = 0;
+
+      for (uint64_t slot = 1; slot <= this->_blockCount; slot++) {
+        const BlockHeader *block = this->block(slot);
+
+        if (block->sequence == 0) {
+          continue;
+        }
+
+        if (this->offset(block->sequence) != this->offset(slot) || !valid(block)) {
+          corrupt++;
+          continue;
+        }
+
+        newest = std::max(newest, block->sequence);
+        oldest = std::min(oldest, block->sequence);
+      }
+
+      if (newest == 0) {
+        spdlog::warn("Ring store {} has no intact blocks, starting over", this->_path);
+        this->initialize();
+        return;
+      }
+
+      this->_header->head = newest;
+      this->_header->tail = std::max(oldest, newest >= this->_blockCount ? newest - this->_blockCount + 1 : 1);
+
+      BlockHeader *block = this->block(newest);
+
+      // A block written with a different codec (e.g. compression was just switched on) is left as is
+      if (block->encoding == Codec::ENCODING) {
+        this->_codec.resume(Store::payload(block), *block);
+        this->_first = block->firstTimestamp;
+        this->_last = block->lastTimestamp;
+      } else {
+        this->advance();
+      }
+
+      spdlog::info("Recovered ring store {}: blocks {}..{}, {} corrupt blocks skipped",
+                   this->_path,
+                   this->_header->tail,
+                   newest,
+                   corrupt);
+    }
+  };
+
+  /**
+   * Read-only view of a ring file written by `Store`, safe to open while the store is appending to it. Blocks are
+   * written in timestamp order, so their headers double as a sparse index: a time range is located by binary search
+   * over them and a query only touches a logarithmic number of headers plus the blocks it actually returns, however
+   * large the file is. Each block is decoded by whichever of `Codecs` matches its encoding.
+   */
+  template <typename Record, typename... Codecs>
+  class Reader {
+    static_assert(sizeof...(Codecs) > 0);
+
+  public:
+    explicit Reader(const std::string &path) :
+        _path(path) {
+      this->_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+      if (this->_fd < 0) {
+        spdlog::error("Failed to open ring store {}: {}", path, strerror(errno));
+        throw std::runtime_error("Failed to open ring store");
+      }
+
+      struct stat info{};
+      ::fstat(this->_fd, &info);
+      this->_mapSize = static_cast<size_t>(info.st_size);
+
+      if (this->_mapSize < BLOCK_SIZE * 2) {
+        ::close(this->_fd);
+        spdlog::error("Ring store {} is too small to contain any blocks", path);
+        throw std::runtime_error("Incompatible ring store");
+      }
+
+      void *map = ::mmap(nullptr, this->_mapSize, PROT_READ, MAP_SHARED, this->_fd, 0);
+
+      if (map == MAP_FAILED) {
+        ::close(this->_fd);
+        spdlog::error("Failed to map ring store {}: {}", path, strerror(errno));
+        throw std::runtime_error("Failed to map ring store");
+      }
+
+      this->_map = static_cast<const std::byte *>(map);
+      this->_header = reinterpret_cast<const FileHeader *>(this->_map);
+
+      if (this->_header->magic != MAGIC || this->_header->version != VERSION ||
+          this->_header->recordSize != sizeof(Record) || this->_header->blockSize != BLOCK_SIZE ||
+          this->_mapSize != BLOCK_SIZE * (static_cast<size_t>(this->_header->blockCount) + 1)) {
+        ::munmap(const_cast<std::byte *>(this->_map), this->_mapSize);
+        ::close(this->_fd);
+        spdlog::error("Ring store {} has an incompatible layout", path);
+        throw std::runtime_error("Incompatible ring store");
+      }
+    }
+
+    ~Reader() noexcept {
+      ::munmap(const_cast<std::byte *>(this->_map), this->_mapSize);
+      ::close(this->_fd);
+    }
+
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    /**
+     * Calls `fn(record)` for every record with a timestamp in [from, to], oldest first, and returns how many blocks
+     * were skipped because they failed validation.
+     */
+    template <typename Fn>
+    size_t read(int64_t from, int64_t to, Fn &&fn) const {
+      const uint64_t head = this->_header->head;
+      uint64_t low = this->_header->tail;
+      uint64_t high = head;
+      size_t skipped = 0;
+
+      // First block that may hold a record at or after `from`; slots already overwritten by the writer sort first
+      while (low < high) {
+        const uint64_t middle = low + ((high - low) / 2);
+        const BlockHeader *block = this->block(middle);
+
+        if (block->sequence != middle || block->lastTimestamp < from) {
+          low = middle + 1;
+        } else {
+          high = middle;
+        }
+      }
+
+      for (uint64_t sequence = low; sequence != 0 && sequence <= head; sequence++) {
+        const BlockHeader *block = this->block(sequence);
+        const BlockHeader snapshot = *block;
+
+        // The writer may commit the block while it's being checked; its committed payload bits never change though,
+        // so a header copy that validated and is still current describes a consistent prefix of the block
+        if (snapshot.sequence != sequence || !valid(block) || std::memcmp(&snapshot, block, sizeof(BlockHeader)) != 0) {
+          skipped++;
+          continue;
+        }
+
+        if (snapshot.count == 0) {
+          continue;
+        }
+
+        if (snapshot.firstTimestamp > to) {
+          break;
+        }
+
+        const auto emit = [&](const Record &record) {
+          if (record.timestamp >= from && record.timestamp <= to) {
+            fn(record);
+          }
+        };
+
+        if (!Reader::decode(this->payload(block), snapshot, emit)) {
+          skipped++;
+        }
+      }
+
+      return skipped;
+    }
+
+    [[nodiscard]] const FileHeader &header() const { return *this->_header; }
+
+  private:
+    std::string _path;
+    int _fd{-1};
+    const std::byte *_map{nullptr};
+    size_t _mapSize{0};
+    const FileHeader *_header{nullptr};
+
+    [[nodiscard]] const BlockHeader *block(uint64_t sequence) const {
+      return reinterpret_cast<const BlockHeader *>(
+          this->_map + (BLOCK_SIZE * (1 + ((sequence - 1) % this->_header->blockCount))));
+    }
+
+    [[nodiscard]] static std::span<const std::byte> payload(const BlockHeader *block) {
+      return {reinterpret_cast<const std::byte *>(block) + sizeof(BlockHeader), PAYLOAD_SIZE};
+    }
+
+    template <typename Fn>
+    static bool decode(std::span<const std::byte> payload, const BlockHeader &block, const Fn &fn) {
+      return ((block.encoding == Codecs::ENCODING && (Codecs::decode(payload, block, fn), true)) || ...);
+    }
+  };
+} // namespace ring
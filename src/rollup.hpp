@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sample.hpp"
+
+namespace rollup {
+  struct Aggregate {
+    double min{std::numeric_limits<double>::infinity()};
+    double max{-std::numeric_limits<double>::infinity()};
+    double sum{0.0};
+    double last{0.0};
+    uint64_t count{0};
+
+    void add(double value) {
+      this->min = std::min(this->min, value);
+      this->max = std::max(this->max, value);
+      this->sum += value;
+      this->last = value;
+      this->count++;
+    }
+
+    void merge(const Aggregate &other) {
+      if (other.count == 0) {
+        return;
+      }
+
+      this->min = std::min(this->min, other.min);
+      this->max = std::max(this->max, other.max);
+      this->sum += other.sum;
+      this->last = other.last;
+      this->count += other.count;
+    }
+
+    [[nodiscard]] double mean() const { return this->sum / static_cast<double>(this->count); }
+  };
+
+  /**
+   * Aggregates of every metric over one aligned time window. Buckets are mergeable, so two buckets for the same
+   * window (e.g. a partial one flushed on shutdown and the rest after a restart) can simply be combined.
+   */
+  struct Bucket {
+    int64_t timestamp{0}; // Start of the window, Unix time in nanoseconds
+    std::array<Aggregate, METRIC_COUNT> metrics{};
+
+    [[nodiscard]] bool has(Metric metric) const { return this->metrics[static_cast<size_t>(metric)].count > 0; }
+
+    [[nodiscard]] const Aggregate &get(Metric metric) const { return this->metrics[static_cast<size_t>(metric)]; }
+
+    void merge(const Bucket &other) {
+      for (size_t i = 0; i < METRIC_COUNT; i++) {
+        this->metrics[i].merge(other.metrics[i]);
+      }
+    }
+  };
+
+  struct Resolution {
+    int64_t nanoseconds;
+    std::string label; // e.g. "1m", used to name the tables and files buckets are stored in
+  };
+
+  /**
+   * Maintains one open bucket per resolution. Samples only ever touch the finest bucket; when it closes it is merged
+   * into the next coarser one, and so on, so the cost per sample is constant no matter how many resolutions there are.
+   */
+  class Engine {
+  public:
+    explicit Engine(std::vector<Resolution> resolutions) {
+      std::ranges::sort(resolutions, {}, &Resolution::nanoseconds);
+
+      for (Resolution &resolution : resolutions) {
+        this->_levels.push_back({std::move(resolution), Bucket{}, false});
+      }
+    }
+
+    [[nodiscard]] size_t size() const { return this->_levels.size(); }
+
+    [[nodiscard]] const Resolution &resolution(size_t level) const { return this->_levels[level].resolution; }
+
+    // Calls `finished(level, bucket)` for every bucket the sample closes
+    template <typename Fn>
+    void add(const Sample &sample, Fn &&finished) {
+      if (this->_levels.empty()) {
+        return;
+      }
+
+      this->roll(0, sample.timestamp, finished);
+
+      Bucket &bucket = this->_levels[0].bucket;
+      sample.forEach([&](Metric metric, double value) { bucket.metrics[static_cast<size_t>(metric)].add(value); });
+    }
+
+    // Closes every open bucket, finest first, so partial windows aren't lost on shutdown
+    template <typename Fn>
+    void flush(Fn &&finished) {
+      for (size_t i = 0; i < this->_levels.size(); i++) {
+        Level &level = this->_levels[i];
+
+        if (!level.open) {
+          continue;
+        }
+
+        finished(i, level.bucket);
+        this->propagate(i, finished);
+        level.open = false;
+      }
+    }
+
+  private:
+    struct Level {
+      Resolution resolution;
+      Bucket bucket;
+      bool open;
+    };
+
+    std::vector<Level> _levels;
+
+    template <typename Fn>
+    void roll(size_t index, int64_t timestamp, Fn &finished) {
+      Level &level = this->_levels[index];
+      const int64_t remainder = timestamp % level.resolution.nanoseconds;
+      const int64_t start = timestamp - (remainder < 0 ? remainder + level.resolution.nanoseconds : remainder);
+
+      if (level.open && level.bucket.timestamp == start) {
+        return;
+      }
+
+      // Workers of different buses publish independently, so a sample stamped before the window turned can arrive
+      // after one from the next window, as can one read across a clock step. It's folded into the open bucket however
+      // late it is, since reopening its own would write buckets out of order and break lookups by time
+      if (level.open && start < level.bucket.timestamp) {
+        return;
+      }
+
+      if (level.open) {
+        finished(index, level.bucket);
+        this->propagate(index, finished);
+      }
+
+      level.bucket = Bucket{.timestamp = start};
+      level.open = true;
+    }
+
+    template <typename Fn>
+    void propagate(size_t index, Fn &finished) {
+      if (index + 1 >= this->_levels.size()) {
+        return;
+      }
+
+      const Bucket &bucket = this->_levels[index].bucket;
+
+      this->roll(index + 1, bucket.timestamp, finished);
+      this->_levels[index + 1].bucket.merge(bucket);
+    }
+  };
+} // namespace rollup
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+enum class Metric : uint8_t {
+  TemperatureCelsius,
+  TemperatureFahrenheit,
+  Humidity,
+};
+
+constexpr size_t METRIC_COUNT = 3;
+
+struct MetricInfo {
+  std::string_view name;
+  std::string_view help;
+};
+
+constexpr std::array<MetricInfo, METRIC_COUNT> METRICS{{
+    {"temperature_celsius", "Ambient temperature in degrees Celsius"},
+    {"temperature_fahrenheit", "Ambient temperature in degrees Fahrenheit"},
+    {"humidity", "Relative humidity in percent"},
+}};
+
+[[nodiscard]] constexpr const MetricInfo &metricInfo(Metric metric) {
+  return METRICS[static_cast<size_t>(metric)];
+}
+
+// Sets of metrics are masks with one bit per metric, the same as `Sample::present`
+[[nodiscard]] constexpr uint32_t metricBit(Metric metric) {
+  return 1U << static_cast<uint32_t>(metric);
+}
+
+constexpr uint32_t ALL_METRICS = (1U << METRIC_COUNT) - 1;
+
+// Both come from the same temperature reading
+constexpr uint32_t TEMPERATURE_METRICS = metricBit(Metric::TemperatureCelsius) |
+                                         metricBit(Metric::TemperatureFahrenheit);
+
+/**
+ * One acquisition of every metric read during a tick. Only metrics that were actually read are flagged as present so
+ * sinks can skip the rest.
+ */
+struct Sample {
+  int64_t timestamp{0}; // Unix time in nanoseconds
+  std::array<double, METRIC_COUNT> values{};
+  uint32_t present{0};
+  uint8_t source{0}; // Index of the acquisition instance that read it, see [I2C] Instances
+
+  void set(Metric metric, double value) {
+    this->values[static_cast<size_t>(metric)] = value;
+    this->present |= 1U << static_cast<uint32_t>(metric);
+  }
+
+  void clear(Metric metric) { this->present &= ~(1U << static_cast<uint32_t>(metric)); }
+
+  [[nodiscard]] bool has(Metric metric) const { return (this->present & (1U << static_cast<uint32_t>(metric))) != 0; }
+
+  [[nodiscard]] double get(Metric metric) const { return this->values[static_cast<size_t>(metric)]; }
+
+  template <typename Fn>
+  void forEach(Fn &&fn) const {
+    for (size_t i = 0; i < METRIC_COUNT; i++) {
+      if ((this->present & (1U << i)) != 0) {
+        fn(static_cast<Metric>(i), this->values[i]);
+      }
+    }
+  }
+};
+
+// Samples are stored and spooled as raw bytes. Source sits in what used to be tail padding, so existing files still
+// read
+static_assert(sizeof(Sample) == 40);
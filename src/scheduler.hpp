@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "acquisition.hpp"
+#include "config.hpp"
+#include "control.hpp"
+#include "exporter.hpp"
+#include "i2c.hpp"
+#include "telemetry.hpp"
+#include "timer.hpp"
+
+/**
+ * Drives every board on one I2C adapter from a single worker thread; separate adapters get separate schedulers and run
+ * in parallel. Boards behind a mux are ticked grouped by channel, starting with the channel the mux was left on, so a
+ * tick writes the mux control byte once per channel it moves to rather than once per read.
+ */
+class Scheduler {
+public:
+  // Sources are indexes into the config's I2C instances, all on the same bus; the first one's adapter settings apply
+  Scheduler(const Config &config, const std::vector<uint8_t> &sources, telemetry::Registry &registry) :
+      _bus(config.I2C[sources.front()], registry), _timer([this] { this->tick(); }, config.App.PollingIntervalMs) {
+    for (const uint8_t source : sources) {
+      this->_acquisitions.push_back(
+          std::make_unique<Acquisition>(config, config.I2C[source], source, this->_bus, registry));
+    }
+
+    std::ranges::stable_sort(this->_acquisitions, {}, [](const std::unique_ptr<Acquisition> &acquisition) {
+      return acquisition->channel();
+    });
+
+    if (const I2cConfig &i2c = config.I2C[sources.front()]; i2c.MuxAddress != 0) {
+      registry.gauge(
+          "pisense_i2c_mux_switches_per_tick",
+          "I2C mux channel switches during the last tick",
+          [this] { return static_cast<double>(this->_lastSwitches.load(std::memory_order_relaxed)); },
+          telemetry::label("adapter", i2c.Bus));
+    }
+  }
+
+  ~Scheduler() { this->stop(); }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  // The exporter and cache have to outlive the worker, so stop() comes before they are torn down
+  void start(Exporter *exporter, control::Cache *cache, uint32_t metrics) {
+    for (const std::unique_ptr<Acquisition> &acquisition : this->_acquisitions) {
+      acquisition->attach(exporter, cache);
+    }
+
+    this->activate(metrics);
+    this->_timer.start();
+  }
+
+  // Powers up the sensors that any of the metrics come from, nothing is read before
+  void activate(uint32_t metrics) {
+    for (const std::unique_ptr<Acquisition> &acquisition : this->_acquisitions) {
+      acquisition->activate(metrics);
+    }
+  }
+
+  void stop() { this->_timer.stop(); }
+
+  void testHardware() const {
+    for (const std::unique_ptr<Acquisition> &acquisition : this->_acquisitions) {
+      acquisition->testHardware();
+    }
+  }
+
+  void printStats() const {
+    for (const std::unique_ptr<Acquisition> &acquisition : this->_acquisitions) {
+      acquisition->printStats();
+    }
+  }
+
+  void tick() {
+    const size_t count = this->_acquisitions.size();
+    const size_t first = this->firstGroup();
+    const uint64_t switches = this->_bus.muxSwitches();
+
+    for (size_t i = 0; i < count; i++) {
+      this->_acquisitions[(first + i) % count]->tick();
+    }
+
+    this->_lastSwitches.store(this->_bus.muxSwitches() - switches, std::memory_order_relaxed);
+  }
+
+private:
+  i2c::Bus _bus;
+  std::vector<std::unique_ptr<Acquisition>> _acquisitions;
+  std::atomic<uint64_t> _lastSwitches{0};
+  Timer _timer;
+
+  // Starting where the last tick left the mux saves switching back to the first channel every time
+  [[nodiscard]] size_t firstGroup() const {
+    const std::optional<uint8_t> channel = this->_bus.channel();
+
+    if (!channel) {
+      return 0;
+    }
+
+    const auto group = std::ranges::find(this->_acquisitions,
+                                         channel,
+                                         [](const std::unique_ptr<Acquisition> &acquisition) {
+                                           return acquisition->channel();
+                                         });
+
+    return group == this->_acquisitions.end() ? 0 : static_cast<size_t>(group - this->_acquisitions.begin());
+  }
+};
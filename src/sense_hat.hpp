@@ -1,38 +1,79 @@
 #pragma once
 
 #include <algorithm>
+#include <cerrno>
 #include <cstdint>
+#include <cstring>
+#include <expected>
 #include <format>
+#include <mutex>
+#include <optional>
 #include <string_view>
 
 #include "components/hts221.hpp"
 #include "components/lps25hb.hpp"
 #include "components/lsm9ds1.hpp"
+#include "config.hpp"
 #include "i2c.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+#include "timestamp.hpp"
 
 namespace {
+  // Loggers take the format string and arguments rather than a finished message, so a message that isn't going to be
+  // logged is never formatted
   struct DefaultLogger {
-    static void trace(std::string_view msg) {}
-    static void debug(std::string_view msg) {}
-    static void info(std::string_view msg) {}
-    static void warn(std::string_view msg) {}
-    static void error(std::string_view msg) {}
-    static void critical(std::string_view msg) {}
+    template <typename... Args>
+    static void trace(std::format_string<Args...> format, Args &&...args) {}
+    template <typename... Args>
+    static void debug(std::format_string<Args...> format, Args &&...args) {}
+    template <typename... Args>
+    static void info(std::format_string<Args...> format, Args &&...args) {}
+    template <typename... Args>
+    static void warn(std::format_string<Args...> format, Args &&...args) {}
+    template <typename... Args>
+    static void error(std::format_string<Args...> format, Args &&...args) {}
+    template <typename... Args>
+    static void critical(std::format_string<Args...> format, Args &&...args) {}
   };
 } // namespace
 
 template <typename Logger = DefaultLogger>
 class SenseHat {
 public:
-  explicit SenseHat(Logger logger = Logger{}) :
-      _logger(logger),
-      _bus("/dev/i2c-1"),
-      _humiditySensor(this->_bus, "Humidity Sensor", hts221::ADDRESS),
-      _pressureSensor(this->_bus, "Pressure Sensor", lps25hb::ADDRESS),
-      _magSensor(this->_bus, "Magnetometer Sensor", lsm9ds1::mag::ADDRESS),
-      _gyroAccelSensor(this->_bus, "Gyroscope/Accelerometer Sensor", lsm9ds1::gyro::ADDRESS) {
-    // TODO: Replace 0x85 with its constituant flags
-    this->_humiditySensor.writeByte(hts221::reg::CTRL_REG1, 0x85);
+  static constexpr uint8_t ODR = hts221::odr::HZ_1;
+
+  // Metrics read from the HTS221. The other sensors don't provide any yet, so they are never powered up
+  static constexpr uint32_t HTS221_METRICS = TEMPERATURE_METRICS | metricBit(Metric::Humidity);
+
+  /**
+   * Only the sensors listed in the config's Devices are set up, the others are never addressed. The bus may be shared
+   * with boards on other channels of a mux, in which case every sensor is addressed through this board's channel.
+   */
+  SenseHat(const I2cConfig &config, i2c::Bus &bus, Logger logger = Logger{}) :
+      _logger(logger), _bus(bus) {
+    const std::optional<uint8_t> channel = config.MuxAddress != 0 ? std::optional(config.MuxChannel) : std::nullopt;
+
+    if ((config.Devices & I2cConfig::HTS221) != 0) {
+      this->_humiditySensor.emplace(this->_bus, "Humidity Sensor", channel, hts221::ADDRESS, hts221::SHADOWED);
+    }
+
+    if ((config.Devices & I2cConfig::LPS25HB) != 0) {
+      this->_pressureSensor.emplace(this->_bus, "Pressure Sensor", channel, lps25hb::ADDRESS, lps25hb::SHADOWED);
+    }
+
+    if ((config.Devices & I2cConfig::LSM9DS1) != 0) {
+      this->_magSensor.emplace(this->_bus,
+                               "Magnetometer Sensor",
+                               channel,
+                               lsm9ds1::mag::ADDRESS,
+                               lsm9ds1::mag::SHADOWED);
+      this->_gyroAccelSensor.emplace(this->_bus,
+                                     "Gyroscope/Accelerometer Sensor",
+                                     channel,
+                                     lsm9ds1::gyro::ADDRESS,
+                                     lsm9ds1::gyro::SHADOWED);
+    }
   }
 
   ~SenseHat() = default;
@@ -49,10 +90,22 @@ public:
 
     bool res = true;
 
-    res &= SenseHat::checkHardwareId(this->_humiditySensor, hts221::reg::WHO_AM_I, hts221::DEVICE_ID);
-    res &= SenseHat::checkHardwareId(this->_pressureSensor, lps25hb::reg::WHO_AM_I, lps25hb::DEVICE_ID);
-    res &= SenseHat::checkHardwareId(this->_magSensor, lsm9ds1::mag::reg::WHO_AM_I_M, lsm9ds1::mag::DEVICE_ID);
-    res &= SenseHat::checkHardwareId(this->_gyroAccelSensor, lsm9ds1::gyro::reg::WHO_AM_I, lsm9ds1::gyro::DEVICE_ID);
+    if (this->_humiditySensor) {
+      res &= this->checkHardwareId<hts221::registers::WHO_AM_I>(*this->_humiditySensor, hts221::DEVICE_ID);
+    }
+
+    if (this->_pressureSensor) {
+      res &= this->checkHardwareId<lps25hb::registers::WHO_AM_I>(*this->_pressureSensor, lps25hb::DEVICE_ID);
+    }
+
+    if (this->_magSensor) {
+      res &= this->checkHardwareId<lsm9ds1::mag::registers::WHO_AM_I_M>(*this->_magSensor, lsm9ds1::mag::DEVICE_ID);
+    }
+
+    if (this->_gyroAccelSensor) {
+      res &= this->checkHardwareId<lsm9ds1::gyro::registers::WHO_AM_I>(*this->_gyroAccelSensor,
+                                                                        lsm9ds1::gyro::DEVICE_ID);
+    }
 
     if (res) {
       this->_logger.info("✅ All SenseHat hardware components verified successfully");
@@ -63,12 +116,167 @@ public:
     }
   }
 
-  double readTemperature() const { return this->readTemperature(false); }
+  template <typename Fn>
+  void forEachDevice(Fn &&fn) const {
+    for (const std::optional<i2c::Device> *device :
+         {&this->_humiditySensor, &this->_pressureSensor, &this->_magSensor, &this->_gyroAccelSensor}) {
+      if (device->has_value()) {
+        fn(**device);
+      }
+    }
+  }
+
+  // The metrics that can be read right now, from sensors that are fitted and powered up
+  [[nodiscard]] uint32_t metrics() const noexcept {
+    return this->_humiditySensor && this->_humiditySensorActive ? SenseHat::HTS221_METRICS : 0;
+  }
+
+  /**
+   * Powers up the sensors that any of the metrics come from and powers down the others, so a sensor nothing consumes
+   * neither converts nor gets polled. Nothing is powered up before this is first called. Can be called again whenever
+   * what is consumed changes.
+   */
+  [[nodiscard]] i2c::Result<void> activate(uint32_t metrics) noexcept {
+    const bool active = (metrics & SenseHat::HTS221_METRICS) != 0;
+
+    // A sensor that is already inactive is still powered down, a previous run may have left it converting
+    if (!this->_humiditySensor || (active && this->_humiditySensorActive)) {
+      return {};
+    }
+
+    {
+      std::lock_guard lock(this->_readMutex);
+      this->_temperature = {};
+      this->_humidity = {};
+    }
+
+    this->_humiditySensorActive = active;
 
-  double readTemperature(bool asFahrenheit) const {
-    const uint8_t tempCalPoint0Lsb = this->_humiditySensor.readByte(hts221::reg::T0_degC_x8);
-    const uint8_t tempCalPoint1Lsb = this->_humiditySensor.readByte(hts221::reg::T1_degC_x8);
-    const uint8_t tempCalPointMsb = this->_humiditySensor.readByte(hts221::reg::T1_T0_MSB);
+    if (active) {
+      this->_logger.info("Powering up the {}", this->_humiditySensor->name());
+      return this->configure();
+    }
+
+    this->_logger.info("Powering down the {}, none of its metrics are consumed", this->_humiditySensor->name());
+
+    return this->_humiditySensor->write<hts221::registers::CTRL_REG1>(
+        hts221::fields::PD{0}, hts221::fields::BDU{1}, hts221::fields::ODR{SenseHat::ODR});
+  }
+
+  // Reads served from memory because the sensor couldn't have converted a new value since the last one
+  [[nodiscard]] const telemetry::Counter &cacheHits() const noexcept { return this->_cacheHits; }
+  [[nodiscard]] const telemetry::Counter &cacheMisses() const noexcept { return this->_cacheMisses; }
+
+  // A failed or nonsensical read comes back as an error for that reading alone, so the caller can carry on without it
+  [[nodiscard]] i2c::Result<double> readTemperature() const noexcept { return this->readTemperature(false); }
+
+  [[nodiscard]] i2c::Result<double> readTemperature(bool asFahrenheit) const noexcept {
+    if (const std::optional<i2c::BusError> error = this->unavailable()) {
+      return std::unexpected(*error);
+    }
+
+    const i2c::Result<double> temperature = this->cached(this->_temperature, [this] {
+      return this->measureTemperature();
+    });
+
+    if (!temperature || !asFahrenheit) {
+      return temperature;
+    }
+
+    return (*temperature * (9.0 / 5.0)) + 32.0;
+  }
+
+  [[nodiscard]] i2c::Result<double> readHumidity() const noexcept {
+    if (const std::optional<i2c::BusError> error = this->unavailable()) {
+      return std::unexpected(*error);
+    }
+
+    return this->cached(this->_humidity, [this] { return this->measureHumidity(); });
+  }
+
+private:
+  // A reading as it was last taken from the bus, along with when
+  struct CachedReading {
+    std::optional<double> value;
+    int64_t readAt{0};
+  };
+
+  Logger _logger;
+  i2c::Bus &_bus;
+  std::optional<i2c::Device> _humiditySensor;
+  std::optional<i2c::Device> _pressureSensor;
+  std::optional<i2c::Device> _magSensor;
+  std::optional<i2c::Device> _gyroAccelSensor;
+  SensorOffsets _offsets{};
+  mutable std::optional<uint32_t> _configuredGeneration; // None until the sensor was first set up
+  bool _humiditySensorActive{false};
+  mutable std::mutex _readMutex;
+  mutable CachedReading _temperature;
+  mutable CachedReading _humidity;
+  mutable telemetry::Counter _cacheHits;
+  mutable telemetry::Counter _cacheMisses;
+
+  struct HumiditySensorCalibration {};
+
+  // Readings from a sensor that isn't fitted fail with ENODEV, from one that is powered down with ENODATA
+  [[nodiscard]] std::optional<i2c::BusError> unavailable() const noexcept {
+    if (this->_humiditySensor && this->_humiditySensorActive) {
+      return std::nullopt;
+    }
+
+    return i2c::BusError{.operation = i2c::Operation::Validate,
+                         .error = this->_humiditySensor ? ENODATA : ENODEV,
+                         .address = hts221::ADDRESS,
+                         .reg = 0};
+  }
+
+  /**
+   * The HTS221 converts a new value once per ODR period, so reading it again within one only returns the same value
+   * over the bus. Such reads are served from memory instead. The lock is held across the bus read, so callers that
+   * come in while one is in flight wait for it and take its value rather than each reading the bus. Failures aren't
+   * kept, the next caller tries the bus again.
+   */
+  template <typename Measure>
+  [[nodiscard]] i2c::Result<double> cached(CachedReading &reading, Measure &&measure) const noexcept {
+    std::lock_guard lock(this->_readMutex);
+
+    const int64_t now = Timestamp::monotonicNow();
+
+    if (reading.value && now - reading.readAt < hts221::odr::period(SenseHat::ODR)) {
+      this->_cacheHits.increment();
+      return *reading.value;
+    }
+
+    this->_cacheMisses.increment();
+
+    const i2c::Result<double> result = measure();
+
+    if (result) {
+      reading = {.value = *result, .readAt = now};
+    }
+
+    return result;
+  }
+
+  [[nodiscard]] i2c::Result<double> measureTemperature() const noexcept {
+    namespace regs = hts221::registers;
+
+    if (const i2c::Result<void> configured = this->reconfigure(); !configured) {
+      return std::unexpected(configured.error());
+    }
+
+    const auto values = this->_humiditySensor->read<regs::T0_degC_x8,
+                                                   regs::T1_degC_x8,
+                                                   regs::T1_T0_MSB,
+                                                   regs::T0_OUT,
+                                                   regs::T1_OUT,
+                                                   regs::TEMP_OUT>();
+
+    if (!values) {
+      return std::unexpected(values.error());
+    }
+
+    const auto [tempCalPoint0Lsb, tempCalPoint1Lsb, tempCalPointMsb, temp0Raw, temp1Raw, tempRaw] = *values;
 
     const uint16_t tempCalPoint0Msb = (tempCalPointMsb & 0x03) << 8;
     const uint16_t tempCalPoint1Msb = (tempCalPointMsb & 0x0C) << 6;
@@ -79,47 +287,46 @@ public:
     const double tempCalPoint0 = static_cast<double>(tempCalPoint0_x8) / 8.0;
     const double tempCalPoint1 = static_cast<double>(tempCalPoint1_x8) / 8.0;
 
-    const int16_t temp0Raw = this->_humiditySensor.readShort(hts221::reg::T0_OUT_L, hts221::reg::T0_OUT_H);
-    const int16_t temp1Raw = this->_humiditySensor.readShort(hts221::reg::T1_OUT_L, hts221::reg::T1_OUT_H);
-    const int16_t tempRaw = this->_humiditySensor.readShort(hts221::reg::TEMP_OUT_L, hts221::reg::TEMP_OUT_H);
-
     if (temp0Raw == temp1Raw) {
-      this->_logger.error(std::format("Invalid temperature calibration data: T0_OUT and T1_OUT "
-                                      "raw values are identical ({}). Cannot "
-                                      "perform interpolation.",
-                                      temp0Raw));
-      return 0.0;
+      this->_logger.error("Invalid temperature calibration data: T0_OUT and T1_OUT "
+                          "raw values are identical ({}). Cannot "
+                          "perform interpolation.",
+                          temp0Raw);
+      return std::unexpected(this->_humiditySensor->invalid(regs::T0_OUT::ADDRESS));
     }
 
-    const double temperature = tempCalPoint0 +
-                               ((tempRaw - temp0Raw) * (tempCalPoint1 - tempCalPoint0) / (temp1Raw - temp0Raw));
+    return tempCalPoint0 + ((tempRaw - temp0Raw) * (tempCalPoint1 - tempCalPoint0) / (temp1Raw - temp0Raw));
+  }
 
-    if (!asFahrenheit) {
-      return temperature;
+  [[nodiscard]] i2c::Result<double> measureHumidity() const noexcept {
+    namespace regs = hts221::registers;
+
+    if (const i2c::Result<void> configured = this->reconfigure(); !configured) {
+      return std::unexpected(configured.error());
     }
 
-    return (temperature * (9.0 / 5.0)) + 32.0;
-  }
+    const auto values = this->_humiditySensor->read<regs::H0_rH_x2,
+                                                   regs::H1_rH_x2,
+                                                   regs::H0_T0_OUT,
+                                                   regs::H1_T0_OUT,
+                                                   regs::HUMIDITY_OUT>();
+
+    if (!values) {
+      return std::unexpected(values.error());
+    }
 
-  double readHumidity() const {
-    const uint8_t humidityCalPoint0_x2 = this->_humiditySensor.readByte(hts221::reg::H0_rH_x2);
-    const uint8_t humidityCalPoint1_x2 = this->_humiditySensor.readByte(hts221::reg::H1_rH_x2);
+    const auto [humidityCalPoint0_x2, humidityCalPoint1_x2, humidity0Raw, humidity1Raw, humidityRaw] = *values;
 
     const double humidityCalPoint0 = humidityCalPoint0_x2 / 2.0;
     const double humidityCalPoint1 = humidityCalPoint1_x2 / 2.0;
 
-    const int16_t humidity0Raw = this->_humiditySensor.readShort(hts221::reg::H0_T0_OUT_L, hts221::reg::H0_T0_OUT_H);
-    const int16_t humidity1Raw = this->_humiditySensor.readShort(hts221::reg::H1_T0_OUT_L, hts221::reg::H1_T0_OUT_H);
-    const int16_t humidityRaw = this->_humiditySensor.readShort(hts221::reg::HUMIDITY_OUT_L,
-                                                                hts221::reg::HUMIDITY_OUT_H);
-
     if (humidity0Raw == humidity1Raw) {
-      this->_logger.error(std::format("Invalid humidity calibration data: H1_T0_OUT and H0_T0_OUT "
-                                      "raw values are identical ({}). Cannot "
-                                      "perform interpolation.",
-                                      humidity0Raw));
+      this->_logger.error("Invalid humidity calibration data: H1_T0_OUT and H0_T0_OUT "
+                          "raw values are identical ({}). Cannot "
+                          "perform interpolation.",
+                          humidity0Raw);
 
-      return 0.0;
+      return std::unexpected(this->_humiditySensor->invalid(regs::H0_T0_OUT::ADDRESS));
     }
 
     const double humidity = humidityCalPoint0 +
@@ -129,29 +336,59 @@ public:
     return std::clamp(humidity, 0.0, 100.0);
   }
 
-private:
-  Logger _logger;
-  i2c::Bus _bus;
-  i2c::Device _humiditySensor;
-  i2c::Device _pressureSensor;
-  i2c::Device _magSensor;
-  i2c::Device _gyroAccelSensor;
-  SensorOffsets _offsets{};
+  [[nodiscard]] i2c::Result<void> configure() const noexcept {
+    if (!this->_humiditySensor) {
+      return {};
+    }
 
-  struct HumiditySensorCalibration {};
+    const i2c::Result<void> result = this->_humiditySensor->write<hts221::registers::CTRL_REG1>(
+        hts221::fields::PD{1}, hts221::fields::BDU{1}, hts221::fields::ODR{SenseHat::ODR});
+
+    if (result) {
+      this->_configuredGeneration = this->_bus.generation();
+    }
+
+    return result;
+  }
+
+  /**
+   * A reopened bus may be talking to sensors that were power cycled along with it, so they are set up again first. A
+   * sensor that failed to power up in activate() is tried again here too.
+   */
+  [[nodiscard]] i2c::Result<void> reconfigure() const noexcept {
+    if (this->_configuredGeneration == this->_bus.generation() || !this->_humiditySensorActive) {
+      return {};
+    }
+
+    if (this->_configuredGeneration) {
+      this->_logger.info("Setting up the {} again after the I2C bus was reopened", this->_humiditySensor->name());
+    } else {
+      this->_logger.info("Trying to power up the {} again", this->_humiditySensor->name());
+    }
+
+    return this->configure();
+  }
+
+  template <typename WhoAmI>
+  bool checkHardwareId(const i2c::Device &device, uint8_t expectedId) const {
+    const i2c::Result<uint8_t> id = device.read<WhoAmI>();
+
+    if (!id) {
+      this->_logger.error("❌ {} hardware ID could not be read: {}", device.name(), strerror(id.error().error));
+      return false;
+    }
 
-  bool checkHardwareId(const i2c::Device &device, uint8_t whoAmIReg, uint8_t expectedId) const {
-    const uint8_t actualId = device.readByte(whoAmIReg);
+    const uint8_t actualId = *id;
 
     if (expectedId != actualId) {
-      this->_logger.error(std::format("❌ {} hardware ID mismatch: expected 0x{:02X}, got 0x{:02X}",
-                                      device.name(),
-                                      expectedId,
-                                      actualId));
+      this->_logger.error("❌ {} hardware ID mismatch: expected 0x{:02X}, got 0x{:02X}",
+                          device.name(),
+                          expectedId,
+                          actualId);
       return false;
     }
 
-    this->_logger.info(std::format("✅ {} hardware ID verified: 0x{:02X}", device.name(), actualId));
+    this->_logger.info("✅ {} hardware ID verified: 0x{:02X}", device.name(), actualId);
 
     return true;
   }
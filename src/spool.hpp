@@ -0,0 +1,467 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "config.hpp"
+#include "sample.hpp"
+#include "telemetry.hpp"
+
+namespace spool {
+  constexpr uint64_t MAGIC = 0x4C4F4F5045534950; // "PISEPOOL" in little endian
+  constexpr uint32_t VERSION = 1;
+
+  struct SegmentHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t consumed; // Records already replayed, rewritten in place as replay moves forward
+  };
+
+  static_assert(std::is_trivially_copyable_v<Sample>);
+  static_assert(sizeof(SegmentHeader) % alignof(Sample) == 0);
+
+  /**
+   * Disk-backed queue of samples that a network sink couldn't deliver, kept in a directory of append-only segment
+   * files. Samples are appended with a plain `write` and only segments being sealed are synced, so spooling stays cheap
+   * and a healthy sink, which never touches its spool, pays nothing at all.
+   *
+   * Replay goes through sealed segments oldest first, straight out of a read-only mapping, at no more than
+   * `ReplayRate` samples per second so catching up after an outage doesn't crowd out live samples. How far replay got
+   * is stored in each segment's header, so a restart resumes where it left off. Once the spool exceeds `MaxSizeMb` the
+   * oldest segments are evicted.
+   */
+  class Spool {
+  public:
+    Spool(const SpoolConfig &config, std::string_view name, telemetry::Registry &registry) :
+        _directory(std::filesystem::path(config.Directory) / name),
+        _maxBytes(static_cast<size_t>(config.MaxSizeMb) * 1024 * 1024),
+        _segmentRecords(Spool::segmentRecords(config)),
+        _rate(config.ReplayRate),
+        _tokens(config.ReplayRate),
+        _lastRefill(Clock::now()) {
+      std::error_code error;
+      std::filesystem::create_directories(this->_directory, error);
+
+      if (error) {
+        spdlog::error("Failed to create spool directory {}: {}", this->_directory.string(), error.message());
+        throw std::runtime_error("Failed to create spool directory");
+      }
+
+      this->recover();
+
+      registry.counter(std::format("pisense_{}_spooled_total", name),
+                       "Samples written to the disk spool while the destination was unavailable",
+                       this->_spooled);
+      registry.counter(std::format("pisense_{}_spool_replayed_total", name),
+                       "Spooled samples handed back for delivery",
+                       this->_replayed);
+      registry.counter(std::format("pisense_{}_spool_dropped_total", name),
+                       "Spooled samples evicted to stay within MaxSizeMb, or that couldn't be written",
+                       this->_dropped);
+      registry.gauge(std::format("pisense_{}_spool_samples", name), "Samples waiting in the disk spool", [this] {
+        return static_cast<double>(this->_size.load(std::memory_order_relaxed));
+      });
+      registry.gauge(std::format("pisense_{}_spool_bytes", name), "Size of the disk spool", [this] {
+        return static_cast<double>(this->_diskBytes.load(std::memory_order_relaxed));
+      });
+    }
+
+    ~Spool() {
+      this->seal();
+      this->unmap();
+    }
+
+    Spool(const Spool &) = delete;
+    Spool &operator=(const Spool &) = delete;
+
+    [[nodiscard]] bool empty() const { return this->_records == 0; }
+
+    [[nodiscard]] size_t size() const { return this->_records; }
+
+    void append(std::span<const Sample> samples) {
+      while (!samples.empty()) {
+        if (this->_tailFd < 0 && !this->openTail()) {
+          this->_dropped.increment(samples.size());
+          return;
+        }
+
+        Segment &tail = this->_segments.back();
+        const size_t count = std::min(samples.size(), this->_segmentRecords - tail.records);
+        const size_t written = this->writeRecords(samples.first(count));
+
+        tail.records += written;
+        tail.bytes += written * sizeof(Sample);
+        this->_records += written;
+        this->_bytes += written * sizeof(Sample);
+        this->_spooled.increment(written);
+
+        if (written < count) {
+          spdlog::warn("Failed to write to spool {}: {}", this->_directory.string(), strerror(errno));
+          this->_dropped.increment(samples.size() - written);
+          this->seal();
+          break;
+        }
+
+        if (tail.records == this->_segmentRecords) {
+          this->seal();
+        }
+
+        samples = samples.subspan(count);
+      }
+
+      this->evict();
+      this->publishSize();
+    }
+
+    /**
+     * Hands the oldest spooled samples to `fn`, in order and in one or more contiguous spans, up to `limit` and
+     * whatever the replay rate allows right now. Handed over samples are gone from the spool. Returns how many.
+     */
+    template <typename Fn>
+    size_t replay(size_t limit, Fn &&fn) {
+      if (this->_records == 0) {
+        return 0;
+      }
+
+      const size_t budget = std::min(limit, this->budget());
+      size_t replayed = 0;
+
+      while (replayed < budget && !this->_segments.empty()) {
+        Segment &head = this->_segments.front();
+
+        if (head.consumed == head.records) {
+          if (this->_tailFd >= 0 && this->_segments.size() == 1) {
+            break;
+          }
+
+          this->remove();
+          continue;
+        }
+
+        // Only sealed segments are mapped, so the mapping never has to follow a growing file
+        if (this->_tailFd >= 0 && this->_segments.size() == 1) {
+          this->seal();
+        }
+
+        if (!this->map()) {
+          this->_records -= head.records - head.consumed;
+          this->_dropped.increment(head.records - head.consumed);
+          this->remove();
+          continue;
+        }
+
+        const size_t count = std::min(budget - replayed, head.records - head.consumed);
+        const auto *records = reinterpret_cast<const Sample *>(this->_map + sizeof(SegmentHeader));
+
+        fn(std::span<const Sample>(records + head.consumed, count));
+
+        head.consumed += count;
+        this->_records -= count;
+        replayed += count;
+
+        if (head.consumed == head.records) {
+          this->remove();
+        } else {
+          this->storeConsumed(head);
+        }
+      }
+
+      if (this->_rate > 0) {
+        this->_tokens -= static_cast<double>(replayed);
+      }
+
+      this->_replayed.increment(replayed);
+      this->publishSize();
+
+      return replayed;
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Segment {
+      uint64_t index;
+      size_t records{0};
+      size_t consumed{0};
+      size_t bytes{sizeof(SegmentHeader)};
+    };
+
+    std::filesystem::path _directory;
+    size_t _maxBytes;
+    size_t _segmentRecords;
+    uint32_t _rate;
+    double _tokens;
+    Clock::time_point _lastRefill;
+    std::deque<Segment> _segments; // Oldest first; the last one is still being appended to while `_tailFd` is open
+    uint64_t _nextIndex{1};
+    int _tailFd{-1};
+    int _headFd{-1};
+    uint64_t _mappedIndex{0};
+    const std::byte *_map{nullptr};
+    size_t _mapSize{0};
+    size_t _records{0};
+    size_t _bytes{0};
+    std::atomic<size_t> _size{0};
+    std::atomic<size_t> _diskBytes{0};
+    telemetry::Counter _spooled;
+    telemetry::Counter _replayed;
+    telemetry::Counter _dropped;
+
+    [[nodiscard]] static size_t segmentRecords(const SpoolConfig &config) {
+      const size_t segmentBytes = static_cast<size_t>(std::min(config.SegmentSizeMb, config.MaxSizeMb)) * 1024 * 1024;
+      return std::max<size_t>((segmentBytes - std::min(segmentBytes, sizeof(SegmentHeader))) / sizeof(Sample), 1);
+    }
+
+    [[nodiscard]] std::filesystem::path path(uint64_t index) const {
+      return this->_directory / std::format("{:020}.spool", index);
+    }
+
+    // Token bucket holding at most one second's worth of replay
+    [[nodiscard]] size_t budget() {
+      if (this->_rate == 0) {
+        return SIZE_MAX;
+      }
+
+      const Clock::time_point now = Clock::now();
+      const double elapsed = std::chrono::duration<double>(now - this->_lastRefill).count();
+
+      this->_lastRefill = now;
+      this->_tokens = std::min(this->_tokens + (elapsed * this->_rate), static_cast<double>(this->_rate));
+
+      return static_cast<size_t>(std::max(this->_tokens, 0.0));
+    }
+
+    // Picks up the segments a previous run left behind, dropping any that are fully replayed or unreadable
+    void recover() {
+      std::vector<uint64_t> indices;
+
+      for (const auto &entry : std::filesystem::directory_iterator(this->_directory)) {
+        const std::string stem = entry.path().stem().string();
+        uint64_t index = 0;
+        const auto [end, error] = std::from_chars(stem.data(), stem.data() + stem.size(), index);
+
+        if (entry.path().extension() == ".spool" && error == std::errc{} && end == stem.data() + stem.size()) {
+          indices.push_back(index);
+        }
+      }
+
+      std::ranges::sort(indices);
+
+      for (const uint64_t index : indices) {
+        const std::string path = this->path(index).string();
+        Segment segment{.index = index};
+        SegmentHeader header{};
+
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat info{};
+
+        const bool valid = fd >= 0 && ::pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                           ::fstat(fd, &info) == 0 && header.magic == MAGIC && header.version == VERSION &&
+                           header.recordSize == sizeof(Sample);
+
+        if (fd >= 0) {
+          ::close(fd);
+        }
+
+        if (!valid) {
+          spdlog::warn("Discarding unreadable spool segment {}", path);
+          ::unlink(path.c_str());
+          continue;
+        }
+
+        // A record cut short by a crash mid-write is ignored
+        segment.records = (static_cast<size_t>(info.st_size) - sizeof(SegmentHeader)) / sizeof(Sample);
+        segment.consumed = std::min<size_t>(header.consumed, segment.records);
+        segment.bytes = static_cast<size_t>(info.st_size);
+
+        if (segment.consumed == segment.records) {
+          ::unlink(path.c_str());
+          continue;
+        }
+
+        this->_records += segment.records - segment.consumed;
+        this->_bytes += segment.bytes;
+        this->_segments.push_back(segment);
+      }
+
+      if (!indices.empty()) {
+        this->_nextIndex = indices.back() + 1;
+      }
+
+      if (this->_records > 0) {
+        spdlog::info("Recovered {} spooled samples from {}", this->_records, this->_directory.string());
+      }
+
+      this->publishSize();
+    }
+
+    bool openTail() {
+      const uint64_t index = this->_nextIndex++;
+      const std::string path = this->path(index).string();
+      this->_tailFd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+
+      const SegmentHeader header{.magic = MAGIC, .version = VERSION, .recordSize = sizeof(Sample), .consumed = 0};
+
+      if (this->_tailFd < 0 || ::write(this->_tailFd, &header, sizeof(header)) != sizeof(header)) {
+        spdlog::warn("Failed to create spool segment {}: {}", path, strerror(errno));
+
+        if (this->_tailFd >= 0) {
+          ::close(this->_tailFd);
+          ::unlink(path.c_str());
+          this->_tailFd = -1;
+        }
+
+        return false;
+      }
+
+      this->_segments.push_back({.index = index});
+      this->_bytes += sizeof(SegmentHeader);
+
+      return true;
+    }
+
+    // Returns how many whole records made it to the file
+    size_t writeRecords(std::span<const Sample> samples) {
+      const auto *data = reinterpret_cast<const char *>(samples.data());
+      const size_t size = samples.size_bytes();
+      size_t written = 0;
+
+      while (written < size) {
+        const ssize_t result = ::write(this->_tailFd, data + written, size - written);
+
+        if (result < 0 && errno == EINTR) {
+          continue;
+        }
+
+        if (result <= 0) {
+          break;
+        }
+
+        written += static_cast<size_t>(result);
+      }
+
+      return written / sizeof(Sample);
+    }
+
+    // Only happens while the destination is unavailable, so the sync never lands on a healthy sink's path
+    void seal() {
+      if (this->_tailFd < 0) {
+        return;
+      }
+
+      ::fdatasync(this->_tailFd);
+      ::close(this->_tailFd);
+      this->_tailFd = -1;
+    }
+
+    bool map() {
+      const Segment &head = this->_segments.front();
+
+      if (this->_map != nullptr && this->_mappedIndex == head.index) {
+        return true;
+      }
+
+      this->unmap();
+
+      const std::string path = this->path(head.index).string();
+      this->_headFd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+      this->_mapSize = sizeof(SegmentHeader) + (head.records * sizeof(Sample));
+
+      void *map = this->_headFd >= 0 ? ::mmap(nullptr, this->_mapSize, PROT_READ, MAP_SHARED, this->_headFd, 0)
+                                     : MAP_FAILED;
+
+      if (map == MAP_FAILED) {
+        spdlog::warn("Failed to map spool segment {}, dropping it: {}", path, strerror(errno));
+        this->unmap();
+        return false;
+      }
+
+      ::madvise(map, this->_mapSize, MADV_SEQUENTIAL);
+
+      this->_map = static_cast<const std::byte *>(map);
+      this->_mappedIndex = head.index;
+
+      return true;
+    }
+
+    void unmap() {
+      if (this->_map != nullptr) {
+        ::munmap(const_cast<std::byte *>(this->_map), this->_mapSize);
+        this->_map = nullptr;
+      }
+
+      if (this->_headFd >= 0) {
+        ::close(this->_headFd);
+        this->_headFd = -1;
+      }
+    }
+
+    void storeConsumed(const Segment &segment) const {
+      const uint64_t consumed = segment.consumed;
+      ::pwrite(this->_headFd, &consumed, sizeof(consumed), offsetof(SegmentHeader, consumed));
+    }
+
+    // Deletes the oldest segment
+    void remove() {
+      const Segment &head = this->_segments.front();
+
+      if (this->_mappedIndex == head.index) {
+        this->unmap();
+        this->_mappedIndex = 0;
+      }
+
+      if (this->_tailFd >= 0 && this->_segments.size() == 1) {
+        ::close(this->_tailFd);
+        this->_tailFd = -1;
+      }
+
+      ::unlink(this->path(head.index).c_str());
+      this->_bytes -= std::min(this->_bytes, head.bytes);
+      this->_segments.pop_front();
+    }
+
+    void evict() {
+      size_t evicted = 0;
+
+      while (this->_bytes > this->_maxBytes && !this->_segments.empty()) {
+        const Segment &head = this->_segments.front();
+        evicted += head.records - head.consumed;
+        this->_records -= head.records - head.consumed;
+        this->remove();
+      }
+
+      if (evicted > 0) {
+        spdlog::warn("Spool {} is full, evicted the oldest {} samples", this->_directory.string(), evicted);
+        this->_dropped.increment(evicted);
+      }
+    }
+
+    void publishSize() {
+      this->_size.store(this->_records, std::memory_order_relaxed);
+      this->_diskBytes.store(this->_bytes, std::memory_order_relaxed);
+    }
+  };
+} // namespace spool
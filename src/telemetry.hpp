@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace telemetry {
+  class Counter {
+  public:
+    void increment(uint64_t amount = 1) noexcept { this->_value.fetch_add(amount, std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t value() const noexcept { return this->_value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> _value{0};
+  };
+
+  /**
+   * Distribution of durations over fixed buckets, from 10 µs to 10 s. Observing is two relaxed atomic adds, so it can
+   * sit on the sampling path.
+   */
+  class Histogram {
+  public:
+    static constexpr std::array<double, 19> BUCKETS{
+        0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+        0.025,   0.05,     0.1,     0.25,   0.5,     1.0,    2.5,   5.0,    10.0,
+    };
+
+    void observe(int64_t nanoseconds) noexcept {
+      nanoseconds = std::max<int64_t>(nanoseconds, 0);
+
+      const double seconds = static_cast<double>(nanoseconds) / 1e9;
+      const auto bucket = static_cast<size_t>(std::ranges::lower_bound(BUCKETS, seconds) - BUCKETS.begin());
+
+      this->_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      this->_sum.fetch_add(static_cast<uint64_t>(nanoseconds), std::memory_order_relaxed);
+    }
+
+    // Observations that fell in a single bucket, not cumulative; the one past BUCKETS is everything above 10 s
+    [[nodiscard]] uint64_t bucket(size_t index) const noexcept {
+      return this->_buckets[index].load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t count() const noexcept {
+      uint64_t count = 0;
+
+      for (const std::atomic<uint64_t> &bucket : this->_buckets) {
+        count += bucket.load(std::memory_order_relaxed);
+      }
+
+      return count;
+    }
+
+    [[nodiscard]] double sum() const noexcept {
+      return static_cast<double>(this->_sum.load(std::memory_order_relaxed)) / 1e9;
+    }
+
+  private:
+    std::array<std::atomic<uint64_t>, BUCKETS.size() + 1> _buckets{};
+    std::atomic<uint64_t> _sum{0}; // Nanoseconds
+  };
+
+  /**
+   * Log-linear distribution of durations in the spirit of HdrHistogram: every power of two is split into 8 linear
+   * sub-buckets, so any duration from 1 ns to about 18 minutes is kept within 12.5% in a fixed 2.4 KB. Recording is
+   * a couple of relaxed atomic ops, and percentiles are read back without stopping the writer.
+   */
+  class HdrHistogram {
+  public:
+    void record(int64_t nanoseconds) noexcept {
+      const auto value = static_cast<uint64_t>(std::clamp<int64_t>(nanoseconds, 0, MAX_VALUE));
+
+      this->_buckets[HdrHistogram::index(value)].fetch_add(1, std::memory_order_relaxed);
+
+      uint64_t max = this->_max.load(std::memory_order_relaxed);
+      while (value > max && !this->_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+      }
+    }
+
+    [[nodiscard]] uint64_t count() const noexcept {
+      uint64_t count = 0;
+
+      for (const std::atomic<uint64_t> &bucket : this->_buckets) {
+        count += bucket.load(std::memory_order_relaxed);
+      }
+
+      return count;
+    }
+
+    [[nodiscard]] uint64_t max() const noexcept { return this->_max.load(std::memory_order_relaxed); }
+
+    // Upper bound of the bucket holding the given quantile (0-1), in nanoseconds; 0 when nothing was recorded
+    [[nodiscard]] uint64_t percentile(double quantile) const noexcept {
+      const uint64_t count = this->count();
+
+      if (count == 0) {
+        return 0;
+      }
+
+      const auto rank = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(count))), 1);
+      uint64_t seen = 0;
+
+      for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += this->_buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= rank) {
+          return std::min(HdrHistogram::upperBound(i), this->max());
+        }
+      }
+
+      return this->max();
+    }
+
+  private:
+    static constexpr unsigned SUB_BUCKET_BITS = 3;
+    static constexpr unsigned SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+    static constexpr unsigned MAX_BITS = 40;
+    static constexpr int64_t MAX_VALUE = (int64_t{1} << MAX_BITS) - 1;
+    static constexpr size_t BUCKET_COUNT = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> _buckets{};
+    std::atomic<uint64_t> _max{0};
+
+    // Values below SUB_BUCKETS get a bucket each, above that the top SUB_BUCKET_BITS after the leading bit pick one
+    [[nodiscard]] static size_t index(uint64_t value) noexcept {
+      if (value < SUB_BUCKETS) {
+        return value;
+      }
+
+      const unsigned exponent = std::bit_width(value) - 1;
+      const uint64_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+      return ((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS) + sub;
+    }
+
+    [[nodiscard]] static uint64_t upperBound(size_t index) noexcept {
+      if (index < SUB_BUCKETS) {
+        return index;
+      }
+
+      const unsigned exponent = (index / SUB_BUCKETS) + SUB_BUCKET_BITS - 1;
+      const uint64_t lower = (SUB_BUCKETS + (index % SUB_BUCKETS)) << (exponent - SUB_BUCKET_BITS);
+
+      return lower + (uint64_t{1} << (exponent - SUB_BUCKET_BITS)) - 1;
+    }
+  };
+
+  enum class Kind : uint8_t { Counter, Gauge, Histogram };
+
+  // A Prometheus label pair, e.g. `bus="hat"`, for telling apart entries of the same name
+  [[nodiscard]] inline std::string label(std::string_view key, std::string_view value) {
+    return std::format("{}=\"{}\"", key, value);
+  }
+
+  /**
+   * Internal counters, gauges and histograms exposed by exporters alongside sensor readings. Everything is registered
+   * during startup; afterwards the registry is only read, so exporters can iterate it without locking. Components that
+   * exist once per bus register under the same name with their own labels.
+   */
+  class Registry {
+  public:
+    struct Entry {
+      std::string name;
+      std::string help;
+      Kind kind;
+      std::function<double()> read;
+      const Histogram *histogram{nullptr};
+      std::string labels{};
+    };
+
+    void counter(std::string name, std::string help, const Counter &counter, std::string labels = {}) {
+      this->_entries.push_back({std::move(name), std::move(help), Kind::Counter, [&counter] {
+                                  return static_cast<double>(counter.value());
+                                }, nullptr, std::move(labels)});
+    }
+
+    void gauge(std::string name, std::string help, std::function<double()> read, std::string labels = {}) {
+      this->_entries.push_back({std::move(name), std::move(help), Kind::Gauge, std::move(read), nullptr,
+                                std::move(labels)});
+    }
+
+    void histogram(std::string name, std::string help, const Histogram &histogram, std::string labels = {}) {
+      this->_entries.push_back({std::move(name), std::move(help), Kind::Histogram, [&histogram] {
+                                  return static_cast<double>(histogram.count());
+                                }, &histogram, std::move(labels)});
+    }
+
+    [[nodiscard]] const std::vector<Entry> &entries() const { return this->_entries; }
+
+  private:
+    std::vector<Entry> _entries;
+  };
+} // namespace telemetry
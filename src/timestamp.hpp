@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+/**
+ * A point in time read from both clocks at once: `monotonic` orders events and measures latency within the process,
+ * `realtime` is what gets exported. Both are vDSO reads on Linux, so stamping costs no syscall.
+ */
+struct Timestamp {
+  int64_t monotonic; // CLOCK_MONOTONIC in nanoseconds
+  int64_t realtime;  // Unix time in nanoseconds
+
+  [[nodiscard]] static Timestamp now() noexcept {
+    return {.monotonic = Timestamp::read(CLOCK_MONOTONIC), .realtime = Timestamp::read(CLOCK_REALTIME)};
+  }
+
+  [[nodiscard]] static int64_t monotonicNow() noexcept { return Timestamp::read(CLOCK_MONOTONIC); }
+
+private:
+  [[nodiscard]] static int64_t read(clockid_t clock) noexcept {
+    timespec time{};
+    ::clock_gettime(clock, &time);
+    return (static_cast<int64_t>(time.tv_sec) * 1'000'000'000LL) + time.tv_nsec;
+  }
+};